@@ -1,134 +1,187 @@
+/*
+ *  Brighten a PPM or PGM image: newimg = img*alpha + beta, saturated
+ *
+ *  Usage: brighten [-a alpha] [-b beta] [-k scalar|lut|fixed] [-t threads]
+ *                  [-o output.ppm] [-B [-n iterations] [-s WxH]] image.ppm
+ *
+ *  Defaults are alpha 1.25, beta 25, the lut kernel on one thread, written
+ *  to brighter.ppm, which is the same image the original triple loop made.
+ *  The input is mapped rather than read and the output file is created at
+ *  its final size and mapped, so the kernels read from and write to the
+ *  page cache with no copy through a buffer of our own.
+ *
+ *  -B benchmarks every kernel on the image, and on a WxH synthetic frame if
+ *  -s is given, at 1, 2, 4 ... up to -t threads.  For the same image in
+ *  OpenCV's convertTo, run ../opencv-brighten/brighten with matching
+ *  alpha and beta.
+ */
 #include <stdio.h>
 #include <stdlib.h>
-#include <ctype.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
-void readppm(unsigned char *buffer, int *bufferlen, 
-             char *header, int *headerlen,
-             unsigned *rows, unsigned *cols, unsigned *chans,
-             char *file)
-{
-    char *aline=NULL;  size_t linelen; FILE *filep;
-    char magic[2]; unsigned col, row, sat, channels=3;
-    int nread=0, toread=0, fd=0;
-    *headerlen=0;
-
-    filep=fopen(file, "r");
-
-    // read and validate header
-    if((*headerlen += getline(&aline, &linelen, filep)) < 0)
-        {perror("getline"); exit(-1);}
-    strcat(header, aline);
-    sscanf(aline, "%s", magic);
-    if(strncmp(magic, "P6", 2) == 0) channels=3; else channels=1;
-
-    // ignore comment line or print for debug
-    if((*headerlen += getline(&aline, &linelen, filep)) < 0)
-        {perror("getline"); exit(-1);}
-    strcat(header, aline);
-
-    if((*headerlen += getline(&aline, &linelen, filep)) < 0)
-        {perror("getline"); exit(-1);}
-    sscanf(aline, "%u %u", &col, &row);
-    strcat(header, aline);
-    *bufferlen=row*col*channels;  toread=*bufferlen;
-    *rows=row, *cols=col, *chans=channels;
-
-    if((*headerlen += getline(&aline, &linelen, filep)) < 0)
-        {perror("getline"); exit(-1);}
-    sscanf(aline, "%u", &sat);
-    strcat(header, aline);
-
-    printf("%s", header);
-
-    printf("read %d bytes, buffer=%p, toread=%d\n", nread, buffer, toread);
-
-    do
-    {
-        if((nread=fread(buffer, 1, (col*row*channels), filep)) == 0)
-        { 
-            if(feof(filep))
-                { printf("completed readppm\n"); break; }
-            else
-                { perror("readppm"); exit(-1); }
-        }
+#include "brightlib.h"
+#include "../pnmio/pnmio.h"
 
-        buffer+=nread;
-        toread=toread-nread;
-        printf("read %d bytes, buffer=%p, toread=%d\n", nread, buffer, toread);
-    } while(toread > 0 && (!feof(filep)));
+#define DEFAULT_ITERATIONS (100)
 
-    printf("readppm done\n\n");
-    close(filep);
+
+static double now_msec(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return ((double)t.tv_sec * 1000.0) + ((double)t.tv_nsec / 1000000.0);
 }
 
 
-void writeppm(unsigned char *buffer, int bufferlen,
-              char *header, int headerlen,
-              char *file)
+// msec per frame for one kernel and thread count, and how many samples differ from ref
+static double bench_one(const struct bright_params_t *p, bright_kernel_t kernel, int threads,
+                        const unsigned char *img, unsigned char *newimg, const unsigned char *ref,
+                        unsigned rows, size_t row_bytes, int iterations, size_t *mismatches)
 {
-    FILE *filep;
-    int nwritten=0, towrite=0;
+    struct bright_pool_t pool;
+    size_t bytes = (size_t)rows * row_bytes, i;
+    double start, elapsed;
+    int it;
 
-    filep=fopen(file, "w");
+    if(bright_pool_start(&pool, threads) < 0)
+        return -1.0;
 
-    printf("wrote %d bytes, header=%p, towrite=%d\n", nwritten, header, towrite);
+    // once untimed, to fault in the output pages and start the workers
+    bright_pool_run(&pool, p, kernel, img, newimg, rows, row_bytes);
 
-    do
-    {
-        if((nwritten=fwrite(header, 1, headerlen, filep)) == 0)
-        { 
-            if(feof(filep))
-                { printf("completed writeppm header\n"); break; }
-            else
-                { perror("writeppm header"); exit(-1); }
-        }
+    start = now_msec();
+    for(it = 0; it < iterations; it++)
+        bright_pool_run(&pool, p, kernel, img, newimg, rows, row_bytes);
+    elapsed = (now_msec() - start) / iterations;
 
-        header+=nwritten;
-        towrite=towrite-nwritten;
-        printf("wrote %d bytes, header=%p, towrite=%d\n", nwritten, header, towrite);
-    } while(towrite > 0);
-    towrite=0; nwritten=0;
-
-    printf("wrote %d bytes, buffer=%p, towrite=%d\n", nwritten, buffer, towrite);
-    do
-    {
-        if((nwritten=fwrite(buffer, 1, bufferlen, filep)) == 0)
-        { 
-            if(feof(filep))
-                { printf("completed writeppm\n"); break; }
-            else
-                { perror("writeppm"); exit(-1); }
-        }
+    bright_pool_stop(&pool);
 
-        buffer+=nwritten;
-        towrite=towrite-nwritten;
-        printf("wrote %d bytes, buffer=%p, towrite=%d\n", nwritten, buffer, towrite);
-    } while(towrite > 0);
+    *mismatches = 0;
+    if(ref)
+        for(i = 0; i < bytes; i++)
+            if(newimg[i] != ref[i]) (*mismatches)++;
 
-    close(filep);
+    return elapsed;
 }
 
 
-#define PIXIDX ((i*col*chan)+(j*chan)+k)
-#define SAT (255)
+static void bench(const struct bright_params_t *p, const char *name, const unsigned char *img,
+                  unsigned rows, unsigned cols, unsigned chans, int max_threads, int iterations)
+{
+    size_t row_bytes = (size_t)cols * chans, bytes = rows * row_bytes, mismatches;
+    unsigned char *newimg = bright_alloc(bytes), *ref = bright_alloc(bytes);
+    double scalar_msec, msec;
+    int k, threads;
+
+    if(!newimg || !ref)
+        exit(-1);
+
+    printf("%s: %ux%u, %u channel(s), %.2f MB, %d iterations, alpha=%.3f beta=%d\n",
+           name, cols, rows, chans, bytes / 1.0e6, iterations, p->alpha, p->beta);
+
+    scalar_msec = bench_one(p, BRIGHT_SCALAR, 1, img, ref, NULL, rows, row_bytes, iterations, &mismatches);
+    printf("  %-6s %2d thread(s) %8.3f msec %8.1f MB/s\n", bright_kernel_name(BRIGHT_SCALAR), 1,
+           scalar_msec, bytes / 1.0e3 / scalar_msec);
+
+    for(k = BRIGHT_LUT; k < BRIGHT_KERNELS; k++)
+        for(threads = 1; ; threads = threads * 2 < max_threads ? threads * 2 : max_threads)
+        {
+            msec = bench_one(p, (bright_kernel_t)k, threads, img, newimg, ref, rows, row_bytes, iterations, &mismatches);
+            printf("  %-6s %2d thread(s) %8.3f msec %8.1f MB/s  %5.1fx scalar  %zu samples differ\n",
+                   bright_kernel_name((bright_kernel_t)k), threads, msec, bytes / 1.0e3 / msec,
+                   scalar_msec / msec, mismatches);
+
+            if(threads >= max_threads) break;
+        }
+
+    bright_free(newimg, bytes);
+    bright_free(ref, bytes);
+}
 
-void main(int argc, char *argv[])
+
+static void usage(const char *prog)
 {
-  char header[512];
-  unsigned char img[640*480*3], newimg[640*480*3];
-  int bufflen, hdrlen; unsigned row=0, col=0, chan=0, pix; int i, j, k;
-  double alpha=1.25;  unsigned char beta=25;
+    fprintf(stderr, "Usage: %s [-a alpha] [-b beta] [-k scalar|lut|fixed] [-t threads]\n"
+                    "       [-o output.ppm] [-B [-n iterations] [-s WxH]] image.ppm\n", prog);
+    exit(-1);
+}
 
-  header[0]='\0';
-  readppm(img, &bufflen, header, &hdrlen, &row, &col, &chan, argv[1]);
 
-  for(i=0; i < row; i++)
-    for(j=0; j < col; j++)
-      for(k=0; k < chan; k++)
+int main(int argc, char *argv[])
+{
+  char *outfile="brighter.ppm";
+  struct pnm_image_t img, newimg;
+  double alpha=1.25;  int beta=25;
+  int threads=1, iterations=DEFAULT_ITERATIONS, benchmark=0, opt;
+  unsigned synth_cols=0, synth_rows=0;
+  bright_kernel_t kernel=BRIGHT_LUT;
+  struct bright_params_t params;
+  struct bright_pool_t pool;
+  double start;
+
+  while((opt = getopt(argc, argv, "a:b:k:t:o:Bn:s:h")) != -1)
+  {
+      switch(opt)
       {
-          newimg[PIXIDX] = (pix=(unsigned)((img[PIXIDX])*alpha)+beta) > SAT ? SAT : pix;
+          case 'a': alpha=atof(optarg); break;
+          case 'b': beta=atoi(optarg); break;
+          case 'k': if(bright_kernel_parse(optarg, &kernel) < 0) usage(argv[0]); break;
+          case 't': threads=atoi(optarg); break;
+          case 'o': outfile=optarg; break;
+          case 'B': benchmark=1; break;
+          case 'n': iterations=atoi(optarg); break;
+          case 's': if(sscanf(optarg, "%ux%u", &synth_cols, &synth_rows) != 2) usage(argv[0]); break;
+          default:  usage(argv[0]);
       }
+  }
+  if(optind >= argc || iterations < 1)
+      usage(argv[0]);
+
+  if(bright_params(&params, alpha, beta) < 0)
+      {fprintf(stderr, "alpha must be >= 0 and beta -255..255\n"); exit(-1);}
+
+  if(pnm_map(&img, argv[optind]) < 0)
+      exit(-1);
+  printf("%s: P%d %ux%u%s%s\n", argv[optind], img.format, img.width, img.height,
+         img.comment[0] ? ", #" : "", img.comment);
+
+  if(benchmark)
+  {
+      bench(&params, argv[optind], img.pixels, img.height, img.width, img.channels, threads, iterations);
+
+      if(synth_cols && synth_rows)
+      {
+          size_t bytes = (size_t)synth_cols * synth_rows * 3, i;
+          unsigned char *synth = bright_alloc(bytes);
+
+          if(!synth) exit(-1);
+          for(i = 0; i < bytes; i++)
+              synth[i] = (unsigned char)rand();
+
+          bench(&params, "synthetic", synth, synth_rows, synth_cols, 3, threads, iterations);
+          bright_free(synth, bytes);
+      }
+  }
+
+  // the input's header, as long as it was laid out the usual way
+  if(pnm_create(&newimg, outfile, img.format, img.width, img.height, img.comment) < 0)
+      exit(-1);
+
+  if(bright_pool_start(&pool, threads) < 0)
+      {fprintf(stderr, "threads must be 1..%d\n", BRIGHT_MAX_THREADS); exit(-1);}
+
+  start = now_msec();
+  bright_pool_run(&pool, &params, kernel, img.pixels, newimg.pixels, img.height, (size_t)img.width * img.channels);
+  printf("%s kernel, %d thread(s): %.3f msec\n", bright_kernel_name(kernel), threads, now_msec() - start);
+  bright_pool_stop(&pool);
+
+  printf("wrote %s, %zu bytes\n", outfile, newimg.header_len + newimg.bytes);
+
+  pnm_unmap(&img);
+  pnm_unmap(&newimg);
 
-  writeppm(newimg, bufflen, header, hdrlen, "brighter.ppm");
+  return 0;
 }
@@ -0,0 +1,257 @@
+/*
+ *  Brightness/contrast engine, see brightlib.h
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/mman.h>
+
+#include "brightlib.h"
+
+#define SAT (255)
+
+static const char *kernel_names[BRIGHT_KERNELS] = { "scalar", "lut", "fixed" };
+
+
+int bright_params(struct bright_params_t *p, double alpha, int beta)
+{
+    int i, pix;
+
+    if(alpha < 0.0 || beta < -SAT || beta > SAT)
+        return -1;
+
+    p->alpha = alpha;
+    p->beta = beta;
+
+    // rounded up, so the fixed kernel is never below the double result
+    p->fixed_ok = alpha <= BRIGHT_FIXED_MAX_ALPHA;
+    if(p->fixed_ok)
+    {
+        uint32_t q16 = (uint32_t)ceil(alpha * 65536.0);
+
+        p->alpha_int = q16 >> 16;
+        p->alpha_frac = q16 & 0xffff;
+    }
+
+    for(i = 0; i < 256; i++)
+    {
+        pix = (int)(i * alpha) + beta;
+        p->lut[i] = pix > SAT ? SAT : (pix < 0 ? 0 : pix);
+    }
+
+    return 0;
+}
+
+
+static void run_scalar(const struct bright_params_t *p, const unsigned char *in, unsigned char *out, size_t bytes)
+{
+    size_t i; int pix;
+
+    for(i = 0; i < bytes; i++)
+    {
+        pix = (int)(in[i] * p->alpha) + p->beta;
+        out[i] = pix > SAT ? SAT : (pix < 0 ? 0 : pix);
+    }
+}
+
+
+static void run_lut(const struct bright_params_t *p, const unsigned char *in, unsigned char *out, size_t bytes)
+{
+    const unsigned char *lut = p->lut;
+    size_t i;
+
+    // unrolled by hand so the loads of independent samples overlap
+    for(i = 0; i + 4 <= bytes; i += 4)
+    {
+        out[i]   = lut[in[i]];
+        out[i+1] = lut[in[i+1]];
+        out[i+2] = lut[in[i+2]];
+        out[i+3] = lut[in[i+3]];
+    }
+    for(; i < bytes; i++)
+        out[i] = lut[in[i]];
+}
+
+
+// Written for the vectorizer: every step is a 16-bit lane operation, and
+// x*frac is the high half of (x<<8)*frac, which is pmulhuw on x86 and
+// a widening multiply on NEON.  Its top byte is floor(x*frac) to 16 bits of fraction.
+static void run_fixed(const struct bright_params_t *p, const unsigned char *in, unsigned char *out, size_t bytes)
+{
+    const uint16_t ai = p->alpha_int, af = p->alpha_frac;
+    const int16_t b = p->beta;
+    uint16_t x, f, s;
+    int16_t v;
+    size_t i;
+
+    for(i = 0; i < bytes; i++)
+    {
+        x = in[i];
+        f = (uint16_t)(((uint32_t)(uint16_t)(x << 8) * af) >> 16) >> 8;
+
+        // x*ai + f fits 16 bits for alpha up to BRIGHT_FIXED_MAX_ALPHA;
+        // anything over 2*SAT saturates whatever beta is
+        s = x * ai + f;
+        s = s > 2 * SAT ? 2 * SAT : s;
+
+        v = (int16_t)s + b;
+        out[i] = v > SAT ? SAT : (v < 0 ? 0 : v);
+    }
+}
+
+
+void bright_run(const struct bright_params_t *p, bright_kernel_t kernel,
+                const unsigned char *in, unsigned char *out, size_t bytes)
+{
+    // alpha too large for 16 bits, the table gives the same answer as scalar
+    if(kernel == BRIGHT_FIXED && !p->fixed_ok)
+        kernel = BRIGHT_LUT;
+
+    switch(kernel)
+    {
+        case BRIGHT_SCALAR: run_scalar(p, in, out, bytes); break;
+        case BRIGHT_FIXED:  run_fixed(p, in, out, bytes); break;
+        default:            run_lut(p, in, out, bytes); break;
+    }
+}
+
+
+// one band of rows of the current job
+static void run_band(struct bright_pool_t *pool, int idx)
+{
+    unsigned first = (unsigned)(((unsigned long)pool->rows * idx) / pool->threads);
+    unsigned last = (unsigned)(((unsigned long)pool->rows * (idx + 1)) / pool->threads);
+    size_t offset = (size_t)first * pool->row_bytes;
+
+    if(last > first)
+        bright_run(pool->params, pool->kernel, pool->in + offset, pool->out + offset,
+                   (size_t)(last - first) * pool->row_bytes);
+}
+
+
+static void *workerService(void *threadp)
+{
+    struct bright_worker_t *w = (struct bright_worker_t *)threadp;
+    struct bright_pool_t *pool = w->pool;
+
+    for(;;)
+    {
+        sem_wait(&w->go);
+        if(pool->stop) break;
+
+        run_band(pool, w->idx);
+        sem_post(&pool->done);
+    }
+
+    return NULL;
+}
+
+
+int bright_pool_start(struct bright_pool_t *pool, int threads)
+{
+    int i;
+
+    if(threads < 1 || threads > BRIGHT_MAX_THREADS)
+        return -1;
+
+    pool->threads = threads;
+    pool->stop = 0;
+    sem_init(&pool->done, 0, 0);
+
+    // worker 0 is the caller
+    for(i = 1; i < threads; i++)
+    {
+        pool->worker[i].idx = i;
+        pool->worker[i].pool = pool;
+        sem_init(&pool->worker[i].go, 0, 0);
+
+        if(pthread_create(&pool->worker[i].thread, NULL, workerService, &pool->worker[i]) != 0)
+        {
+            perror("pthread_create");
+            pool->threads = i;
+            bright_pool_stop(pool);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+void bright_pool_run(struct bright_pool_t *pool, const struct bright_params_t *p, bright_kernel_t kernel,
+                     const unsigned char *in, unsigned char *out, unsigned rows, size_t row_bytes)
+{
+    int i;
+
+    pool->params = p;
+    pool->kernel = kernel;
+    pool->in = in;
+    pool->out = out;
+    pool->rows = rows;
+    pool->row_bytes = row_bytes;
+
+    for(i = 1; i < pool->threads; i++)
+        sem_post(&pool->worker[i].go);
+
+    run_band(pool, 0);
+
+    for(i = 1; i < pool->threads; i++)
+        sem_wait(&pool->done);
+}
+
+
+void bright_pool_stop(struct bright_pool_t *pool)
+{
+    int i;
+
+    pool->stop = 1;
+    for(i = 1; i < pool->threads; i++)
+    {
+        sem_post(&pool->worker[i].go);
+        pthread_join(pool->worker[i].thread, NULL);
+        sem_destroy(&pool->worker[i].go);
+    }
+    sem_destroy(&pool->done);
+}
+
+
+unsigned char *bright_alloc(size_t bytes)
+{
+    void *buf = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if(buf == MAP_FAILED)
+    {
+        perror("mmap");
+        return NULL;
+    }
+
+    return (unsigned char *)buf;
+}
+
+
+void bright_free(unsigned char *buf, size_t bytes)
+{
+    if(buf) munmap(buf, bytes);
+}
+
+
+const char *bright_kernel_name(bright_kernel_t kernel)
+{
+    return kernel < BRIGHT_KERNELS ? kernel_names[kernel] : "?";
+}
+
+
+int bright_kernel_parse(const char *name, bright_kernel_t *kernel)
+{
+    int k;
+
+    for(k = 0; k < BRIGHT_KERNELS; k++)
+        if(strcmp(name, kernel_names[k]) == 0)
+        {
+            *kernel = (bright_kernel_t)k;
+            return 0;
+        }
+
+    return -1;
+}
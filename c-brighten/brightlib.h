@@ -0,0 +1,99 @@
+/*
+ *  Brightness/contrast engine
+ *
+ *  newimg = img*alpha + beta, saturated to 0..255, over 8-bit samples of
+ *  any image size.  Because every output sample depends only on one input
+ *  byte, the transform is done in one of three ways:
+ *
+ *    BRIGHT_SCALAR - the original per-sample double multiply, kept as the
+ *                    reference and the benchmark baseline
+ *    BRIGHT_LUT    - a 256-entry table built once per alpha/beta, exactly
+ *                    the same result as BRIGHT_SCALAR
+ *    BRIGHT_FIXED  - alpha in 16.16 fixed point, in a loop of 16-bit
+ *                    operations the compiler vectorizes at -O3 (8 or 16
+ *                    samples per instruction with SSE2 on x86 or NEON on
+ *                    the Jetson, the fraction through a high-half multiply);
+ *                    no table lookups, so no serial loads.  The same result
+ *                    whenever alpha*65536 is an integer, otherwise at most
+ *                    1 higher, only where the double img*alpha is rounded
+ *                    to just below a whole number
+ *
+ *  The image is split into bands of whole rows, one per worker thread.
+ *  Workers are created once and reused, so a frame costs two semaphore
+ *  operations per thread instead of a thread create and join.
+ */
+#ifndef _BRIGHTLIB_H_
+#define _BRIGHTLIB_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#define BRIGHT_MAX_THREADS (64)
+
+// largest alpha the fixed kernel can take without overflowing 16 bits
+#define BRIGHT_FIXED_MAX_ALPHA (255.0)
+
+typedef enum
+{
+    BRIGHT_SCALAR,
+    BRIGHT_LUT,
+    BRIGHT_FIXED,
+    BRIGHT_KERNELS
+} bright_kernel_t;
+
+struct bright_params_t
+{
+    double alpha;
+    int beta;
+    uint16_t alpha_int, alpha_frac;     // alpha in 16.16, rounded up
+    int fixed_ok;                       // alpha within BRIGHT_FIXED_MAX_ALPHA
+    unsigned char lut[256];
+};
+
+struct bright_worker_t
+{
+    pthread_t thread;
+    sem_t go;
+    int idx;
+    struct bright_pool_t *pool;
+};
+
+struct bright_pool_t
+{
+    int threads;
+    int stop;
+    sem_t done;
+    struct bright_worker_t worker[BRIGHT_MAX_THREADS];
+
+    // the job, set before the workers are released
+    const struct bright_params_t *params;
+    bright_kernel_t kernel;
+    const unsigned char *in;
+    unsigned char *out;
+    unsigned rows;
+    size_t row_bytes;
+};
+
+// alpha >= 0, beta -255..255; returns -1 when out of range
+int bright_params(struct bright_params_t *p, double alpha, int beta);
+
+// transform bytes samples of in to out on the calling thread
+void bright_run(const struct bright_params_t *p, bright_kernel_t kernel,
+                const unsigned char *in, unsigned char *out, size_t bytes);
+
+// threads workers, 1 runs every frame on the caller
+int bright_pool_start(struct bright_pool_t *pool, int threads);
+void bright_pool_run(struct bright_pool_t *pool, const struct bright_params_t *p, bright_kernel_t kernel,
+                     const unsigned char *in, unsigned char *out, unsigned rows, size_t row_bytes);
+void bright_pool_stop(struct bright_pool_t *pool);
+
+// page-aligned frame buffers from mmap, for images of any size
+unsigned char *bright_alloc(size_t bytes);
+void bright_free(unsigned char *buf, size_t bytes);
+
+const char *bright_kernel_name(bright_kernel_t kernel);
+int bright_kernel_parse(const char *name, bright_kernel_t *kernel);
+
+#endif
@@ -0,0 +1,198 @@
+/*
+ *  plywriter.cpp
+ *
+ *  Binary PLY point-cloud output, see plywriter.h
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/uio.h>
+
+#include "opencv2/calib3d/calib3d.hpp"
+
+#include "plywriter.h"
+
+using namespace cv;
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define PLY_FORMAT "binary_big_endian"
+#else
+#define PLY_FORMAT "binary_little_endian"
+#endif
+
+
+static double now_msec(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return ((double)t.tv_sec * 1000.0) + ((double)t.tv_nsec / 1000000.0);
+}
+
+
+int ply_write_cloud(const char *filename, const Mat &xyz, float max_z)
+{
+    Mat z, valid;
+    char header[256];
+    int fd, hlen, count, n = 0;
+    struct iovec iov[2];
+    ssize_t total, done;
+
+    CV_Assert(xyz.type() == CV_32FC3);
+
+    // same test saveXYZ made per point, done on the whole depth plane at once
+    extractChannel(xyz, z, 2);
+    valid = (abs(z) <= max_z) & (z != max_z);
+    count = countNonZero(valid);
+
+    std::vector<Vec3f> packed(count);
+
+    for(int y = 0; y < xyz.rows; y++)
+    {
+        const uchar *m = valid.ptr<uchar>(y);
+        const Vec3f *p = xyz.ptr<Vec3f>(y);
+
+        for(int x = 0; x < xyz.cols; x++)
+            if(m[x]) packed[n++] = p[x];
+    }
+
+    hlen = snprintf(header, sizeof(header),
+                    "ply\nformat " PLY_FORMAT " 1.0\nelement vertex %d\n"
+                    "property float x\nproperty float y\nproperty float z\nend_header\n", count);
+
+    if((fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+    {
+        perror(filename);
+        return -1;
+    }
+
+    iov[0].iov_base = header;
+    iov[0].iov_len = hlen;
+    iov[1].iov_base = count ? (void *)&packed[0] : NULL;
+    iov[1].iov_len = (size_t)count * sizeof(Vec3f);
+    total = iov[0].iov_len + iov[1].iov_len;
+
+    // one call for header and points, loop only if the kernel splits it
+    done = writev(fd, iov, 2);
+    while(done >= 0 && done < total)
+    {
+        ssize_t rc;
+
+        if(done < (ssize_t)iov[0].iov_len)
+            rc = write(fd, header + done, iov[0].iov_len - done);
+        else
+            rc = write(fd, (char *)iov[1].iov_base + (done - iov[0].iov_len), total - done);
+
+        if(rc < 0) { done = -1; break; }
+        done += rc;
+    }
+
+    if(done < 0)
+    {
+        perror(filename);
+        close(fd);
+        return -1;
+    }
+
+    close(fd);
+
+    return count;
+}
+
+
+static void *plyrecorderService(void *threadp)
+{
+    plyrecorder_t *rec = (plyrecorder_t *)threadp;
+    char filename[300];
+    double start;
+    int count;
+
+    while(1)
+    {
+        sem_wait(&rec->slotsFilled);
+
+        // stop is only seen once every queued map has been written
+        if(rec->head == rec->tail && rec->stop)
+            break;
+
+        Mat &disp = rec->disp[rec->head % PLY_RECORDER_SLOTS];
+
+        start = now_msec();
+
+        reprojectImageTo3D(disp, rec->xyz, rec->Q, true);
+        snprintf(filename, sizeof(filename), "%s_%06lu.ply", rec->prefix, rec->written);
+        count = ply_write_cloud(filename, rec->xyz, PLY_MAX_Z);
+
+        rec->writeMsec += now_msec() - start;
+        if(count >= 0)
+        {
+            rec->points += count;
+            rec->written++;
+        }
+
+        rec->head++;
+        sem_post(&rec->slotsFree);
+    }
+
+    return NULL;
+}
+
+
+int plyrecorder_start(plyrecorder_t *rec, const char *prefix, const Mat &Q)
+{
+    strncpy(rec->prefix, prefix, sizeof(rec->prefix) - 1);
+    rec->prefix[sizeof(rec->prefix) - 1] = '\0';
+    Q.copyTo(rec->Q);
+    rec->head = rec->tail = 0;
+    rec->stop = false;
+    rec->submitted = rec->written = rec->dropped = rec->points = 0;
+    rec->writeMsec = 0.0;
+
+    sem_init(&rec->slotsFree, 0, PLY_RECORDER_SLOTS);
+    sem_init(&rec->slotsFilled, 0, 0);
+
+    if(pthread_create(&rec->thread, NULL, plyrecorderService, (void *)rec) != 0)
+    {
+        perror("pthread_create");
+        return -1;
+    }
+
+    return 0;
+}
+
+
+int plyrecorder_submit(plyrecorder_t *rec, const Mat &disp)
+{
+    rec->submitted++;
+
+    if(sem_trywait(&rec->slotsFree) < 0)
+    {
+        rec->dropped++;
+        return -1;
+    }
+
+    disp.copyTo(rec->disp[rec->tail % PLY_RECORDER_SLOTS]);
+    rec->tail++;
+    sem_post(&rec->slotsFilled);
+
+    return 0;
+}
+
+
+void plyrecorder_stop(plyrecorder_t *rec)
+{
+    rec->stop = true;
+    sem_post(&rec->slotsFilled);
+    pthread_join(rec->thread, NULL);
+
+    sem_destroy(&rec->slotsFree);
+    sem_destroy(&rec->slotsFilled);
+
+    printf("point clouds: %lu submitted, %lu written, %lu dropped, ave %.0lf points, ave write %.2lf msec\n",
+           rec->submitted, rec->written, rec->dropped,
+           rec->written ? (double)rec->points / rec->written : 0.0,
+           rec->written ? rec->writeMsec / rec->written : 0.0);
+}
@@ -0,0 +1,60 @@
+/*
+ *  plywriter.h
+ *
+ *  Binary PLY point-cloud output for stereo_match and stereo_stream.
+ *
+ *  ply_write_cloud() writes one XYZ image (from reprojectImageTo3D) as a
+ *  binary little-endian PLY of float x, y, z vertices.  Missing points - the
+ *  max_z value reprojectImageTo3D uses for invalid disparity, or anything
+ *  farther than that - are masked out with whole-image comparisons, the
+ *  survivors are packed into one buffer, and the file is written with a
+ *  single header write and a single payload write.
+ *
+ *  The plyrecorder_* calls do the same work continuously on a background
+ *  thread: the caller hands over each disparity map and the reprojection,
+ *  filtering and file I/O happen off the capture path, one numbered file per
+ *  frame.  When the recorder falls behind, frames are dropped and counted
+ *  rather than stalling the caller.
+ */
+
+#ifndef PLYWRITER_H
+#define PLYWRITER_H
+
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "opencv2/core/core.hpp"
+
+// reprojectImageTo3D(..., handleMissingValues=true) puts bad points at this depth
+#define PLY_MAX_Z (1.0e4f)
+
+#define PLY_RECORDER_SLOTS (4)
+
+// Write the valid points of a CV_32FC3 xyz image, returns the point count or -1
+int ply_write_cloud(const char *filename, const cv::Mat &xyz, float max_z);
+
+typedef struct
+{
+    cv::Mat disp[PLY_RECORDER_SLOTS];
+    cv::Mat Q, xyz;
+    unsigned int head, tail;
+    sem_t slotsFree, slotsFilled;
+    pthread_t thread;
+    volatile bool stop;
+    char prefix[256];
+
+    // writer statistics
+    unsigned long submitted, written, dropped, points;
+    double writeMsec;
+} plyrecorder_t;
+
+// Start a recorder thread writing <prefix>_000000.ply, <prefix>_000001.ply, ...
+int plyrecorder_start(plyrecorder_t *rec, const char *prefix, const cv::Mat &Q);
+
+// Queue a copy of a disparity map, returns -1 and counts a drop if the queue is full
+int plyrecorder_submit(plyrecorder_t *rec, const cv::Mat &disp);
+
+// Write out everything still queued, then join the thread
+void plyrecorder_stop(plyrecorder_t *rec);
+
+#endif
@@ -14,6 +14,8 @@
 
 #include <stdio.h>
 
+#include "plywriter.h"
+
 using namespace cv;
 
 void print_help()
@@ -21,23 +23,7 @@ void print_help()
 	printf("\nDemo stereo matching converting L and R images into disparity and point clouds\n");
     printf("\nUsage: stereo_match <left_image> <right_image> [--algorithm=bm|sgbm|hh|var] [--blocksize=<block_size>]\n"
            "[--max-disparity=<max_disparity>] [--scale=scale_factor>] [-i <intrinsic_filename>] [-e <extrinsic_filename>]\n"
-           "[--no-display] [-o <disparity_image>] [-p <point_cloud_file>]\n");
-}
-
-void saveXYZ(const char* filename, const Mat& mat)
-{
-    const double max_z = 1.0e4;
-    FILE* fp = fopen(filename, "wt");
-    for(int y = 0; y < mat.rows; y++)
-    {
-        for(int x = 0; x < mat.cols; x++)
-        {
-            Vec3f point = mat.at<Vec3f>(y, x);
-            if(fabs(point[2] - max_z) < FLT_EPSILON || fabs(point[2]) > max_z) continue;
-            fprintf(fp, "%f %f %f\n", point[0], point[1], point[2]);
-        }
-    }
-    fclose(fp);
+           "[--no-display] [-o <disparity_image>] [-p <point_cloud_file.ply>]\n");
 }
 
 int main(int argc, char** argv)
@@ -301,8 +287,8 @@ int main(int argc, char** argv)
         fflush(stdout);
         Mat xyz;
         reprojectImageTo3D(disp, xyz, Q, true);
-        saveXYZ(point_cloud_filename, xyz);
-        printf("\n");
+        int points = ply_write_cloud(point_cloud_filename, xyz, PLY_MAX_Z);
+        printf(" %d points\n", points);
     }
     
     return 0;
@@ -0,0 +1,520 @@
+/*
+ *  stereo_stream.cpp
+ *
+ *  Continuous stereo depth from two synchronized cameras (or two video files),
+ *  built on the same StereoBM/StereoSGBM setup as stereo_match.cpp.
+ *
+ *  Differences from the one-shot stereo_match:
+ *
+ *  1) Rectification maps are computed once with initUndistortRectifyMap as
+ *     fixed-point CV_16SC2 maps, so each frame costs two remap calls only.
+ *
+ *  2) Both cameras are grabbed back to back and retrieved afterwards, so the
+ *     two exposures are as close in time as the drivers allow; the skew
+ *     between the two grabs is reported.
+ *
+ *  3) Disparity runs on a pool of worker threads, each with its own matcher,
+ *     over horizontal bands of the rectified pair, and only each band's
+ *     interior rows are kept.  For BM the bands overlap by enough rows that
+ *     the block matching window never sees an artificial band edge, though
+ *     speckle filtering still works within a band.  For SGBM the result is
+ *     an approximation: its vertical and diagonal cost paths run the whole
+ *     image height and its speckle filter works on whole regions, so a fixed
+ *     overlap only brings a band close to the full-frame result.  How close
+ *     is reported once, on the first pair, against a full-frame matcher call.
+ *
+ *  4) While the workers compute disparity for pair N, the main thread grabs
+ *     and rectifies pair N+1, so with enough cores depth streams at the
+ *     camera rate.
+ *
+ *  A per-stage timing report is printed every REPORT_FRAMES frames.  With -p,
+ *  every disparity map is also recorded as a binary PLY point cloud by the
+ *  plywriter background thread.
+ */
+
+#include "opencv2/calib3d/calib3d.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+#include "opencv2/highgui/highgui.hpp"
+
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "plywriter.h"
+
+using namespace cv;
+
+// Should always work for uncompressed USB 2.0 dual cameras
+#define HRES_COLS (320)
+#define VRES_ROWS (240)
+
+#define MAX_BANDS (16)
+#define DEFAULT_BANDS (4)
+
+// SGBM aggregates along vertical and diagonal paths over the whole height, so
+// it needs more context above and below a band than the BM block window does;
+// no fixed overlap makes it exact
+#define SGBM_BAND_OVERLAP (32)
+
+#define REPORT_FRAMES (100)
+
+#define ESC_KEY (27)
+
+enum { STEREO_BM=0, STEREO_SGBM=1 };
+
+typedef struct
+{
+    int idx;
+    int first, last;        // interior rows this band writes
+    int top, bottom;        // rows handed to the matcher, interior plus overlap
+    StereoBM bm;
+    StereoSGBM sgbm;
+    Mat disp;
+    double msec;
+    sem_t start;
+} BandWorker_t;
+
+static BandWorker_t band[MAX_BANDS];
+static pthread_t bandThread[MAX_BANDS];
+static sem_t bandsDone;
+static int numBands = DEFAULT_BANDS, alg = STEREO_BM;
+static volatile bool abortWorkers = false;
+
+// rectified gray pair being matched, and the disparity it produces
+static Mat workLeft, workRight, workDisp;
+
+
+static double now_msec(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return ((double)t.tv_sec * 1000.0) + ((double)t.tv_nsec / 1000000.0);
+}
+
+
+void *bandService(void *threadp)
+{
+    BandWorker_t *w = (BandWorker_t *)threadp;
+    double start;
+
+    while(1)
+    {
+        sem_wait(&w->start);
+        if(abortWorkers) break;
+
+        start = now_msec();
+
+        Mat left = workLeft.rowRange(w->top, w->bottom);
+        Mat right = workRight.rowRange(w->top, w->bottom);
+
+        if(alg == STEREO_BM)
+            w->bm(left, right, w->disp);
+        else
+            w->sgbm(left, right, w->disp);
+
+        // keep the interior only, the overlap rows belong to the neighbours
+        w->disp.rowRange(w->first - w->top, w->last - w->top).copyTo(workDisp.rowRange(w->first, w->last));
+
+        w->msec = now_msec() - start;
+
+        sem_post(&bandsDone);
+    }
+
+    return NULL;
+}
+
+
+// How far the banded disparity is from one matcher call on the whole pair.
+// Run on the main thread while the workers are idle, with band 0's matcher.
+static void compare_full_frame(void)
+{
+    Mat full, diff, validBand, validFull, both;
+    int pixels = workDisp.rows * workDisp.cols;
+
+    if(alg == STEREO_BM)
+        band[0].bm(workLeft, workRight, full);
+    else
+        band[0].sgbm(workLeft, workRight, full);
+
+    // minDisparity is 0, so anything negative is an invalid pixel
+    validBand = workDisp >= 0;
+    validFull = full >= 0;
+    bitwise_and(validBand, validFull, both);
+    absdiff(workDisp, full, diff);
+
+    printf("banded vs full-frame %s on the first pair: %.2lf%% of pixels differ, %.2lf%% valid in only one, "
+           "mean |difference| %.3lf px where both are valid\n",
+           alg == STEREO_BM ? "BM" : "SGBM",
+           100.0 * countNonZero(workDisp != full) / pixels,
+           100.0 * countNonZero(validBand != validFull) / pixels,
+           countNonZero(both) ? mean(diff, both)[0] / 16.0 : 0.0);
+}
+
+
+void print_help()
+{
+    printf("\nStream stereo disparity from two synchronized cameras or video files\n");
+    printf("\nUsage: stereo_stream <left_device|file> <right_device|file> [--algorithm=bm|sgbm] [--blocksize=<block_size>]\n"
+           "[--max-disparity=<max_disparity>] [--bands=<worker_bands>] [--frames=<frames>] [-i <intrinsic_filename>] [-e <extrinsic_filename>]\n"
+           "[--no-display] [-p <point_cloud_prefix>]\n");
+}
+
+
+static bool open_source(VideoCapture &cap, const char *name)
+{
+    int dev;
+    char extra;
+
+    if(sscanf(name, "%d%c", &dev, &extra) == 1)
+    {
+        cap.open(dev);
+        cap.set(CV_CAP_PROP_FRAME_WIDTH, HRES_COLS);
+        cap.set(CV_CAP_PROP_FRAME_HEIGHT, VRES_ROWS);
+    }
+    else
+        cap.open(name);
+
+    return cap.isOpened();
+}
+
+
+int main(int argc, char** argv)
+{
+    const char* algorithm_opt = "--algorithm=";
+    const char* maxdisp_opt = "--max-disparity=";
+    const char* blocksize_opt = "--blocksize=";
+    const char* bands_opt = "--bands=";
+    const char* frames_opt = "--frames=";
+    const char* nodisplay_opt = "--no-display";
+
+    const char* left_name = 0;
+    const char* right_name = 0;
+    const char* intrinsic_filename = 0;
+    const char* extrinsic_filename = 0;
+    const char* point_cloud_prefix = 0;
+    int SADWindowSize = 0, numberOfDisparities = 0, maxFrames = 0;
+    bool no_display = false;
+
+    if(argc < 3)
+    {
+        print_help();
+        return 0;
+    }
+
+    for( int i = 1; i < argc; i++ )
+    {
+        if( argv[i][0] != '-' )
+        {
+            if( !left_name )
+                left_name = argv[i];
+            else
+                right_name = argv[i];
+        }
+        else if( strncmp(argv[i], algorithm_opt, strlen(algorithm_opt)) == 0 )
+        {
+            char* _alg = argv[i] + strlen(algorithm_opt);
+            alg = strcmp(_alg, "bm") == 0 ? STEREO_BM :
+                  strcmp(_alg, "sgbm") == 0 ? STEREO_SGBM : -1;
+            if( alg < 0 )
+            {
+                printf("Command-line parameter error: Unknown stereo algorithm\n\n");
+                print_help();
+                return -1;
+            }
+        }
+        else if( strncmp(argv[i], maxdisp_opt, strlen(maxdisp_opt)) == 0 )
+        {
+            if( sscanf( argv[i] + strlen(maxdisp_opt), "%d", &numberOfDisparities ) != 1 ||
+                numberOfDisparities < 1 || numberOfDisparities % 16 != 0 )
+            {
+                printf("Command-line parameter error: The max disparity (--maxdisparity=<...>) must be a positive integer divisible by 16\n");
+                print_help();
+                return -1;
+            }
+        }
+        else if( strncmp(argv[i], blocksize_opt, strlen(blocksize_opt)) == 0 )
+        {
+            if( sscanf( argv[i] + strlen(blocksize_opt), "%d", &SADWindowSize ) != 1 ||
+                SADWindowSize < 1 || SADWindowSize % 2 != 1 )
+            {
+                printf("Command-line parameter error: The block size (--blocksize=<...>) must be a positive odd number\n");
+                return -1;
+            }
+        }
+        else if( strncmp(argv[i], bands_opt, strlen(bands_opt)) == 0 )
+        {
+            if( sscanf( argv[i] + strlen(bands_opt), "%d", &numBands ) != 1 ||
+                numBands < 1 || numBands > MAX_BANDS )
+            {
+                printf("Command-line parameter error: The number of bands (--bands=<...>) must be 1 to %d\n", MAX_BANDS);
+                return -1;
+            }
+        }
+        else if( strncmp(argv[i], frames_opt, strlen(frames_opt)) == 0 )
+            sscanf( argv[i] + strlen(frames_opt), "%d", &maxFrames );
+        else if( strcmp(argv[i], nodisplay_opt) == 0 )
+            no_display = true;
+        else if( strcmp(argv[i], "-i" ) == 0 )
+            intrinsic_filename = argv[++i];
+        else if( strcmp(argv[i], "-e" ) == 0 )
+            extrinsic_filename = argv[++i];
+        else if( strcmp(argv[i], "-p" ) == 0 )
+            point_cloud_prefix = argv[++i];
+        else
+        {
+            printf("Command-line parameter error: unknown option %s\n", argv[i]);
+            return -1;
+        }
+    }
+
+    if( !left_name || !right_name )
+    {
+        printf("Command-line parameter error: both left and right sources must be specified\n");
+        return -1;
+    }
+
+    if( (intrinsic_filename != 0) ^ (extrinsic_filename != 0) )
+    {
+        printf("Command-line parameter error: either both intrinsic and extrinsic parameters must be specified, or none of them (when the stereo pair is already rectified)\n");
+        return -1;
+    }
+
+    if( extrinsic_filename == 0 && point_cloud_prefix )
+    {
+        printf("Command-line parameter error: extrinsic and intrinsic parameters must be specified to record point clouds\n");
+        return -1;
+    }
+
+    VideoCapture capture_l, capture_r;
+
+    if( !open_source(capture_l, left_name) || !open_source(capture_r, right_name) )
+    {
+        printf("Failed to open %s and %s\n", left_name, right_name);
+        return -1;
+    }
+
+    Mat frame_l, frame_r;
+
+    if( !capture_l.read(frame_l) || !capture_r.read(frame_r) )
+    {
+        printf("No frames from %s and %s\n", left_name, right_name);
+        return -1;
+    }
+
+    Size img_size = frame_l.size();
+
+    // Rectification maps, once for the whole stream
+    Mat map11, map12, map21, map22, Q;
+    bool rectify = intrinsic_filename != 0;
+
+    if( rectify )
+    {
+        FileStorage fs(intrinsic_filename, CV_STORAGE_READ);
+        if(!fs.isOpened())
+        {
+            printf("Failed to open file %s\n", intrinsic_filename);
+            return -1;
+        }
+
+        Mat M1, D1, M2, D2;
+        fs["M1"] >> M1;
+        fs["D1"] >> D1;
+        fs["M2"] >> M2;
+        fs["D2"] >> D2;
+
+        fs.open(extrinsic_filename, CV_STORAGE_READ);
+        if(!fs.isOpened())
+        {
+            printf("Failed to open file %s\n", extrinsic_filename);
+            return -1;
+        }
+
+        Mat R, T, R1, P1, R2, P2;
+        fs["R"] >> R;
+        fs["T"] >> T;
+
+        stereoRectify( M1, D1, M2, D2, img_size, R, T, R1, R2, P1, P2, Q, CALIB_ZERO_DISPARITY, -1, img_size );
+
+        initUndistortRectifyMap(M1, D1, R1, P1, img_size, CV_16SC2, map11, map12);
+        initUndistortRectifyMap(M2, D2, R2, P2, img_size, CV_16SC2, map21, map22);
+    }
+
+    numberOfDisparities = numberOfDisparities > 0 ? numberOfDisparities : ((img_size.width/8) + 15) & -16;
+
+    // Split the rows into bands, each worker gets its own matcher and buffers
+    int blockSize = SADWindowSize > 0 ? SADWindowSize : (alg == STEREO_BM ? 9 : 3);
+    int overlap = alg == STEREO_BM ? blockSize/2 + 1 : SGBM_BAND_OVERLAP;
+    int rowsPerBand = (img_size.height + numBands - 1) / numBands;
+
+    sem_init(&bandsDone, 0, 0);
+
+    for( int b = 0; b < numBands; b++ )
+    {
+        BandWorker_t &w = band[b];
+
+        w.idx = b;
+        w.first = b * rowsPerBand;
+        w.last = std::min(img_size.height, w.first + rowsPerBand);
+        w.top = std::max(0, w.first - overlap);
+        w.bottom = std::min(img_size.height, w.last + overlap);
+
+        w.bm.state->preFilterCap = 31;
+        w.bm.state->SADWindowSize = blockSize;
+        w.bm.state->minDisparity = 0;
+        w.bm.state->numberOfDisparities = numberOfDisparities;
+        w.bm.state->textureThreshold = 10;
+        w.bm.state->uniquenessRatio = 15;
+        w.bm.state->speckleWindowSize = 100;
+        w.bm.state->speckleRange = 32;
+        w.bm.state->disp12MaxDiff = 1;
+
+        w.sgbm.preFilterCap = 63;
+        w.sgbm.SADWindowSize = blockSize;
+        w.sgbm.P1 = 8*blockSize*blockSize;
+        w.sgbm.P2 = 32*blockSize*blockSize;
+        w.sgbm.minDisparity = 0;
+        w.sgbm.numberOfDisparities = numberOfDisparities;
+        w.sgbm.uniquenessRatio = 10;
+        w.sgbm.speckleWindowSize = 100;
+        w.sgbm.speckleRange = 32;
+        w.sgbm.disp12MaxDiff = 1;
+        w.sgbm.fullDP = false;
+
+        sem_init(&w.start, 0, 0);
+        pthread_create(&bandThread[b], NULL, bandService, (void *)&w);
+    }
+
+    printf("%dx%d, %s, %d disparities, block %d, %d bands of %d rows + %d overlap, %s\n",
+           img_size.width, img_size.height, alg == STEREO_BM ? "BM" : "SGBM",
+           numberOfDisparities, blockSize, numBands, rowsPerBand, overlap,
+           rectify ? "rectifying with precomputed maps" : "input already rectified");
+
+    // Two rectified pairs: the workers match one while the main thread fills the other
+    Mat rect_l[2], rect_r[2], gray_l, gray_r, disp8;
+    int fill = 0, frames = 0, window = 0;
+    bool have_pair = false, stop = false;
+    double t, grabMsec = 0.0, retrieveMsec = 0.0, rectifyMsec = 0.0, dispMsec = 0.0, waitMsec = 0.0;
+    double skewMsec = 0.0, maxSkew = 0.0, bandMax = 0.0, windowStart = now_msec();
+
+    workDisp.create(img_size, CV_16S);
+
+    // reprojection and PLY writing happen on the recorder thread, not here
+    plyrecorder_t recorder;
+    if( point_cloud_prefix && plyrecorder_start(&recorder, point_cloud_prefix, Q) < 0 )
+        point_cloud_prefix = 0;
+
+    while( !stop )
+    {
+        double dispStart = 0.0;
+
+        // start the workers on the pair captured last time around
+        if( have_pair )
+        {
+            workLeft = rect_l[1 - fill];
+            workRight = rect_r[1 - fill];
+            dispStart = now_msec();
+            for( int b = 0; b < numBands; b++ )
+                sem_post(&band[b].start);
+        }
+
+        // grab both first so the exposures are as close as possible, then decode
+        t = now_msec();
+        bool ok_l = capture_l.grab();
+        double skew = now_msec();
+        bool ok_r = capture_r.grab();
+        skew = now_msec() - skew;
+        grabMsec += now_msec() - t;
+
+        if( !ok_l || !ok_r )
+            stop = true;
+        else
+        {
+            skewMsec += skew;
+            if( skew > maxSkew ) maxSkew = skew;
+
+            t = now_msec();
+            capture_l.retrieve(frame_l);
+            capture_r.retrieve(frame_r);
+            retrieveMsec += now_msec() - t;
+
+            t = now_msec();
+            cvtColor(frame_l, gray_l, CV_BGR2GRAY);
+            cvtColor(frame_r, gray_r, CV_BGR2GRAY);
+            if( rectify )
+            {
+                remap(gray_l, rect_l[fill], map11, map12, INTER_LINEAR);
+                remap(gray_r, rect_r[fill], map21, map22, INTER_LINEAR);
+            }
+            else
+            {
+                gray_l.copyTo(rect_l[fill]);
+                gray_r.copyTo(rect_r[fill]);
+            }
+            rectifyMsec += now_msec() - t;
+        }
+
+        if( have_pair )
+        {
+            t = now_msec();
+            for( int b = 0; b < numBands; b++ )
+                sem_wait(&bandsDone);
+            waitMsec += now_msec() - t;
+            dispMsec += now_msec() - dispStart;
+            for( int b = 0; b < numBands; b++ )
+                if( band[b].msec > bandMax ) bandMax = band[b].msec;
+
+            if( frames == 0 )
+                compare_full_frame();
+
+            if( point_cloud_prefix )
+                plyrecorder_submit(&recorder, workDisp);
+
+            frames++;
+            window++;
+            if( maxFrames > 0 && frames >= maxFrames )
+                stop = true;
+
+            if( !no_display )
+            {
+                workDisp.convertTo(disp8, CV_8U, 255/(numberOfDisparities*16.));
+                imshow("left", workLeft);
+                imshow("disparity", disp8);
+                char c = waitKey(1);
+                if( c == ESC_KEY || c == 'q' )
+                    stop = true;
+            }
+
+            if( window == REPORT_FRAMES )
+            {
+                double elapsed = now_msec() - windowStart;
+                printf("%d frames at %.2lf FPS: grab %.2lf, retrieve %.2lf, rectify %.2lf, disparity %.2lf (waited %.2lf, slowest band %.2lf) msec, grab skew ave %.3lf max %.3lf msec\n",
+                       frames, window * 1000.0 / elapsed, grabMsec / window, retrieveMsec / window,
+                       rectifyMsec / window, dispMsec / window, waitMsec / window, bandMax,
+                       skewMsec / window, maxSkew);
+                grabMsec = retrieveMsec = rectifyMsec = dispMsec = waitMsec = 0.0;
+                skewMsec = maxSkew = bandMax = 0.0;
+                window = 0;
+                windowStart = now_msec();
+            }
+        }
+
+        have_pair = !stop;
+        fill = 1 - fill;
+    }
+
+    abortWorkers = true;
+    for( int b = 0; b < numBands; b++ )
+    {
+        sem_post(&band[b].start);
+        pthread_join(bandThread[b], NULL);
+    }
+
+    printf("%d disparity frames\n", frames);
+
+    if( point_cloud_prefix )
+        plyrecorder_stop(&recorder);
+
+    return 0;
+}
@@ -0,0 +1,426 @@
+/*
+ *  Headless benchmark for the computer_vision_cv4_tested transforms
+ *
+ *  Runs the algorithm kernels from canny.cpp, sobel.cpp, houghline.cpp,
+ *  houghcirc.cpp, pyrUpDown.cpp, denseoptflow.cpp and hogpeople.cpp (same
+ *  calls and parameters as the interactive demos) over a recorded frame
+ *  corpus, with no imshow/waitKey and no camera, so throughput can be
+ *  measured on a server and tracked from run to run.
+ *
+ *  The corpus is decoded and scaled to each test resolution before timing
+ *  starts, so only the algorithm itself is measured.  Each algorithm and
+ *  resolution runs in its own forked process, so the reported peak memory
+ *  belongs to that run alone.
+ *
+ *  Usage:
+ *
+ *  ./bench [corpus] [--algo=canny,sobel,...|all] [--res=640x480,1280x720]
+ *          [--frames=N] [--warmup=N] [--threads=N] [--out=results.csv]
+ *
+ *  corpus is a video file, an image sequence pattern (frame%04d.png) or a
+ *  directory of .jpg/.png images, default ../optical-flow/slow_traffic_small.mp4
+ *
+ *  One CSV row per algorithm and resolution is appended to the --out file
+ *  (header written when the file is new):
+ *
+ *  host,opencv,algorithm,width,height,threads,frames,fps,mean_ms,p50_ms,p90_ms,p99_ms,max_ms,base_rss_kb,peak_rss_kb
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/videoio.hpp>
+#include <opencv2/video.hpp>
+#include <opencv2/objdetect.hpp>
+
+using namespace cv;
+using namespace std;
+
+#define DEFAULT_CORPUS "../optical-flow/slow_traffic_small.mp4"
+#define DEFAULT_OUT "bench_results.csv"
+
+// Upper bound on corpus size, frames are held decoded in memory
+#define MAX_CORPUS_FRAMES (1000)
+
+#define NUM_ALGORITHMS (7)
+
+
+// State that persists across frames of one run, so the timed loop does not
+// pay for setup the interactive demos do once (HOG model, previous frame)
+typedef struct
+{
+    Mat gray, prevGray, work1, work2, work3, out;
+    Mat grad_x, grad_y, abs_grad_x, abs_grad_y;
+    Mat flow, flow_parts[2], magnitude, angle, magn_norm, hsv, hsv8;
+    vector<Vec4i> linesP;
+    vector<Vec3f> circles;
+    vector<Rect> found;
+    HOGDescriptor hog;
+} BenchState_t;
+
+typedef void (*BenchKernel_t)(const Mat &frame, BenchState_t &st);
+
+
+// canny.cpp / cannycam.cpp: blur, Canny, edges used as a copy mask
+static void kernel_canny(const Mat &frame, BenchState_t &st)
+{
+    cvtColor(frame, st.gray, COLOR_BGR2GRAY);
+    blur(st.gray, st.work1, Size(3,3));
+    Canny(st.work1, st.work1, 50, 150, 3);
+    st.out = Scalar::all(0);
+    frame.copyTo(st.out, st.work1);
+}
+
+// sobel.cpp with default ksize=1, scale=1, delta=0
+static void kernel_sobel(const Mat &frame, BenchState_t &st)
+{
+    GaussianBlur(frame, st.work1, Size(3, 3), 0, 0, BORDER_DEFAULT);
+    cvtColor(st.work1, st.gray, COLOR_BGR2GRAY);
+    Sobel(st.gray, st.grad_x, CV_16S, 1, 0, 1, 1, 0, BORDER_DEFAULT);
+    Sobel(st.gray, st.grad_y, CV_16S, 0, 1, 1, 1, 0, BORDER_DEFAULT);
+    convertScaleAbs(st.grad_x, st.abs_grad_x);
+    convertScaleAbs(st.grad_y, st.abs_grad_y);
+    addWeighted(st.abs_grad_x, 0.5, st.abs_grad_y, 0.5, 0, st.out);
+}
+
+// houghline.cpp probabilistic transform
+static void kernel_houghline(const Mat &frame, BenchState_t &st)
+{
+    cvtColor(frame, st.gray, COLOR_BGR2GRAY);
+    Canny(st.gray, st.work1, 80, 240, 3);
+    HoughLinesP(st.work1, st.linesP, 1, CV_PI/180, 50, 50, 10);
+}
+
+// houghcirc.cpp
+static void kernel_houghcirc(const Mat &frame, BenchState_t &st)
+{
+    cvtColor(frame, st.gray, COLOR_BGR2GRAY);
+    medianBlur(st.gray, st.work1, 5);
+    HoughCircles(st.work1, st.circles, HOUGH_GRADIENT, 1, st.work1.rows/16, 100, 30, 1, 30);
+}
+
+// pyrUpDown.cpp, one zoom out and one zoom in
+static void kernel_pyrupdown(const Mat &frame, BenchState_t &st)
+{
+    pyrDown(frame, st.work1, Size(frame.cols/2, frame.rows/2));
+    pyrUp(frame, st.work2, Size(frame.cols*2, frame.rows*2));
+}
+
+// denseoptflow.cpp including the HSV visualization
+static void kernel_denseoptflow(const Mat &frame, BenchState_t &st)
+{
+    cvtColor(frame, st.gray, COLOR_BGR2GRAY);
+
+    if (st.prevGray.empty())
+    {
+        st.gray.copyTo(st.prevGray);
+        return;
+    }
+
+    calcOpticalFlowFarneback(st.prevGray, st.gray, st.flow, 0.5, 3, 15, 3, 5, 1.2, 0);
+
+    split(st.flow, st.flow_parts);
+    cartToPolar(st.flow_parts[0], st.flow_parts[1], st.magnitude, st.angle, true);
+    normalize(st.magnitude, st.magn_norm, 0.0f, 1.0f, NORM_MINMAX);
+    st.angle *= ((1.f / 360.f) * (180.f / 255.f));
+
+    Mat _hsv[3];
+    _hsv[0] = st.angle;
+    _hsv[1] = Mat::ones(st.angle.size(), CV_32F);
+    _hsv[2] = st.magn_norm;
+    merge(_hsv, 3, st.hsv);
+    st.hsv.convertTo(st.hsv8, CV_8U, 255.0);
+    cvtColor(st.hsv8, st.out, COLOR_HSV2BGR);
+
+    swap(st.prevGray, st.gray);
+}
+
+// hogpeople.cpp Default detector
+static void kernel_hogpeople(const Mat &frame, BenchState_t &st)
+{
+    st.hog.detectMultiScale(frame, st.found, 0, Size(8,8), Size(32,32), 1.05, 2, false);
+}
+
+
+static const struct
+{
+    const char *name;
+    BenchKernel_t kernel;
+} algorithms[NUM_ALGORITHMS] =
+{
+    { "canny",        kernel_canny },
+    { "sobel",        kernel_sobel },
+    { "houghline",    kernel_houghline },
+    { "houghcirc",    kernel_houghcirc },
+    { "pyrupdown",    kernel_pyrupdown },
+    { "denseoptflow", kernel_denseoptflow },
+    { "hogpeople",    kernel_hogpeople },
+};
+
+
+static double now_msec(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return ((double)t.tv_sec * 1000.0) + ((double)t.tv_nsec / 1000000.0);
+}
+
+
+// VmRSS or VmHWM from /proc/self/status in kB
+static long proc_status_kb(const char *field)
+{
+    char line[256];
+    long kb = -1;
+    size_t len = strlen(field);
+    FILE *fp = fopen("/proc/self/status", "r");
+
+    if (!fp) return -1;
+
+    while (fgets(line, sizeof(line), fp))
+    {
+        if (strncmp(line, field, len) == 0)
+        {
+            sscanf(line + len, ":%ld", &kb);
+            break;
+        }
+    }
+
+    fclose(fp);
+    return kb;
+}
+
+
+// Reset VmHWM to the current RSS so the peak covers only what follows
+static void reset_peak_rss(void)
+{
+    FILE *fp = fopen("/proc/self/clear_refs", "w");
+
+    if (fp)
+    {
+        fputs("5", fp);
+        fclose(fp);
+    }
+}
+
+
+static int load_corpus(const string &corpus, int maxFrames, vector<Mat> &frames)
+{
+    vector<String> files;
+    Mat frame;
+
+    // a directory of stills
+    if (access((corpus + "/.").c_str(), F_OK) == 0)
+    {
+        vector<String> jpg, png;
+        glob(corpus + "/*.jpg", jpg, false);
+        glob(corpus + "/*.png", png, false);
+        files.insert(files.end(), jpg.begin(), jpg.end());
+        files.insert(files.end(), png.begin(), png.end());
+        sort(files.begin(), files.end());
+
+        for (size_t i = 0; i < files.size() && (int)frames.size() < maxFrames; i++)
+        {
+            frame = imread(files[i], IMREAD_COLOR);
+            if (!frame.empty()) frames.push_back(frame);
+        }
+    }
+    // a video file or an image sequence pattern
+    else
+    {
+        VideoCapture capture(corpus);
+
+        if (!capture.isOpened())
+            return -1;
+
+        while ((int)frames.size() < maxFrames && capture.read(frame))
+            frames.push_back(frame.clone());
+    }
+
+    return (int)frames.size();
+}
+
+
+static void run_benchmark(int algo, const vector<Mat> &corpus, Size res,
+                          int frames, int warmup, int threads, const char *outFile)
+{
+    vector<Mat> scaled(corpus.size());
+    vector<double> latency(frames);
+    BenchState_t st;
+    double start, total = 0.0;
+    long baseRss, peakRss;
+    char host[64];
+    FILE *fp;
+    int i;
+
+    // OpenCV's worker pool is only ever started here in the child, never in
+    // the parent that forks, so no run inherits a pool with missing threads
+    if (threads >= 0)
+        setNumThreads(threads);
+    threads = getNumThreads();
+
+    for (i = 0; i < (int)corpus.size(); i++)
+        resize(corpus[i], scaled[i], res, 0, 0, INTER_AREA);
+
+    if (strcmp(algorithms[algo].name, "hogpeople") == 0)
+        st.hog.setSVMDetector(HOGDescriptor::getDefaultPeopleDetector());
+
+    // warmup also sizes every buffer in st, so allocation is not timed
+    for (i = 0; i < warmup; i++)
+        algorithms[algo].kernel(scaled[i % scaled.size()], st);
+
+    reset_peak_rss();
+    baseRss = proc_status_kb("VmRSS");
+
+    for (i = 0; i < frames; i++)
+    {
+        start = now_msec();
+        algorithms[algo].kernel(scaled[(warmup + i) % scaled.size()], st);
+        latency[i] = now_msec() - start;
+        total += latency[i];
+    }
+
+    peakRss = proc_status_kb("VmHWM");
+
+    sort(latency.begin(), latency.end());
+
+    printf("%-13s %5dx%-5d %7.2lf fps  mean %8.3lf  p50 %8.3lf  p90 %8.3lf  p99 %8.3lf  max %8.3lf msec  peak %ld kB (+%ld)\n",
+           algorithms[algo].name, res.width, res.height,
+           (double)frames * 1000.0 / total, total / frames,
+           latency[frames/2], latency[(frames*90)/100], latency[(frames*99)/100], latency[frames-1],
+           peakRss, peakRss - baseRss);
+    fflush(stdout);
+
+    gethostname(host, sizeof(host));
+    host[sizeof(host)-1] = '\0';
+
+    if ((fp = fopen(outFile, "a")) == NULL)
+    {
+        perror(outFile);
+        return;
+    }
+
+    fprintf(fp, "%s,%s,%s,%d,%d,%d,%d,%.3lf,%.4lf,%.4lf,%.4lf,%.4lf,%.4lf,%ld,%ld\n",
+            host, CV_VERSION, algorithms[algo].name, res.width, res.height, threads, frames,
+            (double)frames * 1000.0 / total, total / frames,
+            latency[frames/2], latency[(frames*90)/100], latency[(frames*99)/100], latency[frames-1],
+            baseRss, peakRss);
+    fclose(fp);
+}
+
+
+static const string keys =
+    "{ help h   |      | print help message }"
+    "{ @corpus  | " DEFAULT_CORPUS " | video file, image sequence pattern or directory of images }"
+    "{ algo a   | all  | comma separated list of canny,sobel,houghline,houghcirc,pyrupdown,denseoptflow,hogpeople }"
+    "{ res r    | 640x480 | comma separated list of WxH resolutions }"
+    "{ frames n | 200  | timed frames per run }"
+    "{ warmup w | 5    | untimed frames per run }"
+    "{ threads t | -1  | OpenCV worker threads, -1 for the OpenCV default }"
+    "{ out o    | " DEFAULT_OUT " | CSV results file, rows are appended }";
+
+int main(int argc, char **argv)
+{
+    CommandLineParser parser(argc, argv, keys);
+    parser.about("Headless throughput benchmark for the OpenCV demo algorithms.");
+
+    if (parser.has("help"))
+    {
+        parser.printMessage();
+        return 0;
+    }
+
+    string corpusName = parser.get<string>("@corpus");
+    string algoList = parser.get<string>("algo");
+    string resList = parser.get<string>("res");
+    int frames = parser.get<int>("frames");
+    int warmup = parser.get<int>("warmup");
+    int threads = parser.get<int>("threads");
+    string outFile = parser.get<string>("out");
+
+    if (!parser.check() || frames < 1 || warmup < 0)
+    {
+        parser.printErrors();
+        return 1;
+    }
+
+    vector<Mat> corpus;
+
+    if (load_corpus(corpusName, MAX_CORPUS_FRAMES, corpus) <= 0)
+    {
+        cerr << "Unable to read any frames from " << corpusName << endl;
+        return 1;
+    }
+
+    printf("Corpus %s: %d frames at %dx%d\n", corpusName.c_str(), (int)corpus.size(),
+           corpus[0].cols, corpus[0].rows);
+
+    if (access(outFile.c_str(), F_OK) != 0)
+    {
+        FILE *fp = fopen(outFile.c_str(), "w");
+        if (fp)
+        {
+            fprintf(fp, "host,opencv,algorithm,width,height,threads,frames,fps,mean_ms,p50_ms,p90_ms,p99_ms,max_ms,base_rss_kb,peak_rss_kb\n");
+            fclose(fp);
+        }
+    }
+
+    // parse WxH list
+    vector<Size> resolutions;
+    {
+        stringstream ss(resList);
+        string item;
+        int w, h;
+
+        while (getline(ss, item, ','))
+        {
+            if (sscanf(item.c_str(), "%dx%d", &w, &h) == 2 && w > 0 && h > 0)
+                resolutions.push_back(Size(w, h));
+            else
+                cerr << "Ignoring bad resolution " << item << endl;
+        }
+    }
+
+    for (int algo = 0; algo < NUM_ALGORITHMS; algo++)
+    {
+        if (algoList != "all" && ("," + algoList + ",").find(string(",") + algorithms[algo].name + ",") == string::npos)
+            continue;
+
+        for (size_t r = 0; r < resolutions.size(); r++)
+        {
+            pid_t pid = fork();
+
+            if (pid == 0)
+            {
+                run_benchmark(algo, corpus, resolutions[r], frames, warmup, threads, outFile.c_str());
+                _exit(0);
+            }
+            else if (pid < 0)
+            {
+                perror("fork");
+                return 1;
+            }
+
+            int status;
+            waitpid(pid, &status, 0);
+
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                printf("%-13s %5dx%-5d FAILED\n", algorithms[algo].name,
+                       resolutions[r].width, resolutions[r].height);
+        }
+    }
+
+    printf("Results appended to %s\n", outFile.c_str());
+
+    return 0;
+}
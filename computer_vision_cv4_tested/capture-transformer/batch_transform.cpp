@@ -0,0 +1,482 @@
+#include "opencv2/imgproc.hpp"
+#include "opencv2/imgcodecs.hpp"
+#include "opencv2/videoio.hpp"
+#include <iostream>
+#include <algorithm>
+#include <deque>
+#include <vector>
+#include <string>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/stat.h>
+using namespace cv;
+using namespace std;
+
+// Batch transformer
+//
+// Runs one of the capture-transformer kernels (the same calls canny.cpp,
+// sobel.cpp, houghline.cpp, houghcirc.cpp and pyrUpDown.cpp make
+// interactively) over a directory of images or every frame of a video
+// container, and writes each result plus a CSV of per-image timing.
+//
+// Images are spread over a pool of worker threads, each with its own job
+// deque.  A worker takes from the front of its own deque and, when that is
+// empty, steals from the back of another worker's, so a few slow images
+// (large frames, many Hough lines) do not leave the other cores idle at the
+// end of a run.  One counting semaphore tracks the jobs queued across all
+// deques, so idle workers sleep on it rather than spinning over the deques.
+//
+// Usage: batch_transform <dir|video> --op=canny --out=out [--threads=N] ...
+
+#define MAX_WORKERS (64)
+
+// video frames decoded ahead of the workers, bounds memory for long captures
+#define MAX_QUEUED_FRAMES (64)
+
+enum { OP_CANNY, OP_SOBEL, OP_HOUGHLINE, OP_HOUGHCIRC, OP_PYRDOWN, OP_PYRUP };
+
+typedef struct
+{
+    int op;
+    int lowThreshold, ratio;        // canny
+    int ksize, scale, delta;        // sobel
+    string out, ext;
+} Params_t;
+
+typedef struct
+{
+    int index;
+    string name;                    // file to load, empty for a video frame
+    Mat frame;                      // already decoded video frame
+} Job_t;
+
+typedef struct
+{
+    int index;
+    string name;
+    int worker;
+    bool stolen;
+    int width, height;
+    size_t features;                // lines or circles found, 0 for other ops
+    double loadMsec, transformMsec, writeMsec;
+} Result_t;
+
+typedef struct
+{
+    int id;
+    deque<Job_t> jobs;
+    pthread_mutex_t lock;
+    vector<Result_t> results;
+    unsigned int done, steals;
+} Worker_t;
+
+static Worker_t worker[MAX_WORKERS];
+static pthread_t workerThread[MAX_WORKERS];
+static int numWorkers;
+static sem_t jobsQueued, framesFree;
+static volatile bool noMoreJobs = false;
+static Params_t params;
+
+
+static double now_msec(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return ((double)t.tv_sec * 1000.0) + ((double)t.tv_nsec / 1000000.0);
+}
+
+
+static size_t transform(const Params_t &p, const Mat &src, Mat &dst)
+{
+    Mat gray, edges;
+
+    switch(p.op)
+    {
+    case OP_CANNY:
+        cvtColor(src, gray, COLOR_BGR2GRAY);
+        blur(gray, edges, Size(3,3));
+        Canny(edges, edges, p.lowThreshold, p.lowThreshold*p.ratio, 3);
+        dst.create(src.size(), src.type());
+        dst = Scalar::all(0);
+        src.copyTo(dst, edges);
+        return 0;
+
+    case OP_SOBEL:
+    {
+        Mat blurred, grad_x, grad_y, abs_grad_x, abs_grad_y;
+        GaussianBlur(src, blurred, Size(3, 3), 0, 0, BORDER_DEFAULT);
+        cvtColor(blurred, gray, COLOR_BGR2GRAY);
+        Sobel(gray, grad_x, CV_16S, 1, 0, p.ksize, p.scale, p.delta, BORDER_DEFAULT);
+        Sobel(gray, grad_y, CV_16S, 0, 1, p.ksize, p.scale, p.delta, BORDER_DEFAULT);
+        convertScaleAbs(grad_x, abs_grad_x);
+        convertScaleAbs(grad_y, abs_grad_y);
+        addWeighted(abs_grad_x, 0.5, abs_grad_y, 0.5, 0, dst);
+        return 0;
+    }
+
+    case OP_HOUGHLINE:
+    {
+        vector<Vec4i> linesP;
+        cvtColor(src, gray, COLOR_BGR2GRAY);
+        Canny(gray, edges, 80, 240, 3);
+        cvtColor(edges, dst, COLOR_GRAY2BGR);
+        HoughLinesP(edges, linesP, 1, CV_PI/180, 50, 50, 10);
+        for(size_t i = 0; i < linesP.size(); i++)
+        {
+            Vec4i l = linesP[i];
+            line(dst, Point(l[0], l[1]), Point(l[2], l[3]), Scalar(0,0,255), 3, LINE_AA);
+        }
+        return linesP.size();
+    }
+
+    case OP_HOUGHCIRC:
+    {
+        vector<Vec3f> circles;
+        cvtColor(src, gray, COLOR_BGR2GRAY);
+        medianBlur(gray, gray, 5);
+        HoughCircles(gray, circles, HOUGH_GRADIENT, 1, gray.rows/16, 100, 30, 1, 30);
+        src.copyTo(dst);
+        for(size_t i = 0; i < circles.size(); i++)
+        {
+            Vec3i c = circles[i];
+            Point center = Point(c[0], c[1]);
+            circle(dst, center, 1, Scalar(0,100,100), 3, LINE_AA);
+            circle(dst, center, c[2], Scalar(255,0,255), 3, LINE_AA);
+        }
+        return circles.size();
+    }
+
+    case OP_PYRDOWN:
+        pyrDown(src, dst, Size(src.cols/2, src.rows/2));
+        return 0;
+
+    case OP_PYRUP:
+        pyrUp(src, dst, Size(src.cols*2, src.rows*2));
+        return 0;
+    }
+
+    return 0;
+}
+
+
+// Own deque from the front, otherwise steal from the back of the others
+static bool take_job(Worker_t *w, Job_t &job, bool &stolen)
+{
+    pthread_mutex_lock(&w->lock);
+    if(!w->jobs.empty())
+    {
+        job = w->jobs.front();
+        w->jobs.pop_front();
+        pthread_mutex_unlock(&w->lock);
+        stolen = false;
+        return true;
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    for(int k = 1; k < numWorkers; k++)
+    {
+        Worker_t *victim = &worker[(w->id + k) % numWorkers];
+
+        pthread_mutex_lock(&victim->lock);
+        if(!victim->jobs.empty())
+        {
+            job = victim->jobs.back();
+            victim->jobs.pop_back();
+            pthread_mutex_unlock(&victim->lock);
+            stolen = true;
+            return true;
+        }
+        pthread_mutex_unlock(&victim->lock);
+    }
+
+    return false;
+}
+
+
+void *workerService(void *threadp)
+{
+    Worker_t *w = (Worker_t *)threadp;
+    Job_t job;
+    Mat src, dst;
+    char outname[512];
+    bool stolen;
+
+    while(1)
+    {
+        sem_wait(&jobsQueued);
+
+        // Each post is one job or one stop signal.  Once the producer is done
+        // an empty scan means the pool is drained; before that, a job we
+        // counted on was taken by a late thief, so put the token back.
+        bool last = noMoreJobs;
+        if(!take_job(w, job, stolen))
+        {
+            if(last) break;
+            sem_post(&jobsQueued);
+            continue;
+        }
+
+        Result_t r;
+        r.index = job.index;
+        r.worker = w->id;
+        r.stolen = stolen;
+
+        double t = now_msec();
+        if(job.name.empty())
+        {
+            src = job.frame;
+            job.frame.release();
+            sem_post(&framesFree);
+            snprintf(outname, sizeof(outname), "frame_%06d", job.index);
+            r.name = outname;
+        }
+        else
+        {
+            src = imread(job.name, IMREAD_COLOR);
+            r.name = job.name.substr(job.name.find_last_of('/') + 1);
+        }
+        r.loadMsec = now_msec() - t;
+
+        if(src.empty())
+        {
+            fprintf(stderr, "could not read %s\n", job.name.c_str());
+            continue;
+        }
+
+        r.width = src.cols;
+        r.height = src.rows;
+
+        t = now_msec();
+        r.features = transform(params, src, dst);
+        r.transformMsec = now_msec() - t;
+
+        t = now_msec();
+        string base = r.name.substr(0, r.name.find_last_of('.'));
+        snprintf(outname, sizeof(outname), "%s/%s%s", params.out.c_str(), base.c_str(), params.ext.c_str());
+        if(!imwrite(outname, dst))
+            fprintf(stderr, "could not write %s\n", outname);
+        r.writeMsec = now_msec() - t;
+
+        w->results.push_back(r);
+        w->done++;
+        if(stolen) w->steals++;
+    }
+
+    return NULL;
+}
+
+
+static bool is_image(const char *name)
+{
+    const char *dot = strrchr(name, '.');
+    const char *exts[] = { ".jpg", ".jpeg", ".png", ".bmp", ".ppm", ".pgm", ".tif", ".tiff" };
+
+    if(!dot) return false;
+    for(size_t i = 0; i < sizeof(exts)/sizeof(exts[0]); i++)
+        if(strcasecmp(dot, exts[i]) == 0) return true;
+    return false;
+}
+
+
+static bool by_index(const Result_t &a, const Result_t &b)
+{
+    return a.index < b.index;
+}
+
+
+int main(int argc, char **argv)
+{
+    CommandLineParser parser(argc, argv,
+                             "{@input  |<none>| directory of images or a video file}"
+                             "{op      |canny | canny, sobel, houghline, houghcirc, pyrdown or pyrup}"
+                             "{out     |out   | output directory}"
+                             "{ext     |.png  | output image extension}"
+                             "{csv     |      | timing CSV, default <out>/timing.csv}"
+                             "{threads |0     | worker threads, 0 for one per core}"
+                             "{low     |50    | canny low threshold}"
+                             "{ratio   |3     | canny high/low ratio}"
+                             "{ksize   |1     | sobel kernel size}"
+                             "{scale   |1     | sobel scale}"
+                             "{delta   |0     | sobel delta}"
+                             "{help h  |      | show help message}");
+
+    if(parser.has("help"))
+    {
+        parser.printMessage();
+        return 0;
+    }
+
+    string input = parser.get<string>("@input");
+    string opName = parser.get<string>("op");
+    string csvName = parser.get<string>("csv");
+    numWorkers = parser.get<int>("threads");
+    params.out = parser.get<string>("out");
+    params.ext = parser.get<string>("ext");
+    params.lowThreshold = parser.get<int>("low");
+    params.ratio = parser.get<int>("ratio");
+    params.ksize = parser.get<int>("ksize");
+    params.scale = parser.get<int>("scale");
+    params.delta = parser.get<int>("delta");
+
+    if(!parser.check())
+    {
+        parser.printErrors();
+        return 1;
+    }
+
+    if(opName == "canny") params.op = OP_CANNY;
+    else if(opName == "sobel") params.op = OP_SOBEL;
+    else if(opName == "houghline") params.op = OP_HOUGHLINE;
+    else if(opName == "houghcirc") params.op = OP_HOUGHCIRC;
+    else if(opName == "pyrdown") params.op = OP_PYRDOWN;
+    else if(opName == "pyrup") params.op = OP_PYRUP;
+    else
+    {
+        printf("Unknown op %s\n", opName.c_str());
+        return 1;
+    }
+
+    if(numWorkers <= 0)
+        numWorkers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    numWorkers = std::min(std::max(numWorkers, 1), MAX_WORKERS);
+
+    if(csvName.empty())
+        csvName = params.out + "/timing.csv";
+
+    mkdir(params.out.c_str(), 0755);
+
+    // the pool already uses every core, OpenCV's own threads would only contend
+    setNumThreads(1);
+
+    sem_init(&jobsQueued, 0, 0);
+    sem_init(&framesFree, 0, MAX_QUEUED_FRAMES);
+
+    for(int i = 0; i < numWorkers; i++)
+    {
+        worker[i].id = i;
+        worker[i].done = worker[i].steals = 0;
+        pthread_mutex_init(&worker[i].lock, NULL);
+    }
+
+    struct stat st;
+    bool isDir = (stat(input.c_str(), &st) == 0) && S_ISDIR(st.st_mode);
+    vector<string> files;
+
+    if(isDir)
+    {
+        DIR *dir = opendir(input.c_str());
+        struct dirent *entry;
+
+        while(dir && (entry = readdir(dir)) != NULL)
+            if(is_image(entry->d_name))
+                files.push_back(input + "/" + entry->d_name);
+        if(dir) closedir(dir);
+
+        sort(files.begin(), files.end());
+
+        if(files.empty())
+        {
+            printf("No images in %s\n", input.c_str());
+            return 1;
+        }
+
+        // contiguous runs per worker, stealing evens out whatever is left at the end
+        for(size_t i = 0; i < files.size(); i++)
+        {
+            Job_t job;
+            job.index = (int)i;
+            job.name = files[i];
+            worker[(i * numWorkers) / files.size()].jobs.push_back(job);
+        }
+    }
+
+    printf("%s %s with %d workers into %s\n", opName.c_str(), input.c_str(), numWorkers, params.out.c_str());
+
+    double start = now_msec();
+    int jobs = 0;
+
+    for(int i = 0; i < numWorkers; i++)
+        pthread_create(&workerThread[i], NULL, workerService, (void *)&worker[i]);
+
+    if(isDir)
+    {
+        jobs = (int)files.size();
+        for(int i = 0; i < jobs; i++)
+            sem_post(&jobsQueued);
+    }
+    else
+    {
+        VideoCapture capture(input);
+        Mat frame;
+
+        if(!capture.isOpened())
+            printf("Unable to open %s\n", input.c_str());
+
+        // decoding is sequential, hand frames out round robin as they come
+        while(capture.isOpened())
+        {
+            sem_wait(&framesFree);
+            capture >> frame;
+            if(frame.empty())
+                break;
+
+            Job_t job;
+            job.index = jobs;
+            job.frame = frame.clone();
+
+            Worker_t *w = &worker[jobs % numWorkers];
+            pthread_mutex_lock(&w->lock);
+            w->jobs.push_back(job);
+            pthread_mutex_unlock(&w->lock);
+            jobs++;
+            sem_post(&jobsQueued);
+        }
+    }
+
+    noMoreJobs = true;
+    for(int i = 0; i < numWorkers; i++)
+        sem_post(&jobsQueued);
+    for(int i = 0; i < numWorkers; i++)
+        pthread_join(workerThread[i], NULL);
+
+    double elapsed = now_msec() - start;
+
+    vector<Result_t> results;
+    for(int i = 0; i < numWorkers; i++)
+        results.insert(results.end(), worker[i].results.begin(), worker[i].results.end());
+    sort(results.begin(), results.end(), by_index);
+
+    FILE *csv = fopen(csvName.c_str(), "w");
+    double transformTotal = 0.0;
+
+    if(csv)
+        fprintf(csv, "index,name,op,worker,stolen,width,height,features,load_ms,transform_ms,write_ms\n");
+    for(size_t i = 0; i < results.size(); i++)
+    {
+        Result_t &r = results[i];
+        transformTotal += r.transformMsec;
+        if(csv)
+            fprintf(csv, "%d,%s,%s,%d,%d,%d,%d,%zu,%.3lf,%.3lf,%.3lf\n",
+                    r.index, r.name.c_str(), opName.c_str(), r.worker, r.stolen ? 1 : 0,
+                    r.width, r.height, r.features, r.loadMsec, r.transformMsec, r.writeMsec);
+    }
+    if(csv)
+        fclose(csv);
+    else
+        perror(csvName.c_str());
+
+    printf("%zu of %d images in %.2lf sec, %.2lf images/sec, transform ave %.3lf msec\n",
+           results.size(), jobs, elapsed / 1000.0, results.size() * 1000.0 / elapsed,
+           results.empty() ? 0.0 : transformTotal / results.size());
+    for(int i = 0; i < numWorkers; i++)
+        printf("worker %2d: %u images, %u stolen\n", i, worker[i].done, worker[i].steals);
+    printf("timing written to %s\n", csvName.c_str());
+
+    return 0;
+}
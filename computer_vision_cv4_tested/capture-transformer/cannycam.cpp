@@ -1,9 +1,11 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 #include <iostream>
 
 #include <opencv2/imgproc.hpp>
 #include <opencv2/highgui.hpp>
+#include <opencv2/core/hal/intrin.hpp>
 
 using namespace cv;
 
@@ -12,7 +14,21 @@ using namespace cv;
 #define ESCAPE_KEY (27)
 #define SYSTEM_ERROR (-1)
 
+// Default capture size, override with: cannycam <width> <height>
+#define HRES_COLS (640)
+#define VRES_ROWS (480)
 
+// Print per-stage frame time every REPORT_FRAMES frames
+#define REPORT_FRAMES (100)
+
+// Edge composite: the original zero fill plus masked copyTo (two passes over
+// the output), or one pass that ANDs each pixel with its 0/255 Canny mask
+// byte using OpenCV universal intrinsics.  Toggle with 'c' while running.
+#define COMPOSITE_COPYTO (0)
+#define COMPOSITE_FUSED (1)
+
+
+// All allocated once for the capture size and reused every frame
 Mat canny_frame, timg_gray, timg_grad;
 Mat frame;
 
@@ -22,58 +38,188 @@ const int ratio = 3;
 const int kernel_size = 3;
 const char* window_name = "Edge Map";
 
+int compositeMode = COMPOSITE_FUSED;
+
+// accumulated per-stage msec over the current report window
+double grayMsec = 0.0, blurMsec = 0.0, cannyMsec = 0.0, compositeMsec = 0.0, frameMsec = 0.0;
+
+
+static double now_msec(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return ((double)t.tv_sec * 1000.0) + ((double)t.tv_nsec / 1000000.0);
+}
+
+
+// dst = mask ? src : 0 for 3 channel src, in one pass
+static void compositeEdges(const Mat &src, const Mat &mask, Mat &dst)
+{
+    CV_Assert(src.type() == CV_8UC3 && mask.type() == CV_8UC1 && src.size() == mask.size());
+
+    int rows = src.rows, cols = src.cols;
+
+    // continuous buffers are one long row
+    if (src.isContinuous() && mask.isContinuous() && dst.isContinuous())
+    {
+        cols *= rows;
+        rows = 1;
+    }
+
+    for (int y = 0; y < rows; y++)
+    {
+        const uchar *s = src.ptr<uchar>(y);
+        const uchar *m = mask.ptr<uchar>(y);
+        uchar *d = dst.ptr<uchar>(y);
+        int x = 0;
+
+#if CV_SIMD128
+        for (; x <= cols - 16; x += 16)
+        {
+            v_uint8x16 b, g, r;
+            v_uint8x16 vm = v_load(m + x);
+
+            v_load_deinterleave(s + 3*x, b, g, r);
+            v_store_interleave(d + 3*x, b & vm, g & vm, r & vm);
+        }
+#endif
+        for (; x < cols; x++)
+        {
+            uchar k = m[x];
+
+            d[3*x] = s[3*x] & k;
+            d[3*x+1] = s[3*x+1] & k;
+            d[3*x+2] = s[3*x+2] & k;
+        }
+    }
+}
+
 
 void CannyThreshold(int, void*)
 {
+    double t0, t1, t2, t3, t4;
+
+    t0 = now_msec();
     cvtColor(frame, timg_gray, COLOR_BGR2GRAY);
+    t1 = now_msec();
 
     /// Reduce noise with a kernel 3x3
     blur( timg_gray, canny_frame, Size(3,3) );
+    t2 = now_msec();
 
     /// Canny detector
     Canny( canny_frame, canny_frame, lowThreshold, lowThreshold*ratio, kernel_size );
+    t3 = now_msec();
 
     /// Using Canny's output as a mask, we display our result
-    timg_grad = Scalar::all(0);
-
-    frame.copyTo( timg_grad, canny_frame);
-
-    imshow( window_name, timg_grad );
-
+    if (compositeMode == COMPOSITE_COPYTO)
+    {
+        timg_grad = Scalar::all(0);
+        frame.copyTo( timg_grad, canny_frame);
+    }
+    else
+    {
+        compositeEdges(frame, canny_frame, timg_grad);
+    }
+    t4 = now_msec();
+
+    grayMsec += t1 - t0;
+    blurMsec += t2 - t1;
+    cannyMsec += t3 - t2;
+    compositeMsec += t4 - t3;
 }
 
 
 
 int main( int argc, char** argv )
 {
-   VideoCapture cam0(0);
-   namedWindow("video_display");
+   int width = HRES_COLS, height = VRES_ROWS;
+   unsigned int frames = 0;
+   double start, windowStart;
    char winInput;
+   char text[80];
+
+   if (argc == 3)
+   {
+       width = atoi(argv[1]);
+       height = atoi(argv[2]);
+   }
+
+   VideoCapture cam0(0);
 
    if (!cam0.isOpened())
    {
        exit(SYSTEM_ERROR);
    }
 
-   cam0.set(CAP_PROP_FRAME_WIDTH, 640);
-   cam0.set(CAP_PROP_FRAME_HEIGHT, 480);
+   cam0.set(CAP_PROP_FRAME_WIDTH, width);
+   cam0.set(CAP_PROP_FRAME_HEIGHT, height);
+
+   if (!cam0.read(frame) || frame.empty())
+   {
+       exit(SYSTEM_ERROR);
+   }
+
+   printf("%dx%d, press 'c' to toggle copyTo and fused composite\n", frame.cols, frame.rows);
+
+   timg_gray.create(frame.size(), CV_8UC1);
+   canny_frame.create(frame.size(), CV_8UC1);
+   timg_grad.create(frame.size(), frame.type());
+
+   // once, not every frame; the trackbar updates lowThreshold in place and
+   // the next frame picks it up
+   namedWindow("video_display");
+   namedWindow( window_name, WINDOW_AUTOSIZE );
+   createTrackbar( "Min Threshold:", window_name, &lowThreshold, max_lowThreshold );
+
+   windowStart = now_msec();
 
    while (1)
    {
+      start = now_msec();
+
       cam0.read(frame);
+      if (frame.empty())
+          break;
 
-      imshow("video_display", frame);
+      CannyThreshold(0, 0);
 
-      namedWindow( window_name, WINDOW_AUTOSIZE );
-      createTrackbar( "Min Threshold:", window_name, &lowThreshold, max_lowThreshold, CannyThreshold );
+      frameMsec += now_msec() - start;
+      frames++;
 
-      CannyThreshold(0, 0);
+      if ((frames % REPORT_FRAMES) == 0)
+      {
+          double elapsed = now_msec() - windowStart;
+
+          printf("%s: %.2lf FPS, gray %.3lf, blur %.3lf, canny %.3lf, composite %.3lf, capture+edges %.3lf msec\n",
+                 compositeMode == COMPOSITE_FUSED ? "fused" : "copyTo",
+                 REPORT_FRAMES * 1000.0 / elapsed,
+                 grayMsec / REPORT_FRAMES, blurMsec / REPORT_FRAMES, cannyMsec / REPORT_FRAMES,
+                 compositeMsec / REPORT_FRAMES, frameMsec / REPORT_FRAMES);
+
+          grayMsec = blurMsec = cannyMsec = compositeMsec = frameMsec = 0.0;
+          windowStart = now_msec();
+      }
+
+      snprintf(text, sizeof(text), "%s composite", compositeMode == COMPOSITE_FUSED ? "fused" : "copyTo");
+      putText(timg_grad, text, Point(10, 20), FONT_HERSHEY_PLAIN, 1.2, Scalar(255,255,255), 1, LINE_AA);
+
+      imshow("video_display", frame);
+      imshow( window_name, timg_grad );
 
-      if ((winInput = waitKey(10)) == ESCAPE_KEY)
+      if ((winInput = waitKey(1)) == ESCAPE_KEY)
       //if ((winInput = waitKey(0)) == ESCAPE_KEY)
       {
           break;
       }
+      else if(winInput == 'c')
+      {
+          compositeMode = (compositeMode == COMPOSITE_FUSED) ? COMPOSITE_COPYTO : COMPOSITE_FUSED;
+          grayMsec = blurMsec = cannyMsec = compositeMsec = frameMsec = 0.0;
+          frames = 0;
+          windowStart = now_msec();
+      }
       else if(winInput == 'n')
       {
           printf("input %c is ignored\n", winInput);
@@ -1,4 +1,3 @@
-
 // This file is part of OpenCV project.
 // It is subject to the license terms in the LICENSE file found in the top-level directory
 // of this distribution and at http://opencv.org/license.html
@@ -6,32 +5,200 @@
 #include <opencv2/highgui.hpp>
 #include <opencv2/imgproc.hpp>
 #include <opencv2/videoio.hpp>
+#include <opencv2/video.hpp>
 #include <iostream>
 #include <iomanip>
+#include <algorithm>
 using namespace cv;
 using namespace std;
+
+// Detection engine
+//
+// detectMultiScale parallelizes over scale levels only, so the full size
+// level - the most expensive by far - runs on one core while the small
+// levels finish early.  Here every level is cut into bands of TILE_ROWS rows
+// and each (level, band) pair is a separate job for parallel_for_, so the
+// big levels are spread over all cores.  Each band evaluates only windows
+// whose top row falls inside it, reading the rows below from the level
+// image itself.  Levels are sized and resized as detectMultiScale does
+// (INTER_LINEAR_EXACT), so the set of windows and their pixels match it and
+// the same grouping is applied afterwards.
+//
+// The detector runs every Nth frame; in between, boxes are moved by the
+// median Lucas-Kanade displacement of a grid of points inside each box.
+
+// window rows owned by one band at any level, a multiple of the 8 pixel stride
+#define TILE_ROWS (64)
+
+#define MAX_LEVELS (64)
+
+// points per side of the grid tracked inside each box between detections
+#define TRACK_GRID (4)
+
+typedef struct
+{
+    int level;
+    int ownFirst, ownLast;  // window top rows owned by this band, in level pixels
+} TileJob_t;
+
 class Detector
 {
     enum Mode { Default, Daimler } m;
     HOGDescriptor hog, hog_d;
+    bool tiled;
+    // scaled frame per level and per-job results, reused from frame to frame
+    vector<Mat> levelImg;
+    vector<double> levelScale;
+    vector<TileJob_t> jobs;
+    vector< vector<Rect> > jobRects;
+    vector< vector<double> > jobWeights, jobScales;
+    Size plannedFor, plannedWin;
+
+    class LevelBuilder : public ParallelLoopBody
+    {
+    public:
+        LevelBuilder(Detector &d, const Mat &img) : d_(d), img_(img) {}
+        void operator()(const Range &range) const
+        {
+            for (int l = range.start; l < range.end; l++)
+            {
+                Size sz(cvRound(img_.cols / d_.levelScale[l]), cvRound(img_.rows / d_.levelScale[l]));
+                if (sz == img_.size())
+                    d_.levelImg[l] = img_;
+                else
+                    // the interpolation detectMultiScale's own levels use
+                    resize(img_, d_.levelImg[l], sz, 0, 0, INTER_LINEAR_EXACT);
+            }
+        }
+    private:
+        Detector &d_;
+        const Mat &img_;
+    };
+
+    class TileDetector : public ParallelLoopBody
+    {
+    public:
+        TileDetector(Detector &d, const HOGDescriptor &hog, double hitThreshold)
+            : d_(d), hog_(hog), hitThreshold_(hitThreshold) {}
+        void operator()(const Range &range) const
+        {
+            vector<Point> locations;
+            vector<double> weights;
+            for (int j = range.start; j < range.end; j++)
+            {
+                const TileJob_t &job = d_.jobs[j];
+                const Mat &level = d_.levelImg[job.level];
+                double scale = d_.levelScale[job.level];
+                int first = std::max(0, job.ownFirst);
+                int last = std::min(level.rows, job.ownLast + hog_.winSize.height);
+                d_.jobRects[j].clear();
+                d_.jobWeights[j].clear();
+                d_.jobScales[j].clear();
+                // not even one window fits with the padding above and below
+                if (last - first + 64 < hog_.winSize.height)
+                    continue;
+                // the band is a view into the level, so windows near its edges
+                // read real neighbouring rows rather than a replicated border
+                Mat band = level.rowRange(first, last);
+                hog_.detect(band, locations, weights, hitThreshold_, Size(8,8), Size(32,32));
+                for (size_t i = 0; i < locations.size(); i++)
+                {
+                    int y = locations[i].y + first;
+                    if (y < job.ownFirst || y >= job.ownLast)
+                        continue;
+                    d_.jobRects[j].push_back(Rect(cvRound(locations[i].x * scale), cvRound(y * scale),
+                                                  cvRound(hog_.winSize.width * scale), cvRound(hog_.winSize.height * scale)));
+                    d_.jobWeights[j].push_back(weights[i]);
+                    d_.jobScales[j].push_back(scale);
+                }
+            }
+        }
+    private:
+        Detector &d_;
+        const HOGDescriptor &hog_;
+        double hitThreshold_;
+    };
+
+    // Level scales and band jobs depend only on the frame size and window size
+    void planJobs(Size frameSize, Size winSize)
+    {
+        levelScale.clear();
+        jobs.clear();
+        double scale = 1.0;
+        for (int l = 0; l < MAX_LEVELS; l++, scale *= 1.05)
+        {
+            Size sz(cvRound(frameSize.width / scale), cvRound(frameSize.height / scale));
+            if (sz.width < winSize.width || sz.height < winSize.height)
+                break;
+            levelScale.push_back(scale);
+            // padding lets windows start 32 rows above the image, the first
+            // band owns those and the last band owns everything below it
+            for (int y = 0; y < sz.height; y += TILE_ROWS)
+            {
+                TileJob_t job;
+                job.level = (int)levelScale.size() - 1;
+                job.ownFirst = (y == 0) ? -32 : y;
+                job.ownLast = (y + TILE_ROWS >= sz.height) ? sz.height + 32 : y + TILE_ROWS;
+                jobs.push_back(job);
+            }
+        }
+        levelImg.resize(levelScale.size());
+        jobRects.resize(jobs.size());
+        jobWeights.resize(jobs.size());
+        jobScales.resize(jobs.size());
+    }
+
 public:
-    Detector() : m(Default), hog(), hog_d(Size(48, 96), Size(16, 16), Size(8, 8), Size(8, 8), 9)
+    Detector() : m(Default), hog(), hog_d(Size(48, 96), Size(16, 16), Size(8, 8), Size(8, 8), 9), tiled(true)
     {
         hog.setSVMDetector(HOGDescriptor::getDefaultPeopleDetector());
         hog_d.setSVMDetector(HOGDescriptor::getDaimlerPeopleDetector());
     }
     void toggleMode() { m = (m == Default ? Daimler : Default); }
     string modeName() const { return (m == Default ? "Default" : "Daimler"); }
+    void toggleEngine() { tiled = !tiled; }
+    string engineName() const { return (tiled ? "tiled" : "detectMultiScale"); }
+    size_t jobCount() const { return jobs.size(); }
     vector<Rect> detect(InputArray img)
     {
         // Run the detector with default parameters. to get a higher hit-rate
         // (and more false alarms, respectively), decrease the hitThreshold and
         // groupThreshold (set groupThreshold to 0 to turn off the grouping completely).
         vector<Rect> found;
+        if (!tiled)
+        {
+            if (m == Default)
+                hog.detectMultiScale(img, found, 0, Size(8,8), Size(32,32), 1.05, 2, false);
+            else if (m == Daimler)
+                hog_d.detectMultiScale(img, found, 0.5, Size(8,8), Size(32,32), 1.05, 2, true);
+            return found;
+        }
+
+        Mat frame = img.getMat();
+        const HOGDescriptor &active = (m == Default) ? hog : hog_d;
+        if (frame.size() != plannedFor || active.winSize != plannedWin)
+        {
+            planJobs(frame.size(), active.winSize);
+            plannedFor = frame.size();
+            plannedWin = active.winSize;
+        }
+
+        parallel_for_(Range(0, (int)levelScale.size()), LevelBuilder(*this, frame));
+        parallel_for_(Range(0, (int)jobs.size()), TileDetector(*this, active, m == Default ? 0.0 : 0.5), (double)jobs.size());
+
+        vector<double> weights, scales;
+        for (size_t j = 0; j < jobs.size(); j++)
+        {
+            found.insert(found.end(), jobRects[j].begin(), jobRects[j].end());
+            weights.insert(weights.end(), jobWeights[j].begin(), jobWeights[j].end());
+            scales.insert(scales.end(), jobScales[j].begin(), jobScales[j].end());
+        }
+
+        // same grouping detectMultiScale applies with these parameters
         if (m == Default)
-            hog.detectMultiScale(img, found, 0, Size(8,8), Size(32,32), 1.05, 2, false);
-        else if (m == Daimler)
-            hog_d.detectMultiScale(img, found, 0.5, Size(8,8), Size(32,32), 1.05, 2, true);
+            hog.groupRectangles(found, weights, 2, 0.2);
+        else
+            groupRectangles_meanshift(found, weights, scales, 2, hog_d.winSize);
         return found;
     }
     void adjustRect(Rect & r) const
@@ -44,9 +211,54 @@ public:
         r.height = cvRound(r.height*0.8);
     }
 };
+
+// Move each box by the median displacement of a point grid inside it
+static void trackBoxes(const Mat &prevGray, const Mat &gray, vector<Rect> &boxes)
+{
+    vector<Point2f> p0, p1;
+    vector<uchar> status;
+    vector<float> err;
+    if (boxes.empty())
+        return;
+    for (size_t b = 0; b < boxes.size(); b++)
+        for (int gy = 1; gy <= TRACK_GRID; gy++)
+            for (int gx = 1; gx <= TRACK_GRID; gx++)
+                p0.push_back(Point2f(boxes[b].x + boxes[b].width * gx / (TRACK_GRID + 1.0f),
+                                     boxes[b].y + boxes[b].height * gy / (TRACK_GRID + 1.0f)));
+    calcOpticalFlowPyrLK(prevGray, gray, p0, p1, status, err, Size(15,15), 2);
+    for (size_t b = 0; b < boxes.size(); b++)
+    {
+        vector<float> dx, dy;
+        for (int i = b * TRACK_GRID * TRACK_GRID; i < (int)(b + 1) * TRACK_GRID * TRACK_GRID; i++)
+        {
+            if (status[i])
+            {
+                dx.push_back(p1[i].x - p0[i].x);
+                dy.push_back(p1[i].y - p0[i].y);
+            }
+        }
+        // too few points followed, leave the box where it was
+        if (dx.size() < 3)
+            continue;
+        nth_element(dx.begin(), dx.begin() + dx.size()/2, dx.end());
+        nth_element(dy.begin(), dy.begin() + dy.size()/2, dy.end());
+        boxes[b].x += cvRound(dx[dx.size()/2]);
+        boxes[b].y += cvRound(dy[dy.size()/2]);
+    }
+}
+
+static double percentile(vector<double> &v, int p)
+{
+    if (v.empty())
+        return 0.0;
+    sort(v.begin(), v.end());
+    return v[std::min(v.size() - 1, (v.size() * p) / 100)];
+}
+
 static const string keys = "{ help h   |   | print help message }"
                            "{ camera c | 0 | capture video from camera (device index starting from 0) }"
-                           "{ video v  |   | use video as input }";
+                           "{ video v  |   | use video as input }"
+                           "{ every n  | 3 | run the detector every nth frame, track boxes in between }";
 int main(int argc, char** argv)
 {
     CommandLineParser parser(argc, argv, keys);
@@ -58,6 +270,7 @@ int main(int argc, char** argv)
     }
     int camera = parser.get<int>("camera");
     string file = parser.get<string>("video");
+    int every = std::max(1, parser.get<int>("every"));
     if (!parser.check())
     {
         parser.printErrors();
@@ -78,8 +291,15 @@ int main(int argc, char** argv)
     }
     cout << "Press 'q' or <ESC> to quit." << endl;
     cout << "Press <space> to toggle between Default and Daimler detector" << endl;
+    cout << "Press 'e' to toggle between the tiled engine and plain detectMultiScale" << endl;
+    cout << "Running the detector every " << every << " frames on " << getNumThreads() << " threads" << endl;
     Detector detector;
-    Mat frame;
+    Mat frame, gray, prevGray;
+    vector<Rect> found;
+    vector<double> detectMsec, frameMsec;
+    unsigned long frames = 0, detections = 0, boxes = 0;
+    double detectTotal = 0.0;
+    int64 runStart = getTickCount();
     for (;;)
     {
         cap >> frame;
@@ -89,20 +309,39 @@ int main(int argc, char** argv)
             break;
         }
         int64 t = getTickCount();
-        vector<Rect> found = detector.detect(frame);
+        cvtColor(frame, gray, COLOR_BGR2GRAY);
+        bool detectFrame = (frames % every) == 0;
+        if (detectFrame)
+        {
+            int64 d = getTickCount();
+            found = detector.detect(frame);
+            double msec = (getTickCount() - d) * 1000.0 / getTickFrequency();
+            detectMsec.push_back(msec);
+            detectTotal += msec;
+            detections++;
+            boxes += found.size();
+            for (vector<Rect>::iterator i = found.begin(); i != found.end(); ++i)
+                detector.adjustRect(*i);
+        }
+        else
+        {
+            trackBoxes(prevGray, gray, found);
+        }
         t = getTickCount() - t;
+        frameMsec.push_back(t * 1000.0 / getTickFrequency());
+        frames++;
+        swap(prevGray, gray);
         // show the window
         {
             ostringstream buf;
-            buf << "Mode: " << detector.modeName() << " ||| "
+            buf << "Mode: " << detector.modeName() << " (" << detector.engineName() << ") ||| "
                 << "FPS: " << fixed << setprecision(1) << (getTickFrequency() / (double)t);
             putText(frame, buf.str(), Point(10, 30), FONT_HERSHEY_PLAIN, 2.0, Scalar(0, 0, 255), 2, LINE_AA);
         }
         for (vector<Rect>::iterator i = found.begin(); i != found.end(); ++i)
         {
             Rect &r = *i;
-            detector.adjustRect(r);
-            rectangle(frame, r.tl(), r.br(), cv::Scalar(0, 255, 0), 2);
+            rectangle(frame, r.tl(), r.br(), detectFrame ? cv::Scalar(0, 255, 0) : cv::Scalar(0, 255, 255), 2);
         }
         imshow("People detector", frame);
         // interact with user
@@ -116,7 +355,23 @@ int main(int argc, char** argv)
         {
             detector.toggleMode();
         }
+        else if (key == 'e')
+        {
+            detector.toggleEngine();
+        }
+    }
+    double elapsed = (getTickCount() - runStart) / getTickFrequency();
+    if (detections > 0)
+    {
+        cout << fixed << setprecision(2);
+        cout << frames << " frames, " << detections << " detector runs, " << detector.jobCount() << " tile jobs per run" << endl;
+        cout << "sustained " << detections / elapsed << " detector runs/sec, " << boxes / elapsed << " people/sec, "
+             << frames / elapsed << " frames/sec" << endl;
+        cout << "detect msec ave " << detectTotal / detections << ", p50 " << percentile(detectMsec, 50)
+             << ", p90 " << percentile(detectMsec, 90) << ", p99 " << percentile(detectMsec, 99)
+             << ", max " << percentile(detectMsec, 100) << endl;
+        cout << "frame msec p50 " << percentile(frameMsec, 50) << ", p90 " << percentile(frameMsec, 90)
+             << ", p99 " << percentile(frameMsec, 99) << ", max " << percentile(frameMsec, 100) << endl;
     }
     return 0;
 }
-
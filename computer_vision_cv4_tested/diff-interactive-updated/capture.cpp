@@ -1,16 +1,32 @@
 /*
  *
- *  Example by Sam Siewert 
+ *  Example by Sam Siewert
  *
  *  Updated 12/6/18 for OpenCV 3.1
  *
  *  Updated 8/1/23 for OpenCV 4.x
  *
+ *  Tick detection: each frame's percent difference goes through the
+ *  tickdetect engine, which decides online whether the external clock just
+ *  ticked and picks one stable frame per tick to store.
+ *
+ *  The difference itself comes from diffmetric: one fused pass over a
+ *  decimated and/or ROI-restricted luma plane instead of cvtColor, absdiff
+ *  and sum over the whole frame.  Every --validate frames the full metric is
+ *  computed too, and the error and cost of both are reported on exit.
+ *
+ *  Usage: capture [device] [save directory] [--step=4] [--roi=x,y,w,h]
+ *                 [--raw] [--validate=30] [--nodisplay]
+ *
+ *  'r' in the display selects the clock face as the ROI, 'q' or Ctrl-C quits.
+ *
  */
 #include <stdio.h>
 #include <stdlib.h>
 #include <iostream>
 
+#include <math.h>
+#include <signal.h>
 #include <syslog.h>
 #include <time.h>
 
@@ -20,104 +36,253 @@
 #include "opencv2/highgui/highgui.hpp"
 #include "opencv2/imgproc/imgproc.hpp"
 
+#include "tickdetect.h"
+#include "diffmetric.h"
+
 using namespace cv;
 using namespace std;
 
+// noise model and state machine, see tickdetect.h
+#define NOISE_ALPHA (0.02)     // about the last 50 stable frames
+#define K_ENTER (6.0)          // sigmas above the mean to start a tick
+#define K_EXIT (3.0)           // and to end it
+#define SETTLE_FRAMES (2)      // stable frames in a row before storing one
+
+// as fast as the camera delivers; ticks at 10 Hz need at least 20-30 Hz
+#define SAMPLE_DELAY_MSEC (1)
+
 char difftext[20];
 char timetext[20];
 
+// Ctrl-C ends the run with the report, there is no window to press 'q' in
+static volatile sig_atomic_t stop = 0;
+
+static void handle_sigint(int sig)
+{
+    stop = 1;
+}
+
+
+static double now_msec(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return ((double)t.tv_sec * 1000.0) + ((double)t.tv_nsec / 1000000.0);
+}
+
+
+static Rect parse_roi(const String &text)
+{
+    Rect roi;
+
+    if(text.empty() || sscanf(text.c_str(), "%d,%d,%d,%d", &roi.x, &roi.y, &roi.width, &roi.height) != 4)
+        return Rect();
+
+    return roi;
+}
+
+
 int main( int argc, char** argv )
 {
-    Mat mat_frame, mat_gray, mat_diff, mat_gray_prev;
+    Mat mat_frame, mat_gray, mat_diff, mat_gray_prev, mat_candidate, ref_prev, ref_cur;
     VideoCapture vcap;
-    unsigned int diffsum, maxdiff, framecnt=0;
-    double percent_diff=0.0, percent_diff_old = 0.0;
-    double ma_percent_diff = 0.0, fcurtime=0.0, start_fcurtime=0.0;
+    unsigned int framecnt=0;
+    double percent_diff=0.0, ref_diff, err;
+    double fcurtime=0.0, start_fcurtime=0.0, frame_msec, stamp, metric_msec=0.0, t0;
+    double fast_msec=0.0, ref_msec=0.0, err_sum=0.0, err_max=0.0;
+    unsigned long validated=0, agreed=0;
+    int events;
+    char filename[256];
+    tick_detector_t ticks;
+    diff_metric_t metric;
+    diff_format_t format = DIFF_BGR;
+
+    CommandLineParser parser(argc, argv,
+        "{help h ||}"
+        "{@device | 0 | camera index}"
+        "{@dir | . | directory for the stored tick frames}"
+        "{step | 1 | use every step-th pixel of every step-th row}"
+        "{roi | | clock face as x,y,w,h, default whole frame}"
+        "{raw | | capture raw YUYV and use its Y bytes directly}"
+        "{validate | 30 | compare against the full-frame metric every N frames, 0 for never}"
+        "{nodisplay | | no windows, for long unattended runs}");
+
+    if(parser.has("help"))
+    {
+        parser.printMessage();
+        return 0;
+    }
 
-    struct timespec curtime;
+    int device = parser.get<int>("@device");
+    String savedir = parser.get<String>("@dir");
+    int step = parser.get<int>("step");
+    Rect roi = parse_roi(parser.get<String>("roi"));
+    int validate = parser.get<int>("validate");
+    bool display = !parser.has("nodisplay");
 
+    tick_init(&ticks, NOISE_ALPHA, K_ENTER, K_EXIT, SETTLE_FRAMES);
+    signal(SIGINT, handle_sigint);
 
-    clock_gettime(CLOCK_REALTIME, &curtime);
-    start_fcurtime = (double)curtime.tv_sec + ((double)curtime.tv_nsec/1000000000.0);
+    start_fcurtime = now_msec();
 
     //open the video stream and make sure it's opened
     // "0" is the default video device which is normally the built-in webcam
-    if(!vcap.open(0)) 
+    if(!vcap.open(device, parser.has("raw") ? CAP_V4L2 : CAP_ANY))
     {
         std::cout << "Error opening video stream or file" << std::endl;
         return -1;
     }
     else
     {
-	   std::cout << "Opened default camera interface" << std::endl;
+	   std::cout << "Opened camera interface " << device << std::endl;
+    }
+
+    // the Y bytes of YUYV are the luma, no conversion at all
+    if(parser.has("raw"))
+    {
+        vcap.set(CAP_PROP_FOURCC, VideoWriter::fourcc('Y', 'U', 'Y', 'V'));
+        vcap.set(CAP_PROP_CONVERT_RGB, 0);
     }
 
     while(!vcap.read(mat_frame)) {
 	std::cout << "No frame" << std::endl;
 	cv::waitKey(33);
     }
-	
-    cv::cvtColor(mat_frame, mat_gray, COLOR_BGR2GRAY);
 
+    if(mat_frame.type() == CV_8UC2)
+        format = DIFF_YUYV;
+    else if(mat_frame.type() == CV_8UC1)
+        format = DIFF_GRAY;
+    else if(parser.has("raw"))
+        std::cout << "Camera did not deliver raw YUYV, using BGR" << std::endl;
+
+    diff_init(&metric, mat_frame.size(), roi, step, format);
+    diff_update(&metric, mat_frame);
+
+    printf("%dx%d %s, roi %dx%d at %d,%d, step %d, %zu samples per frame\n",
+           mat_frame.cols, mat_frame.rows, format == DIFF_YUYV ? "YUYV" : (format == DIFF_GRAY ? "gray" : "BGR"),
+           metric.roi.width, metric.roi.height, metric.roi.x, metric.roi.y, metric.step, metric.prev.size());
+
+    diff_luma(mat_frame, format, mat_gray);
     mat_diff = mat_gray.clone();
     mat_gray_prev = mat_gray.clone();
 
-    maxdiff = (mat_diff.cols)*(mat_diff.rows)*255;
-
-    while(1)
+    while(!stop)
     {
 	if(!vcap.read(mat_frame)) {
 		std::cout << "No frame" << std::endl;
-		cv::waitKey();
+		if(cv::waitKey(33) == 'q') break;
+		continue;
 	}
-        else
+
+        framecnt++;
+        frame_msec = now_msec();
+        fcurtime = (frame_msec - start_fcurtime) / 1000.0;
+
+        // V4L2 stamps the buffer with its CLOCK_MONOTONIC capture time,
+        // which is earlier and steadier than when read() returned
+        stamp = vcap.get(CAP_PROP_POS_MSEC);
+        if(stamp > 0.0 && frame_msec - stamp >= 0.0 && frame_msec - stamp < 1000.0)
+            frame_msec = stamp;
+
+        t0 = now_msec();
+        percent_diff = diff_update(&metric, mat_frame);
+        fast_msec += now_msec() - t0;
+
+        events = tick_update(&ticks, percent_diff, frame_msec, now_msec());
+        metric_msec += now_msec() - frame_msec;
+
+        // the full metric needs the previous frame's luma, so keep it one
+        // frame ahead; this costs two conversions every validate frames
+        if(validate > 0 && framecnt % validate == (unsigned)validate - 1)
         {
-            framecnt++;
-            clock_gettime(CLOCK_REALTIME, &curtime);
-            fcurtime = (double)curtime.tv_sec + ((double)curtime.tv_nsec/1000000000.0) - start_fcurtime;
+            diff_luma(mat_frame, format, ref_prev);
         }
-	
-	cv::cvtColor(mat_frame, mat_gray, COLOR_BGR2GRAY);
+        else if(validate > 0 && framecnt % validate == 0 && !ref_prev.empty())
+        {
+            t0 = now_msec();
+            diff_luma(mat_frame, format, ref_cur);
+            ref_diff = diff_reference(ref_prev, ref_cur, metric.roi);
+            ref_msec += now_msec() - t0;
 
-	absdiff(mat_gray_prev, mat_gray, mat_diff);
+            err = fabs(ref_diff - percent_diff);
+            err_sum += err;
+            if(err > err_max) err_max = err;
+            if((ref_diff > tick_enter_threshold(&ticks)) == (percent_diff > tick_enter_threshold(&ticks)))
+                agreed++;
+            validated++;
+        }
 
-	// worst case sum is resolution * 255
-	diffsum = (unsigned int)cv::sum(mat_diff)[0]; // single channel sum
+        // keep the best stable frame so far, it may be selected later
+        if(events & TICK_EVENT_CANDIDATE)
+            mat_frame.copyTo(mat_candidate);
 
-	percent_diff = ((double)diffsum / (double)maxdiff)*100.0;
+        if(events & TICK_EVENT_SELECT)
+        {
+            if(format == DIFF_YUYV)
+                cvtColor(mat_candidate, mat_candidate, COLOR_YUV2BGR_YUYV);
+            snprintf(filename, sizeof(filename), "%s/tick_%06lu.ppm", savedir.c_str(), ticks.selected);
+            imwrite(filename, mat_candidate);
+            syslog(LOG_CRIT, "TICK: stored, %lu, cnt, %u, time, %lf\n", ticks.selected, framecnt, fcurtime);
+        }
 
-        if(framecnt < 3)
-            ma_percent_diff=(percent_diff+percent_diff_old)/(double)framecnt;
-        else
-            ma_percent_diff = ( (ma_percent_diff * (double)framecnt) + percent_diff ) / (double)(framecnt+1);
+        if(events & TICK_EVENT_START)
+        {
+            syslog(LOG_CRIT, "TICK: start, %lu, percent diff, %lf, threshold, %lf, cnt, %u, time, %lf\n",
+                   ticks.ticks, percent_diff, tick_enter_threshold(&ticks), framecnt, fcurtime);
+            //printf("TICK @ %lf\n", fcurtime);
+        }
 
-        //printf("percent diff=%lf, old=%lf, ma=%lf, cnt=%u, change=%lf\n", percent_diff, percent_diff_old, ma_percent_diff, framecnt, (percent_diff - percent_diff_old));
+        if(!display)
+            continue;
 
+        // everything below is only for the windows, not part of the metric cost
+        diff_luma(mat_frame, format, mat_gray);
+	absdiff(mat_gray_prev, mat_gray, mat_diff);
 
-        syslog(LOG_CRIT, "TICK: percent diff, %lf, old, %lf, ma, %lf, cnt, %u, change, %lf\n", percent_diff, percent_diff_old, ma_percent_diff, framecnt, (percent_diff - percent_diff_old));
-        sprintf(difftext, "%8d",  diffsum);
+        sprintf(difftext, "%8.4lf",  percent_diff);
         sprintf(timetext, "%6.3lf",  fcurtime);
 
-        percent_diff_old = percent_diff;
-
-        // tested in ERAU Jetson lab
-	if(percent_diff > 0.5)
+	if(ticks.state != TICK_STABLE)
         {
             cv::putText(mat_diff, difftext, Point(30,30), FONT_HERSHEY_COMPLEX_SMALL, 0.8, Scalar(200,200,250), 1, LINE_AA);
             cv::putText(mat_diff, timetext, Point(500,30), FONT_HERSHEY_COMPLEX_SMALL, 0.8, Scalar(200,200,250), 1, LINE_AA);
         }
-
-        //if(percent_diff > 0.5) printf("TICK @ %lf\n", fcurtime);
+        cv::rectangle(mat_diff, metric.roi, Scalar(255), 1);
 
 	cv::imshow("Clock Current", mat_gray);
 	cv::imshow("Clock Previous", mat_gray_prev);
 	cv::imshow("Clock Diff", mat_diff);
 
 
-        char c = cv::waitKey(100); // sample rate
+        char c = cv::waitKey(SAMPLE_DELAY_MSEC); // sample rate
         if( c == 'q' ) break;
 
-	mat_gray_prev = mat_gray.clone();
+        if( c == 'r' )
+        {
+            // a new region changes the scale of the metric, start the noise model over
+            roi = selectROI("Clock Current", mat_gray);
+            diff_init(&metric, mat_frame.size(), roi, step, format);
+            diff_update(&metric, mat_frame);
+            tick_init(&ticks, NOISE_ALPHA, K_ENTER, K_EXIT, SETTLE_FRAMES);
+            ref_prev.release();
+        }
+
+	std::swap(mat_gray_prev, mat_gray);
     }
 
+    printf("%u frames in %.2lf sec, %.2lf fps, capture to classified %.2lf msec/frame\n",
+           framecnt, fcurtime, fcurtime > 0.0 ? framecnt / fcurtime : 0.0, framecnt ? metric_msec / framecnt : 0.0);
+    if(framecnt)
+        printf("difference metric: %.4lf msec/frame", fast_msec / framecnt);
+    if(validated)
+        printf(", full frame %.4lf msec/frame, %.1fx; error mean %.4lf%% max %.4lf%%, tick decision agreed on %.1lf%% of %lu frames",
+               ref_msec / validated, (ref_msec / validated) / (fast_msec / framecnt),
+               err_sum / validated, err_max, 100.0 * agreed / validated, validated);
+    if(framecnt)
+        printf("\n");
+    tick_report(&ticks);
+
+    return 0;
 };
@@ -0,0 +1,167 @@
+// Frame difference metric, see diffmetric.h
+
+#include <stdlib.h>
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/core/hal/intrin.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "diffmetric.h"
+
+using namespace cv;
+
+// BT.601 luma in 8 bit fixed point, the weights sum to 256
+#define Y_B (29)
+#define Y_G (150)
+#define Y_R (77)
+
+
+void diff_init(diff_metric_t *d, Size frame, Rect roi, int step, diff_format_t format)
+{
+    Rect whole(0, 0, frame.width, frame.height);
+
+    d->roi = roi.area() > 0 ? (roi & whole) : whole;
+    d->step = step < 1 ? 1 : step;
+    d->format = format;
+
+    int cols = (d->roi.width + d->step - 1) / d->step;
+    int rows = (d->roi.height + d->step - 1) / d->step;
+
+    d->prev.assign((size_t)cols * rows, 0);
+    d->primed = false;
+}
+
+
+// One row of roi.width pixels, every pixel, SAD against prev which is then
+// replaced by this row's luma
+static unsigned row_sad_dense(const uchar *s, uchar *p, int cols, diff_format_t format)
+{
+    unsigned sad = 0;
+    int x = 0;
+
+#if CV_SIMD128
+    for (; x <= cols - 16; x += 16)
+    {
+        v_uint8x16 y;
+
+        if (format == DIFF_YUYV)
+        {
+            v_uint8x16 uv;
+            v_load_deinterleave(s + 2*x, y, uv);
+        }
+        else if (format == DIFF_BGR)
+        {
+            v_uint8x16 b, g, r;
+            v_uint16x8 bl, bh, gl, gh, rl, rh;
+            v_uint16x8 round = v_setall_u16(128);
+
+            v_load_deinterleave(s + 3*x, b, g, r);
+            v_expand(b, bl, bh);
+            v_expand(g, gl, gh);
+            v_expand(r, rl, rh);
+
+            // at most 255 * 256 + 128, fits 16 bits
+            v_uint16x8 yl = (bl * v_setall_u16(Y_B) + gl * v_setall_u16(Y_G) + rl * v_setall_u16(Y_R) + round) >> 8;
+            v_uint16x8 yh = (bh * v_setall_u16(Y_B) + gh * v_setall_u16(Y_G) + rh * v_setall_u16(Y_R) + round) >> 8;
+            y = v_pack(yl, yh);
+        }
+        else
+            y = v_load(s + x);
+
+        sad += v_reduce_sad(y, v_load(p + x));
+        v_store(p + x, y);
+    }
+#endif
+    for (; x < cols; x++)
+    {
+        int y;
+
+        if (format == DIFF_YUYV)
+            y = s[2*x];
+        else if (format == DIFF_BGR)
+            y = (Y_B * s[3*x] + Y_G * s[3*x+1] + Y_R * s[3*x+2] + 128) >> 8;
+        else
+            y = s[x];
+
+        sad += abs(y - p[x]);
+        p[x] = (uchar)y;
+    }
+
+    return sad;
+}
+
+
+// Every step-th pixel: a gather, no point in vectorizing the SAD
+static unsigned row_sad_sparse(const uchar *s, uchar *p, int cols, int step, diff_format_t format)
+{
+    unsigned sad = 0;
+    int n = 0;
+
+    for (int x = 0; x < cols; x += step, n++)
+    {
+        int y;
+
+        if (format == DIFF_YUYV)
+            y = s[2*x];
+        else if (format == DIFF_BGR)
+            y = (Y_B * s[3*x] + Y_G * s[3*x+1] + Y_R * s[3*x+2] + 128) >> 8;
+        else
+            y = s[x];
+
+        sad += abs(y - p[n]);
+        p[n] = (uchar)y;
+    }
+
+    return sad;
+}
+
+
+double diff_update(diff_metric_t *d, const Mat &frame)
+{
+    const int bpp = d->format == DIFF_BGR ? 3 : (d->format == DIFF_YUYV ? 2 : 1);
+    const int step = d->step;
+    const int cols = (d->roi.width + step - 1) / step;
+    uint64 sad = 0;
+    uchar *p = d->prev.data();
+
+    CV_Assert((int)frame.elemSize() == bpp);
+
+    for (int r = d->roi.y; r < d->roi.y + d->roi.height; r += step, p += cols)
+    {
+        const uchar *s = frame.ptr<uchar>(r) + d->roi.x * bpp;
+
+        if (step == 1)
+            sad += row_sad_dense(s, p, cols, d->format);
+        else
+            sad += row_sad_sparse(s, p, d->roi.width, step, d->format);
+    }
+
+    if (!d->primed)
+    {
+        d->primed = true;
+        return 0.0;
+    }
+
+    return (double)sad / ((double)d->prev.size() * 255.0) * 100.0;
+}
+
+
+void diff_luma(const Mat &frame, diff_format_t format, Mat &y)
+{
+    if (format == DIFF_YUYV)
+        cvtColor(frame, y, COLOR_YUV2GRAY_YUYV);
+    else if (format == DIFF_BGR)
+        cvtColor(frame, y, COLOR_BGR2GRAY);
+    else
+        frame.copyTo(y);
+}
+
+
+double diff_reference(const Mat &prev_y, const Mat &cur_y, Rect roi)
+{
+    Mat diff;
+
+    absdiff(prev_y(roi), cur_y(roi), diff);
+
+    return sum(diff)[0] / ((double)roi.area() * 255.0) * 100.0;
+}
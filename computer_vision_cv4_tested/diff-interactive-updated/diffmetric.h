@@ -0,0 +1,56 @@
+// Frame difference metric for the tick detector
+//
+// The original metric converts the whole frame to gray, takes absdiff with
+// the previous gray frame into a third buffer and sums it - three full
+// passes over 640x480 to get one number.  This computes the same percent
+// difference in a single fused pass that reads only the samples it needs:
+//
+//   - only a region of interest, e.g. the clock face
+//   - only every step-th pixel of every step-th row
+//   - luma straight from the captured format: the Y bytes of raw YUYV, or
+//     a fixed-point BGR to Y, with no separate gray image
+//
+// The previous frame is kept as the compact array of sampled Y values, which
+// the pass reads and overwrites as it goes.  With step 1 the inner loop is
+// a SIMD sum of absolute differences (v_reduce_sad).
+//
+// The result is a percent of the maximum possible difference over the
+// sampled pixels, so it is on the same scale as the full-frame metric.
+
+#ifndef DIFFMETRIC_H
+#define DIFFMETRIC_H
+
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+
+typedef enum
+{
+    DIFF_BGR = 0,   // CV_8UC3, as VideoCapture normally delivers
+    DIFF_YUYV,      // CV_8UC2, raw V4L2 with CAP_PROP_CONVERT_RGB off
+    DIFF_GRAY       // CV_8UC1
+} diff_format_t;
+
+typedef struct
+{
+    cv::Rect roi;
+    int step;
+    diff_format_t format;
+
+    std::vector<uchar> prev;  // sampled Y of the previous frame
+    bool primed;
+} diff_metric_t;
+
+// roi is clipped to the frame, an empty roi means the whole frame
+void diff_init(diff_metric_t *d, cv::Size frame, cv::Rect roi, int step, diff_format_t format);
+
+// Percent difference of frame from the previous one, 0 on the first call
+double diff_update(diff_metric_t *d, const cv::Mat &frame);
+
+// Luma of a frame in any of the formats, for display and validation
+void diff_luma(const cv::Mat &frame, diff_format_t format, cv::Mat &y);
+
+// The original metric, absdiff and sum over every pixel of roi
+double diff_reference(const cv::Mat &prev_y, const cv::Mat &cur_y, cv::Rect roi);
+
+#endif
@@ -0,0 +1,221 @@
+// External clock tick detector, see tickdetect.h
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+#include "tickdetect.h"
+
+
+void tick_init(tick_detector_t *t, double alpha, double k_enter, double k_exit, int settle_frames)
+{
+    memset(t, 0, sizeof(*t));
+
+    t->alpha = alpha;
+    t->k_enter = k_enter;
+    t->k_exit = k_exit;
+    t->settle_frames = settle_frames < 1 ? 1 : settle_frames;
+    t->state = TICK_STABLE;
+    t->period_min = 1e30;
+}
+
+
+double tick_enter_threshold(const tick_detector_t *t)
+{
+    double th = t->mean + t->k_enter * sqrt(t->var);
+
+    return th > TICK_MIN_THRESHOLD ? th : TICK_MIN_THRESHOLD;
+}
+
+
+double tick_exit_threshold(const tick_detector_t *t)
+{
+    double th = t->mean + t->k_exit * sqrt(t->var);
+    double enter = tick_enter_threshold(t);
+
+    // floored in proportion to the enter floor, otherwise a perfectly still
+    // image (mean and sigma both 0) gives 0 and no difference is ever below it
+    double floor = t->k_enter > 0.0 ? TICK_MIN_THRESHOLD * t->k_exit / t->k_enter : 0.0;
+
+    if(th < floor) th = floor;
+
+    // never above the enter threshold, or a tick could end on a moving frame
+    return th < enter ? th : enter;
+}
+
+
+// West's incremental form of the exponentially weighted variance.  Frames
+// that were not quite a tick are clipped so they cannot pull the threshold
+// up after them.
+static void tick_learn(tick_detector_t *t, double diff)
+{
+    double a = t->alpha;
+    double delta = std::min(diff, tick_exit_threshold(t)) - t->mean;
+
+    t->mean += a * delta;
+    t->var = (1.0 - a) * (t->var + a * delta * delta);
+}
+
+
+// Start the noise model from the median and median absolute deviation of
+// the warmup frames, so a tick among them does not inflate the threshold
+static void tick_seed(tick_detector_t *t)
+{
+    double *w = t->warmup, dev[TICK_WARMUP_FRAMES];
+    int mid = TICK_WARMUP_FRAMES / 2;
+
+    std::nth_element(w, w + mid, w + TICK_WARMUP_FRAMES);
+    t->mean = w[mid];
+
+    for(int i = 0; i < TICK_WARMUP_FRAMES; i++)
+        dev[i] = fabs(w[i] - t->mean);
+    std::nth_element(dev, dev + mid, dev + TICK_WARMUP_FRAMES);
+
+    // MAD to sigma for normally distributed noise
+    t->var = (1.4826 * dev[mid]) * (1.4826 * dev[mid]);
+}
+
+
+static void tick_start(tick_detector_t *t, double frame_msec, double now_msec)
+{
+    double latency = now_msec - frame_msec;
+
+    // the previous tick never had a stable frame at all
+    if(t->ticks && !t->tick_done)
+        t->unselected++;
+
+    t->ticks++;
+    if(t->ticks > 1)
+    {
+        double period = frame_msec - t->last_tick_msec;
+
+        t->period_sum += period;
+        t->period_sq += period * period;
+        if(period < t->period_min) t->period_min = period;
+        if(period > t->period_max) t->period_max = period;
+        t->periods++;
+    }
+    t->last_tick_msec = t->tick_msec = frame_msec;
+
+    t->detect_sum += latency;
+    if(latency > t->detect_max) t->detect_max = latency;
+
+    t->state = TICK_MOVING;
+    t->stable_run = 0;
+    t->have_candidate = 0;
+    t->tick_done = 0;
+}
+
+
+static void tick_select(tick_detector_t *t, double now_msec)
+{
+    double latency = now_msec - t->tick_msec;
+
+    t->selected++;
+    t->select_sum += latency;
+    if(latency > t->select_max) t->select_max = latency;
+    t->have_candidate = 0;
+    t->tick_done = 1;
+}
+
+
+int tick_update(tick_detector_t *t, double diff, double frame_msec, double now_msec)
+{
+    int events = 0;
+
+    if(t->frames < TICK_WARMUP_FRAMES)
+    {
+        t->warmup[t->frames++] = diff;
+        if(t->frames == TICK_WARMUP_FRAMES)
+            tick_seed(t);
+        return 0;
+    }
+    t->frames++;
+
+    switch(t->state)
+    {
+    case TICK_STABLE:
+        if(diff > tick_enter_threshold(t))
+        {
+            tick_start(t, frame_msec, now_msec);
+            events |= TICK_EVENT_START;
+        }
+        else
+            tick_learn(t, diff);
+        break;
+
+    case TICK_MOVING:
+        if(diff < tick_exit_threshold(t))
+        {
+            t->state = TICK_SETTLING;
+            t->stable_run = 1;
+            t->have_candidate = 1;
+            t->candidate_diff = diff;
+            events |= TICK_EVENT_CANDIDATE;
+        }
+        break;
+
+    case TICK_SETTLING:
+        if(diff > tick_enter_threshold(t))
+        {
+            // a new tick before this one settled: close this one with its best frame
+            if(t->have_candidate)
+            {
+                tick_select(t, now_msec);
+                events |= TICK_EVENT_SELECT;
+            }
+            tick_start(t, frame_msec, now_msec);
+            events |= TICK_EVENT_START;
+            break;
+        }
+
+        if(diff > tick_exit_threshold(t))
+        {
+            // still some motion, e.g. the hand bouncing
+            t->stable_run = 0;
+            break;
+        }
+
+        tick_learn(t, diff);
+        if(diff < t->candidate_diff)
+        {
+            t->candidate_diff = diff;
+            events |= TICK_EVENT_CANDIDATE;
+        }
+
+        if(++t->stable_run >= t->settle_frames)
+        {
+            tick_select(t, now_msec);
+            events |= TICK_EVENT_SELECT;
+            t->state = TICK_STABLE;
+        }
+        break;
+    }
+
+    return events;
+}
+
+
+void tick_report(const tick_detector_t *t)
+{
+    printf("%lu frames, %lu ticks, %lu stored, %lu without a stable frame\n",
+           t->frames, t->ticks, t->selected, t->unselected);
+    printf("noise: mean %.4lf%%, sigma %.4lf%%, enter %.4lf%%, exit %.4lf%%\n",
+           t->mean, sqrt(t->var), tick_enter_threshold(t), tick_exit_threshold(t));
+
+    if(t->periods)
+    {
+        double mean = t->period_sum / t->periods;
+        double var = t->period_sq / t->periods - mean * mean;
+
+        printf("period: mean %.2lf msec (%.3lf Hz), jitter %.2lf msec, min %.2lf, max %.2lf\n",
+               mean, 1000.0 / mean, sqrt(var > 0.0 ? var : 0.0), t->period_min, t->period_max);
+    }
+    if(t->ticks)
+        printf("detection latency: mean %.2lf msec, max %.2lf msec\n",
+               t->detect_sum / t->ticks, t->detect_max);
+    if(t->selected)
+        printf("tick to stored frame: mean %.2lf msec, max %.2lf msec\n",
+               t->select_sum / t->selected, t->select_max);
+}
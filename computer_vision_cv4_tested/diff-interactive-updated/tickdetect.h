@@ -0,0 +1,91 @@
+// External clock tick detector
+//
+// Classifies each frame of a camera pointed at a clock (1 Hz or 10 Hz hand,
+// digit or LED) from one number per frame, the percent difference from the
+// previous frame, and picks exactly one stable frame per tick to store.
+//
+// The threshold adapts to the camera: an exponentially weighted mean and
+// variance of the difference is kept over stable frames only, and a frame
+// starts a tick when it exceeds mean + k_enter * sigma.  The tick is over
+// once the difference falls back under mean + k_exit * sigma, and the frame
+// is selected after settle_frames stable frames in a row.  Everything is a
+// few arithmetic operations per frame, no history is kept.
+//
+//     STABLE --(diff > enter)--> MOVING --(diff < exit)--> SETTLING
+//       ^                          ^                          |
+//       |                          +--(diff > exit, no        |
+//       |                              stable frame yet)------+
+//       +-----------(settle_frames stable frames: SELECT)-----+
+//
+// If the next tick arrives before the current one has settled, the lowest
+// difference stable frame seen so far (the candidate, which the caller
+// keeps a copy of) is selected for it instead, so every tick that had any
+// stable frame at all still gets exactly one.
+//
+// Plain C++ with no OpenCV dependency.
+
+#ifndef TICKDETECT_H
+#define TICKDETECT_H
+
+// frames used only to learn the noise before any tick is reported
+#define TICK_WARMUP_FRAMES (15)
+
+// lower bound on the enter threshold, percent, for a perfectly still image;
+// the exit threshold's is this scaled by k_exit / k_enter
+#define TICK_MIN_THRESHOLD (0.05)
+
+// bits returned by tick_update()
+#define TICK_EVENT_START (0x1)     // this frame starts a new tick
+#define TICK_EVENT_CANDIDATE (0x2) // keep a copy of this frame, best stable frame so far
+#define TICK_EVENT_SELECT (0x4)    // store the kept candidate for the last tick
+
+typedef enum
+{
+    TICK_STABLE = 0,
+    TICK_MOVING,
+    TICK_SETTLING
+} tick_state_t;
+
+typedef struct
+{
+    // configuration
+    double alpha;            // EWMA weight of a new stable frame
+    double k_enter, k_exit;  // thresholds in sigmas above the mean
+    int settle_frames;       // stable frames in a row before selecting
+
+    // noise model of stable frames, percent difference
+    double mean, var;
+    unsigned long frames;
+    double warmup[TICK_WARMUP_FRAMES];
+
+    tick_state_t state;
+    int stable_run;
+    int have_candidate;
+    int tick_done;           // a frame has been selected for the current tick
+    double candidate_diff;
+    double tick_msec;        // capture time of the frame that started the tick
+
+    // statistics
+    unsigned long ticks, selected, unselected;
+    double last_tick_msec;
+    double period_sum, period_sq, period_min, period_max;
+    unsigned long periods;
+    double detect_sum, detect_max;  // frame capture to tick reported
+    double select_sum, select_max;  // tick start to frame selected
+} tick_detector_t;
+
+void tick_init(tick_detector_t *t, double alpha, double k_enter, double k_exit, int settle_frames);
+
+// One frame: its percent difference from the previous frame, when it was
+// captured and the time now, both in msec on the same clock.  Returns a
+// mask of TICK_EVENT_ bits.
+int tick_update(tick_detector_t *t, double diff, double frame_msec, double now_msec);
+
+// Current thresholds to start and end a tick, percent
+double tick_enter_threshold(const tick_detector_t *t);
+double tick_exit_threshold(const tick_detector_t *t);
+
+// Tick period, detection and selection latency summary on stdout
+void tick_report(const tick_detector_t *t);
+
+#endif
@@ -0,0 +1,105 @@
+// Synthetic check of the tick detector
+//
+// Feeds tick_update() difference traces of a clock seen at FRAME_RATE fps,
+// with the same settings capture.cpp uses, and checks that every tick is
+// detected once and gets exactly one stored frame.  Each tick is a few
+// frames of large difference (the hand moving) over a floor of gaussian
+// noise; a noise level of 0 is a perfectly still camera, or duplicated
+// frames from a file, where still frames differ by exactly 0.
+//
+// Usage: ticksim
+//
+// Prints one line per case and exits non-zero if any case fails.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "tickdetect.h"
+
+#define FRAME_RATE (30.0)
+#define TRACE_SECONDS (10)
+#define MOVING_FRAMES (2)      // frames of each tick with the hand in motion
+#define TICK_DIFF (2.0)        // percent difference while it moves
+
+// capture.cpp's settings
+#define NOISE_ALPHA (0.02)
+#define K_ENTER (6.0)
+#define K_EXIT (3.0)
+#define SETTLE_FRAMES (2)
+
+typedef struct
+{
+    double hz;              // tick rate
+    double noise;           // sigma of the still-frame difference, percent
+} tick_case_t;
+
+static const tick_case_t cases[] =
+{
+    { 1.0, 0.01 },
+    { 1.0, 0.0001 },
+    { 1.0, 0.0 },
+    { 10.0, 0.01 },
+    { 10.0, 0.0 },
+};
+
+
+// Box-Muller, one sample per call is plenty here
+static double gaussian(unsigned int *seed)
+{
+    double u1 = (rand_r(seed) + 1.0) / (RAND_MAX + 2.0);
+    double u2 = (rand_r(seed) + 1.0) / (RAND_MAX + 2.0);
+
+    return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+
+static int run(const tick_case_t *c)
+{
+    tick_detector_t t;
+    unsigned int seed = 1;
+    int frames = (int)(TRACE_SECONDS * FRAME_RATE), period = (int)(FRAME_RATE / c->hz + 0.5);
+    unsigned long expected = 0;
+    int pass;
+
+    tick_init(&t, NOISE_ALPHA, K_ENTER, K_EXIT, SETTLE_FRAMES);
+
+    for(int i = 0; i < frames; i++)
+    {
+        double msec = i * 1000.0 / FRAME_RATE;
+        double diff = fabs(c->noise * gaussian(&seed));
+
+        // first tick a second in, after the warmup frames
+        int phase = i - (int)FRAME_RATE;
+        if(phase >= 0 && phase % period < MOVING_FRAMES)
+        {
+            diff = TICK_DIFF;
+            if(phase % period == 0)
+                expected++;
+        }
+
+        tick_update(&t, diff, msec, msec);
+    }
+
+    // the last tick may not have had time to settle
+    pass = t.ticks == expected && t.selected + 1 >= expected && t.unselected == 0 &&
+           (t.state == TICK_STABLE || t.selected + 1 == expected);
+
+    printf("%4.1lf Hz, noise %.4lf%%: %lu ticks of %lu, %lu stored, %lu without a stable frame, "
+           "ends %s  %s\n", c->hz, c->noise, t.ticks, expected, t.selected, t.unselected,
+           t.state == TICK_STABLE ? "stable" : (t.state == TICK_MOVING ? "MOVING" : "settling"),
+           pass ? "PASS" : "FAIL");
+
+    return pass ? 0 : -1;
+}
+
+
+int main(void)
+{
+    int failed = 0;
+
+    for(size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+        failed |= run(&cases[i]) < 0;
+
+    return failed ? -1 : 0;
+}
@@ -0,0 +1,297 @@
+// Multi-target Kalman tracker, see mtkalman.h
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+
+#include "mtkalman.h"
+
+// velocity variance of a newly started target, pixels^2/frame^2
+#define MTK_INIT_VEL_VAR (100.0f)
+
+// how quickly the drawn box size follows the measured size
+#define MTK_SIZE_GAIN (0.5f)
+
+struct mtk_pair
+{
+    float d2;
+    int target, meas;
+};
+
+
+static double now_msec(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return ((double)t.tv_sec * 1000.0) + ((double)t.tv_nsec / 1000000.0);
+}
+
+
+static bool pair_closer(const mtk_pair &a, const mtk_pair &b)
+{
+    return a.d2 < b.d2;
+}
+
+
+int mtk_init(mtk_tracker_t *t, int capacity, float accel_var, float meas_var)
+{
+    float **f[] = { &t->x, &t->y, &t->vx, &t->vy, &t->p00, &t->p01, &t->p11,
+                    &t->w, &t->h, &t->zx, &t->zy, &t->zw, &t->zh, &t->has };
+    unsigned int **u[] = { &t->id, &t->hits, &t->misses };
+
+    memset(t, 0, sizeof(*t));
+
+    // every array on its own cache line so the loops start aligned
+    for(size_t i = 0; i < sizeof(f)/sizeof(f[0]); i++)
+        if(posix_memalign((void **)f[i], 64, capacity * sizeof(float)) != 0)
+        {
+            mtk_free(t);
+            return -1;
+        }
+    for(size_t i = 0; i < sizeof(u)/sizeof(u[0]); i++)
+        if(posix_memalign((void **)u[i], 64, capacity * sizeof(unsigned int)) != 0)
+        {
+            mtk_free(t);
+            return -1;
+        }
+
+    t->capacity = capacity;
+    t->accel_var = accel_var;
+    t->meas_var = meas_var;
+
+    return 0;
+}
+
+
+void mtk_free(mtk_tracker_t *t)
+{
+    free(t->x); free(t->y); free(t->vx); free(t->vy);
+    free(t->p00); free(t->p01); free(t->p11);
+    free(t->w); free(t->h);
+    free(t->zx); free(t->zy); free(t->zw); free(t->zh); free(t->has);
+    free(t->id); free(t->hits); free(t->misses);
+    free(t->pairs);
+    free(t->meas_used);
+    memset(t, 0, sizeof(*t));
+}
+
+
+// x' = x + v dt, P' = F P F^T + Q with white-noise acceleration Q
+static void mtk_predict(mtk_tracker_t *t, float dt)
+{
+    float *__restrict x = t->x, *__restrict y = t->y;
+    float *__restrict vx = t->vx, *__restrict vy = t->vy;
+    float *__restrict p00 = t->p00, *__restrict p01 = t->p01, *__restrict p11 = t->p11;
+    float *__restrict zx = t->zx, *__restrict zy = t->zy;
+    float *__restrict zw = t->zw, *__restrict zh = t->zh, *__restrict has = t->has;
+    const float *__restrict w = t->w, *__restrict h = t->h;
+    const float dt2 = dt * dt;
+    const float q00 = t->accel_var * dt2 * dt2 * 0.25f;
+    const float q01 = t->accel_var * dt2 * dt * 0.5f;
+    const float q11 = t->accel_var * dt2;
+    const int n = t->count;
+
+    for(int i = 0; i < n; i++)
+    {
+        float a = p00[i], b = p01[i], c = p11[i];
+
+        x[i] += vx[i] * dt;
+        y[i] += vy[i] * dt;
+        p00[i] = a + dt * (2.0f * b + dt * c) + q00;
+        p01[i] = b + dt * c + q01;
+        p11[i] = c + q11;
+
+        // no measurement yet: a zero innovation, so the update leaves it alone
+        zx[i] = x[i];
+        zy[i] = y[i];
+        zw[i] = w[i];
+        zh[i] = h[i];
+        has[i] = 0.0f;
+    }
+}
+
+
+// Greedy nearest-first assignment inside the gate
+static int mtk_associate(mtk_tracker_t *t, const mtk_box_t *meas, int n)
+{
+    size_t npairs = 0, need = (size_t)t->count * (size_t)n;
+    int matched = 0;
+
+    if(need > t->pairs_capacity)
+    {
+        mtk_pair *p = (mtk_pair *)realloc(t->pairs, need * sizeof(mtk_pair));
+        if(!p) return 0;
+        t->pairs = p;
+        t->pairs_capacity = need;
+    }
+
+    for(int i = 0; i < t->count; i++)
+    {
+        float inv_s = 1.0f / (t->p00[i] + t->meas_var);
+
+        for(int j = 0; j < n; j++)
+        {
+            float dx = meas[j].x + 0.5f * meas[j].w - t->x[i];
+            float dy = meas[j].y + 0.5f * meas[j].h - t->y[i];
+            float d2 = (dx * dx + dy * dy) * inv_s;
+
+            if(d2 < MTK_GATE_SQ)
+            {
+                t->pairs[npairs].d2 = d2;
+                t->pairs[npairs].target = i;
+                t->pairs[npairs].meas = j;
+                npairs++;
+            }
+        }
+    }
+
+    std::sort(t->pairs, t->pairs + npairs, pair_closer);
+
+    for(size_t k = 0; k < npairs; k++)
+    {
+        int i = t->pairs[k].target, j = t->pairs[k].meas;
+
+        if(t->has[i] != 0.0f || t->meas_used[j])
+            continue;
+
+        t->zx[i] = meas[j].x + 0.5f * meas[j].w;
+        t->zy[i] = meas[j].y + 0.5f * meas[j].h;
+        t->zw[i] = meas[j].w;
+        t->zh[i] = meas[j].h;
+        t->has[i] = 1.0f;
+        t->meas_used[j] = 1;
+        matched++;
+    }
+
+    return matched;
+}
+
+
+// Position-only measurement, H = [1 0], gain scaled by has[] so unmatched
+// targets go through the same loop unchanged
+static void mtk_update(mtk_tracker_t *t)
+{
+    float *__restrict x = t->x, *__restrict y = t->y;
+    float *__restrict vx = t->vx, *__restrict vy = t->vy;
+    float *__restrict p00 = t->p00, *__restrict p01 = t->p01, *__restrict p11 = t->p11;
+    float *__restrict w = t->w, *__restrict h = t->h;
+    const float *__restrict zx = t->zx, *__restrict zy = t->zy;
+    const float *__restrict zw = t->zw, *__restrict zh = t->zh, *__restrict has = t->has;
+    const float r = t->meas_var;
+    const int n = t->count;
+
+    for(int i = 0; i < n; i++)
+    {
+        float a = p00[i], b = p01[i], c = p11[i];
+        float inv_s = has[i] / (a + r);
+        float k0 = a * inv_s, k1 = b * inv_s;
+        float ix = zx[i] - x[i], iy = zy[i] - y[i];
+
+        x[i] += k0 * ix;
+        y[i] += k0 * iy;
+        vx[i] += k1 * ix;
+        vy[i] += k1 * iy;
+
+        p00[i] = a - k0 * a;
+        p01[i] = b - k0 * b;
+        p11[i] = c - k1 * b;
+
+        w[i] += MTK_SIZE_GAIN * (zw[i] - w[i]);
+        h[i] += MTK_SIZE_GAIN * (zh[i] - h[i]);
+    }
+}
+
+
+// Remove lost targets and start new ones; the order of targets is not kept
+static void mtk_maintain(mtk_tracker_t *t, const mtk_box_t *meas, int n)
+{
+    for(int i = t->count - 1; i >= 0; i--)
+    {
+        if(t->has[i] != 0.0f)
+        {
+            t->hits[i]++;
+            t->misses[i] = 0;
+            continue;
+        }
+
+        if(++t->misses[i] <= MTK_MAX_MISSES)
+            continue;
+
+        int last = --t->count;
+        t->x[i] = t->x[last]; t->y[i] = t->y[last];
+        t->vx[i] = t->vx[last]; t->vy[i] = t->vy[last];
+        t->p00[i] = t->p00[last]; t->p01[i] = t->p01[last]; t->p11[i] = t->p11[last];
+        t->w[i] = t->w[last]; t->h[i] = t->h[last];
+        t->has[i] = t->has[last];
+        t->id[i] = t->id[last]; t->hits[i] = t->hits[last]; t->misses[i] = t->misses[last];
+    }
+
+    for(int j = 0; j < n && t->count < t->capacity; j++)
+    {
+        if(t->meas_used[j])
+            continue;
+
+        int i = t->count++;
+        t->x[i] = meas[j].x + 0.5f * meas[j].w;
+        t->y[i] = meas[j].y + 0.5f * meas[j].h;
+        t->vx[i] = t->vy[i] = 0.0f;
+        t->p00[i] = t->meas_var;
+        t->p01[i] = 0.0f;
+        t->p11[i] = MTK_INIT_VEL_VAR;
+        t->w[i] = meas[j].w;
+        t->h[i] = meas[j].h;
+        t->has[i] = 0.0f;
+        t->id[i] = t->next_id++;
+        t->hits[i] = 1;
+        t->misses[i] = 0;
+    }
+}
+
+
+int mtk_step(mtk_tracker_t *t, const mtk_box_t *meas, int n, float dt)
+{
+    double start, mid;
+    int matched = 0;
+
+    start = now_msec();
+    mtk_predict(t, dt);
+    mid = now_msec();
+    t->predict_msec = mid - start;
+
+    // new targets are started from measurements left unused, so this is
+    // needed even when there is nothing to associate them with yet
+    if(n > t->meas_capacity)
+    {
+        unsigned char *u = (unsigned char *)realloc(t->meas_used, n);
+        if(!u) return 0;
+        t->meas_used = u;
+        t->meas_capacity = n;
+    }
+    if(n > 0)
+        memset(t->meas_used, 0, n);
+
+    matched = mtk_associate(t, meas, n);
+    start = now_msec();
+    t->associate_msec = start - mid;
+
+    mtk_update(t);
+    mtk_maintain(t, meas, n);
+    t->update_msec = now_msec() - start;
+
+    return matched;
+}
+
+
+mtk_box_t mtk_target_box(const mtk_tracker_t *t, int i)
+{
+    mtk_box_t b;
+
+    b.w = t->w[i];
+    b.h = t->h[i];
+    b.x = t->x[i] - 0.5f * b.w;
+    b.y = t->y[i] - 0.5f * b.h;
+
+    return b;
+}
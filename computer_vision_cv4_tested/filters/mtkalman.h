@@ -0,0 +1,88 @@
+// Multi-target Kalman tracker
+//
+// Tracks hundreds of image-plane targets (e.g. motion_detector blobs) with
+// one constant-velocity Kalman filter each, stored as a structure of arrays
+// so predict and update are straight loops over contiguous floats that the
+// compiler can vectorize, instead of one cv::KalmanFilter object with small
+// Mat allocations per target.
+//
+// State per target is (x, y, vx, vy) for the box center.  The x and y axes
+// are independent and share the same process and measurement noise, so they
+// also share one symmetric 2x2 covariance (p00, p01, p11) - three floats per
+// target instead of a 4x4 matrix.
+//
+// Each frame, mtk_step():
+//   1) predicts every target forward by dt
+//   2) associates measurements to targets, nearest first, within a gate on
+//      the normalized innovation
+//   3) updates matched targets, starts new ones from unmatched measurements,
+//      and drops targets that have gone unmatched for too long
+//
+// Plain C++ with no OpenCV dependency, so it builds and benchmarks anywhere.
+
+#ifndef MTKALMAN_H
+#define MTKALMAN_H
+
+#include <stddef.h>
+
+// drop a target after this many frames without a measurement
+#define MTK_MAX_MISSES (5)
+
+// report a target as confirmed once it has been matched this many times
+#define MTK_MIN_HITS (3)
+
+// association gate on the normalized innovation, squared (about 3 sigma)
+#define MTK_GATE_SQ (9.0f)
+
+typedef struct
+{
+    float x, y, w, h;       // top left corner and size, as from a bounding box
+} mtk_box_t;
+
+typedef struct
+{
+    // filter state and shared per-axis covariance, one entry per target
+    float *x, *y, *vx, *vy;
+    float *p00, *p01, *p11;
+
+    // box size, smoothed, only carried along for drawing
+    float *w, *h;
+
+    // measurement assigned this frame, and 1.0 or 0.0 for whether there is one
+    float *zx, *zy, *zw, *zh, *has;
+
+    unsigned int *id, *hits, *misses;
+
+    int count, capacity;
+    unsigned int next_id;
+
+    // noise: acceleration variance per frame^2, measurement variance in pixels^2
+    float accel_var, meas_var;
+
+    // association scratch, sized for capacity x max measurements
+    struct mtk_pair *pairs;
+    size_t pairs_capacity;
+    unsigned char *meas_used;
+    int meas_capacity;
+
+    // cost of the last mtk_step, in msec
+    double predict_msec, associate_msec, update_msec;
+} mtk_tracker_t;
+
+// Allocate room for up to capacity targets; returns 0 or -1 on allocation failure
+int mtk_init(mtk_tracker_t *t, int capacity, float accel_var, float meas_var);
+void mtk_free(mtk_tracker_t *t);
+
+// One frame: predict by dt, associate and update with n measurements.
+// Returns the number of measurements matched to existing targets.
+int mtk_step(mtk_tracker_t *t, const mtk_box_t *meas, int n, float dt);
+
+// Current box of target i, top left and size, from the filtered center
+mtk_box_t mtk_target_box(const mtk_tracker_t *t, int i);
+
+static inline int mtk_confirmed(const mtk_tracker_t *t, int i)
+{
+    return t->hits[i] >= MTK_MIN_HITS;
+}
+
+#endif
@@ -0,0 +1,199 @@
+// Multi-target Kalman tracker benchmark
+//
+// Simulates N targets moving at constant velocity in a 1280x720 frame,
+// bouncing off the edges, and feeds noisy box measurements (some missed, in
+// random order) through mtk_step() for a number of frames.  For each target
+// count it reports the per-frame cost of predict, association and update,
+// the cost per target, and how closely the confirmed tracks follow the
+// truth.
+//
+// Usage: mtkalman_bench [frames] [counts...]
+//
+//        defaults are 300 frames and 10 50 100 250 500 1000 targets
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <math.h>
+
+#include "mtkalman.h"
+
+#define FRAME_COLS (1280)
+#define FRAME_ROWS (720)
+
+#define BOX_SIZE (24.0f)
+#define MAX_SPEED (4.0f)         // pixels per frame
+#define MEAS_SIGMA (1.5f)        // pixels
+#define MISS_PERCENT (10)
+
+// the first frames only start tracks, leave them out of the error average
+#define SETTLE_FRAMES (10)
+
+typedef struct
+{
+    float x, y, vx, vy;
+} truth_t;
+
+
+static float uniform(unsigned int *seed, float lo, float hi)
+{
+    return lo + (hi - lo) * ((float)rand_r(seed) / (float)RAND_MAX);
+}
+
+
+static float gaussian(unsigned int *seed)
+{
+    float u1 = uniform(seed, 1e-6f, 1.0f), u2 = uniform(seed, 0.0f, 1.0f);
+
+    return sqrtf(-2.0f * logf(u1)) * cosf(2.0f * (float)M_PI * u2);
+}
+
+
+static void run(int targets, int frames)
+{
+    unsigned int seed = 1234;
+    truth_t *truth = (truth_t *)malloc(targets * sizeof(truth_t));
+    mtk_box_t *meas = (mtk_box_t *)malloc(targets * sizeof(mtk_box_t));
+    mtk_tracker_t tracker;
+    double predict = 0.0, associate = 0.0, update = 0.0, worst = 0.0;
+    double err_sum = 0.0;
+    unsigned long err_count = 0, matched = 0, measured = 0;
+
+    if(mtk_init(&tracker, 2 * targets, 0.05f, MEAS_SIGMA * MEAS_SIGMA) < 0)
+    {
+        fprintf(stderr, "mtk_init failed for %d targets\n", targets);
+        exit(EXIT_FAILURE);
+    }
+
+    for(int i = 0; i < targets; i++)
+    {
+        truth[i].x = uniform(&seed, BOX_SIZE, FRAME_COLS - BOX_SIZE);
+        truth[i].y = uniform(&seed, BOX_SIZE, FRAME_ROWS - BOX_SIZE);
+        truth[i].vx = uniform(&seed, -MAX_SPEED, MAX_SPEED);
+        truth[i].vy = uniform(&seed, -MAX_SPEED, MAX_SPEED);
+    }
+
+    for(int f = 0; f < frames; f++)
+    {
+        int n = 0;
+
+        for(int i = 0; i < targets; i++)
+        {
+            truth_t *t = &truth[i];
+
+            t->x += t->vx;
+            t->y += t->vy;
+            if(t->x < BOX_SIZE || t->x > FRAME_COLS - BOX_SIZE) t->vx = -t->vx;
+            if(t->y < BOX_SIZE || t->y > FRAME_ROWS - BOX_SIZE) t->vy = -t->vy;
+
+            if((rand_r(&seed) % 100) < MISS_PERCENT)
+                continue;
+
+            meas[n].w = meas[n].h = BOX_SIZE;
+            meas[n].x = t->x + MEAS_SIGMA * gaussian(&seed) - 0.5f * BOX_SIZE;
+            meas[n].y = t->y + MEAS_SIGMA * gaussian(&seed) - 0.5f * BOX_SIZE;
+            n++;
+        }
+
+        // detectors report blobs in scan order, not target order
+        for(int j = n - 1; j > 0; j--)
+        {
+            int k = rand_r(&seed) % (j + 1);
+            mtk_box_t tmp = meas[j]; meas[j] = meas[k]; meas[k] = tmp;
+        }
+
+        matched += mtk_step(&tracker, meas, n, 1.0f);
+        measured += n;
+
+        double cost = tracker.predict_msec + tracker.associate_msec + tracker.update_msec;
+        predict += tracker.predict_msec;
+        associate += tracker.associate_msec;
+        update += tracker.update_msec;
+        if(cost > worst) worst = cost;
+
+        if(f < SETTLE_FRAMES)
+            continue;
+
+        // distance from each truth to the nearest confirmed track, outside the timing
+        for(int i = 0; i < targets; i++)
+        {
+            float best = 1e30f;
+
+            for(int k = 0; k < tracker.count; k++)
+            {
+                if(!mtk_confirmed(&tracker, k)) continue;
+                float dx = tracker.x[k] - truth[i].x, dy = tracker.y[k] - truth[i].y;
+                float d2 = dx * dx + dy * dy;
+                if(d2 < best) best = d2;
+            }
+
+            if(best < 1e30f)
+            {
+                err_sum += sqrtf(best);
+                err_count++;
+            }
+        }
+    }
+
+    double total = predict + associate + update;
+
+    printf("%5d targets: %7.4lf msec/frame (predict %.4lf, associate %.4lf, update %.4lf), max %.4lf, "
+           "%.3lf usec/target, %d tracks, %.1lf%% matched, mean error %.2lf px\n",
+           targets, total / frames, predict / frames, associate / frames, update / frames, worst,
+           1000.0 * total / frames / targets, tracker.count,
+           measured ? 100.0 * matched / measured : 0.0,
+           err_count ? err_sum / err_count : 0.0);
+
+    mtk_free(&tracker);
+    free(truth);
+    free(meas);
+}
+
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [frames] [counts...]\n"
+                    "       frames and target counts are positive integers\n", prog);
+    exit(-1);
+}
+
+
+// a positive integer, the whole argument
+static int count_arg(const char *prog, const char *arg)
+{
+    char *end;
+    long v = strtol(arg, &end, 10);
+
+    if(end == arg || *end != '\0' || v < 1 || v > INT_MAX)
+        usage(prog);
+
+    return (int)v;
+}
+
+
+int main(int argc, char *argv[])
+{
+    int defaults[] = { 10, 50, 100, 250, 500, 1000 };
+    int frames = 300;
+
+    if(argc > 1) frames = count_arg(argv[0], argv[1]);
+
+    // reject bad counts before any of the runs start
+    for(int i = 2; i < argc; i++)
+        count_arg(argv[0], argv[i]);
+
+    printf("%d frames, measurement sigma %.1f px, %d%% missed detections\n", frames, MEAS_SIGMA, MISS_PERCENT);
+
+    if(argc > 2)
+    {
+        for(int i = 2; i < argc; i++)
+            run(count_arg(argv[0], argv[i]), frames);
+    }
+    else
+    {
+        for(size_t i = 0; i < sizeof(defaults)/sizeof(defaults[0]); i++)
+            run(defaults[i], frames);
+    }
+
+    return 0;
+}
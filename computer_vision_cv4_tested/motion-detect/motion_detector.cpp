@@ -10,6 +10,10 @@
 #include <dirent.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "../filters/mtkalman.h"
 
 using namespace std;
 using namespace cv;
@@ -25,7 +29,26 @@ using namespace cv;
 #define DIRECTORY_DETECT ("/tmp/")
 #define DIRECTORY_COLLECT ("/tmp/")
 #define FILE_FORMAT ("%d%h%Y_%H%M%S") // 1Jan1970/1Jan1970_12153
+
+// Encoder for saved frames - PNG is lossless but several times slower than JPEG
+#define SAVE_PNG (0)
+#define SAVE_JPEG (1)
+#define SAVE_ENCODER SAVE_PNG
+
+#define PNG_COMPRESSION (1) // 0-9, OpenCV default is 3, 1 is much faster for little size cost
+#define JPEG_QUALITY (90) // 0-100
+
+#if (SAVE_ENCODER == SAVE_JPEG)
+#define EXTENSION (".jpg") // extension of the images
+#else
 #define EXTENSION (".png") // extension of the images
+#endif
+
+// Frames waiting for the saver thread. When it falls behind, new saves are
+// dropped and counted rather than stalling the capture loop.
+#define SAVE_QUEUE_SLOTS (8)
+
+#define ESCAPE_KEY (27)
 
 #define MAX_THRESHOLD 255
 #define MAX_DEVIATION 255 // Maximum allowable deviation of a pixel to count as "changed"
@@ -36,15 +59,45 @@ int currentMotionTrigger = 10;
 
 #define CAM_WIDTH_OFFSET 0
 
+// Gray frame history, current plus the two before it
+#define HISTORY_SLOTS (3)
+
 bool running = true;
 
+// Report detectMotion() cost every REPORT_FRAMES frames
+#define REPORT_FRAMES (100)
+
+// Blobs smaller than this many pixels are not handed to the tracker
+#define MIN_BLOB_AREA (20)
+
+// Most blobs and targets the multi-target tracker handles at once
+#define MAX_TARGETS (256)
+
+// Uncomment to also run the original meanStdDev + per-pixel loop each frame
+// and check the fused pass against it
+//#define CHECK_DETECT
+
 typedef struct {
   bool isMotion;
   Scalar mean;
   Scalar stddev;
   int numberOfChanges;
+  Rect changedBounds; // bounding box of all changed pixels, empty if none
 } MotionDetectData_t;
 
+// detectMotion() splits the mask into this many horizontal stripes, each
+// reduced independently by parallel_for_ into its own slot, so the pass
+// needs no locks and allocates nothing per frame
+#define DETECT_STRIPES (8)
+
+typedef struct {
+  int changes;
+  int min_x, max_x;
+  int min_y, max_y;
+} MotionStripe_t;
+
+static MotionStripe_t motionStripes[DETECT_STRIPES];
+
 // Check if the directory exists, if not create it
 // This function will create a new directory if the image is the first
 // image taken for a specific day
@@ -58,67 +111,232 @@ inline void directoryExistsOrCreate(const char* pzPath) {
 }
 
 
+typedef struct {
+  Mat frame; // allocated on first use, then reused for every frame
+  time_t captureTime;
+  unsigned int sequence;
+  const char *directory;
+  int traceOn;
+} SaveRequest_t;
+
+// Single producer (capture loop), single consumer (saver thread) ring,
+// with counting semaphores for the free and filled slots
+static SaveRequest_t saveQueue[SAVE_QUEUE_SLOTS];
+static int saveHead = 0, saveTail = 0;
+static sem_t saveSlotsFree, saveSlotsFilled;
+static pthread_t saverThread;
+static volatile bool saverStop = false;
+
+static unsigned int savesQueued = 0, savesDropped = 0;
+static volatile unsigned int savesWritten = 0, savesFailed = 0;
+
+
 // When motion is detected we write the image to disk
 //    - Check if the directory exists where the image will be stored.
 //    - Build the directory and image names.
-inline bool saveImg(Mat image, const string directory,
-                    const string extension, const string fileFormat,
-                    const int sequence, int traceOn)
+//
+// Runs on the saver thread only, so the directory check is cached: the
+// opendir/mkdir is only repeated when the directory name changes.
+inline bool saveImg(const SaveRequest_t &request, const string extension,
+                    const string fileFormat, const vector<int> &encodeParams)
 {
+  static string checkedDirectory;
   stringstream ss;
-  time_t seconds;
-  struct tm * timeinfo;
+  struct tm timeinfo;
   char timeStr[80];
-  time(&seconds);
 
-  // Get the current time
-  timeinfo = localtime(&seconds);
+  // Time of capture, not of the (possibly much later) write
+  localtime_r(&request.captureTime, &timeinfo);
 
   // Create name for the date directory
-  directoryExistsOrCreate(directory.c_str());
+  if (checkedDirectory != request.directory) {
+    directoryExistsOrCreate(request.directory);
+    checkedDirectory = request.directory;
+  }
 
   // Create name for the image
-  strftime(timeStr, 80, fileFormat.c_str(), timeinfo);
+  strftime(timeStr, 80, fileFormat.c_str(), &timeinfo);
 
   ss.str("");
-  ss << directory << timeStr << "_" << sequence << extension;
+  ss << request.directory << timeStr << "_" << request.sequence << extension;
 
-  if(traceOn)
+  if(request.traceOn)
       cout << "Saving Image: " << ss.str() << endl;
 
-  return imwrite(ss.str().c_str(), image);
+  return imwrite(ss.str().c_str(), request.frame, encodeParams);
 }
 
+
+void *saverService(void *threadp)
+{
+  vector<int> encodeParams;
+
+#if (SAVE_ENCODER == SAVE_JPEG)
+  encodeParams.push_back(IMWRITE_JPEG_QUALITY);
+  encodeParams.push_back(JPEG_QUALITY);
+#else
+  encodeParams.push_back(IMWRITE_PNG_COMPRESSION);
+  encodeParams.push_back(PNG_COMPRESSION);
+#endif
+
+  int freeSlots;
+
+  while (1) {
+    sem_wait(&saveSlotsFilled);
+
+    // stop is posted as one extra fill, exit once everything queued is written
+    sem_getvalue(&saveSlotsFree, &freeSlots);
+    if (saverStop && freeSlots == SAVE_QUEUE_SLOTS) break;
+
+    if (saveImg(saveQueue[saveHead], EXTENSION, FILE_FORMAT, encodeParams))
+      savesWritten++;
+    else
+      savesFailed++;
+
+    saveHead = (saveHead + 1) % SAVE_QUEUE_SLOTS;
+    sem_post(&saveSlotsFree);
+  }
+
+  return NULL;
+}
+
+
+// Called from the capture loop: costs one frame copy into a preallocated
+// slot, never an encode or file system call
+inline bool queueSaveImg(const Mat &image, const char *directory,
+                         const unsigned int sequence, int traceOn)
+{
+  SaveRequest_t *request;
+
+  if (sem_trywait(&saveSlotsFree) != 0) {
+    savesDropped++;
+    return false;
+  }
+
+  request = &saveQueue[saveTail];
+  image.copyTo(request->frame);
+  time(&request->captureTime);
+  request->sequence = sequence;
+  request->directory = directory;
+  request->traceOn = traceOn;
+
+  saveTail = (saveTail + 1) % SAVE_QUEUE_SLOTS;
+  savesQueued++;
+  sem_post(&saveSlotsFilled);
+
+  return true;
+}
+
+
+// Reduce one stripe of rows of the binary motion mask to a changed-pixel
+// count and bounding box. countNonZero is SIMD in OpenCV, and only rows that
+// actually changed are scanned again for their left and right extent.
+class MotionStripeReducer : public ParallelLoopBody {
+public:
+  MotionStripeReducer(const Mat &motion, int rowsPerStripe)
+    : motion_(motion), rowsPerStripe_(rowsPerStripe) {}
+
+  void operator()(const Range &range) const {
+    for (int s = range.start; s < range.end; s++) {
+      MotionStripe_t &stripe = motionStripes[s];
+      int rowEnd = std::min(motion_.rows, (s + 1) * rowsPerStripe_);
+
+      stripe.changes = 0;
+      stripe.min_x = motion_.cols; stripe.max_x = -1;
+      stripe.min_y = motion_.rows; stripe.max_y = -1;
+
+      for (int j = s * rowsPerStripe_; j < rowEnd; j++) {
+        const uchar *row = motion_.ptr<uchar>(j);
+        // header only, wraps the row in place
+        int rowChanges = countNonZero(Mat(1, motion_.cols, CV_8UC1, (void *)row));
+
+        if (rowChanges == 0) continue;
+
+        int left = 0, right = motion_.cols - 1;
+        while (row[left] == 0) left++;
+        while (row[right] == 0) right--;
+
+        stripe.changes += rowChanges;
+        if (left < stripe.min_x) stripe.min_x = left;
+        if (right > stripe.max_x) stripe.max_x = right;
+        if (j < stripe.min_y) stripe.min_y = j;
+        stripe.max_y = j;
+      }
+    }
+  }
+
+private:
+  const Mat &motion_;
+  int rowsPerStripe_;
+};
+
+
 // Check if there is motion in the result matrix. Count the number of changes and return.
+//
+// motion is the eroded threshold mask, so every pixel is either 0 or 255 and
+// the changes are exactly the nonzero pixels. The mean and standard deviation
+// then follow from the change count alone, which lets one pass over the
+// image replace meanStdDev plus a second per-pixel loop.
 inline MotionDetectData_t detectMotion(const Mat &motion, int max_deviation, int triggerCount) {
 
-  int rows = motion.rows;
-  int cols = motion.cols;
-  
-  int min_x = motion.cols, max_x = 0;
-  int min_y = motion.rows, max_y = 0;
-  
-  // calculate the standard deviation
+  CV_Assert(motion.type() == CV_8UC1);
+
+  int rowsPerStripe = (motion.rows + DETECT_STRIPES - 1) / DETECT_STRIPES;
+  int min_x = motion.cols, max_x = -1;
+  int min_y = motion.rows, max_y = -1;
+  int changes = 0;
+
   MotionDetectData_t data;
-  data.mean = 0;
-  data.stddev = 0;
   data.numberOfChanges = 0;
   data.isMotion = false;
-  
-  meanStdDev(motion, data.mean, data.stddev);
+  data.changedBounds = Rect();
+
+  parallel_for_(Range(0, DETECT_STRIPES), MotionStripeReducer(motion, rowsPerStripe));
+
+  for (int s = 0; s < DETECT_STRIPES; s++) {
+    changes += motionStripes[s].changes;
+    min_x = std::min(min_x, motionStripes[s].min_x);
+    max_x = std::max(max_x, motionStripes[s].max_x);
+    min_y = std::min(min_y, motionStripes[s].min_y);
+    max_y = std::max(max_y, motionStripes[s].max_y);
+  }
+
+  // population mean and standard deviation of a 0/255 image with p changed
+  double p = (double)changes / (double)(motion.rows * motion.cols);
+  data.mean = Scalar(255.0 * p);
+  data.stddev = Scalar(255.0 * sqrt(p * (1.0 - p)));
+
   // if not to much changes then the motion is real
   if (data.stddev[0] < max_deviation) {
-    // loop over image and detect changes
-    for (int j = 0; j < rows; j+=1) { // height
-      for (int i = 0; i < cols; i+=1) { // width
-        // check if at pixel (j,i) intensity is equal to 255 this means that the pixel is different in the sequence of images (prev_frame, current_frame, next_frame)
-        if ((motion.at<int>(j,i)) == 255) data.numberOfChanges++;        
+    data.numberOfChanges = changes;
+    if (changes > 0)
+      data.changedBounds = Rect(min_x, min_y, max_x - min_x + 1, max_y - min_y + 1);
+  }
+  data.isMotion = (data.numberOfChanges >= triggerCount);
+  return data;
+}
+
+
+#ifdef CHECK_DETECT
+// The original two-pass version, kept to check detectMotion() against
+inline MotionDetectData_t detectMotionReference(const Mat &motion, int max_deviation, int triggerCount) {
+
+  MotionDetectData_t data;
+  data.numberOfChanges = 0;
+  data.isMotion = false;
+
+  meanStdDev(motion, data.mean, data.stddev);
+  if (data.stddev[0] < max_deviation) {
+    for (int j = 0; j < motion.rows; j+=1) {
+      for (int i = 0; i < motion.cols; i+=1) {
+        if ((motion.at<uchar>(j,i)) == 255) data.numberOfChanges++;
       }
     }
   }
   data.isMotion = (data.numberOfChanges >= triggerCount);
   return data;
 }
+#endif
 
 
 int main (int argc, char * const argv[]) 
@@ -127,20 +345,45 @@ int main (int argc, char * const argv[])
   stringstream drawnStringStream;
   Point textOrg(10, 10);
   
-  // Bounding rectangle and contours to visually track target
+  // Bounding rectangle and connected component outputs to visually track target
   Rect boundingR;
-  vector<vector<Point> > contours;
-  
+  Mat labels, stats, centroids;
+  int numberOfBlobs;
+
+  // blob boxes feed one constant-velocity filter per moving object
+  mtk_tracker_t tracker;
+  mtk_box_t blobBoxes[MAX_TARGETS];
+  int numberOfBoxes;
+  double trackSumMsec = 0.0, trackMaxMsec = 0.0;
+  unsigned long trackTargets = 0;
+
+  // Gray history ring: each new frame is converted straight into the oldest
+  // slot and only the indices rotate, so no frame is ever copied to age it
+  Mat grayRing[HISTORY_SLOTS];
+  int currentIdx, prevIdx, prevPrevIdx;
+
   // d1 and d2 for calculating the differences
   // result, the result of and operation, calculated on d1 and d2
   // number_of_changes, the amount of changes in the result matrix.
   // color, the color for drawing the rectangle when something has changed.
-  Mat prevPrevFrame, prevFrame, currentFrame, result_saved, resultTracked, display, roi;  
-  Mat d1, d2, motion;
+  Mat result_saved, display, maskView, trackedView;
+  Mat d1, d2, anded, motion;
   MotionDetectData_t motionDetectData;
   int numberOfSequence = 0;
   unsigned int frameCnt = 0;
 
+  // detectMotion() cost per frame, reported every REPORT_FRAMES
+  int64 detectTicks;
+  double detectMsec = 0.0, detectSumMsec = 0.0, detectMaxMsec = 0.0;
+
+  // Saver thread for motion and reference frames
+  sem_init(&saveSlotsFree, 0, SAVE_QUEUE_SLOTS);
+  sem_init(&saveSlotsFilled, 0, 0);
+  if (pthread_create(&saverThread, NULL, saverService, NULL) != 0) {
+    perror("pthread_create saver");
+    exit(EXIT_FAILURE);
+  }
+
   // Erode kernel
   Mat kernel_ero = getStructuringElement(MORPH_RECT, Size(2, 2));
   
@@ -158,81 +401,155 @@ int main (int argc, char * const argv[])
   camera.set(CAP_PROP_FRAME_WIDTH, 640);
   camera.set(CAP_PROP_FRAME_HEIGHT, 480);
 
-  // Take image, initialize mats, and convert them to gray
+  // Take image, allocate every per-frame buffer once, and convert to gray
   camera >> result_saved;
-  prevPrevFrame = Mat::zeros(result_saved.size(), result_saved.type());
-  prevFrame = Mat::zeros(result_saved.size(), result_saved.type());
-  currentFrame = Mat::zeros(result_saved.size(), result_saved.type());
 #ifdef SHOW_DIFF
   display = Mat::zeros(Size(result_saved.cols * 2, result_saved.rows * 2), result_saved.type());
+  maskView = display(Rect(result_saved.cols * 0, result_saved.rows * 1, result_saved.cols, result_saved.rows));
+  trackedView = display(Rect(result_saved.cols * 1, result_saved.rows * 1, result_saved.cols, result_saved.rows));
 #else
   display = Mat::zeros(Size(result_saved.cols * 2, result_saved.rows * 1), result_saved.type());
+  maskView = display(Rect(result_saved.cols * 0, result_saved.rows * 0, result_saved.cols, result_saved.rows));
+  trackedView = display(Rect(result_saved.cols * 1, result_saved.rows * 0, result_saved.cols, result_saved.rows));
 #endif
+
+  d1.create(result_saved.size(), CV_8UC1);
+  d2.create(result_saved.size(), CV_8UC1);
+  anded.create(result_saved.size(), CV_8UC1);
+  motion.create(result_saved.size(), CV_8UC1);
+  labels.create(result_saved.size(), CV_32SC1);
+
+  if (mtk_init(&tracker, MAX_TARGETS, 1.0f, 4.0f) < 0) {
+    cout << "Failed to allocate the tracker" << endl;
+    exit(EXIT_FAILURE);
+  }
+
+  // start with prevPrev black and prev and current both the first frame
+  prevPrevIdx = 0; prevIdx = 1; currentIdx = 2;
+  grayRing[prevPrevIdx] = Mat::zeros(result_saved.size(), CV_8UC1);
+  grayRing[prevIdx].create(result_saved.size(), CV_8UC1);
+  grayRing[currentIdx].create(result_saved.size(), CV_8UC1);
+  cvtColor(result_saved, grayRing[prevIdx], COLOR_RGB2GRAY);
+  cvtColor(result_saved, grayRing[currentIdx], COLOR_RGB2GRAY);
   
-  result_saved.copyTo(prevFrame);
-  result_saved.copyTo(currentFrame);
-  
-  cvtColor(prevFrame, prevFrame, COLOR_RGB2GRAY);
-  cvtColor(currentFrame, currentFrame, COLOR_RGB2GRAY);
-  
-  cout << "Image Capture Resolution: " << currentFrame.cols << "x" << currentFrame.rows << endl;
+  cout << "Image Capture Resolution: " << result_saved.cols << "x" << result_saved.rows << endl;
 
   // Setup display window	
   namedWindow(WINDOW_NAME, WINDOW_AUTOSIZE | WINDOW_GUI_NORMAL); 
   createTrackbar("Threshold:", WINDOW_NAME, &currentThreshold, MAX_THRESHOLD, NULL);
   createTrackbar("Max Deviation:", WINDOW_NAME, &currentDeviation, MAX_DEVIATION, NULL);
-  createTrackbar("Pixels Changed:", WINDOW_NAME, &currentMotionTrigger, currentFrame.cols * currentFrame.rows, NULL);	
+  createTrackbar("Pixels Changed:", WINDOW_NAME, &currentMotionTrigger, result_saved.cols * result_saved.rows, NULL);	
   
   waitKey (DELAY_IN_MSEC);
 
   // All settings have been set, now go in endless frame acquisition loop
   while (running)
   {
-    // Take a new image
+    // Take a new image, decoded into the same buffer every frame
     camera >> result_saved;
-    prevFrame.copyTo(prevPrevFrame);
-    currentFrame.copyTo(prevFrame);
-    result_saved.copyTo(currentFrame);
+
+    // Age the history by rotating indices, the oldest slot takes the new frame
+    prevPrevIdx = prevIdx;
+    prevIdx = currentIdx;
+    currentIdx = (currentIdx + 1) % HISTORY_SLOTS;
     
-    cvtColor(currentFrame, currentFrame, COLOR_RGB2GRAY);
+    cvtColor(result_saved, grayRing[currentIdx], COLOR_RGB2GRAY);
     
     // Calc differences between the images and do AND-operation threshold image
-    absdiff(prevPrevFrame, currentFrame, d1);
-    absdiff(prevFrame, currentFrame, d2);
-    bitwise_and(d1, d2, motion);
-    threshold(motion, motion, currentThreshold, 255, THRESH_BINARY);
-    erode(motion, motion, kernel_ero);
+    // every destination is preallocated at the right size, so none of these reallocate
+    absdiff(grayRing[prevPrevIdx], grayRing[currentIdx], d1);
+    absdiff(grayRing[prevIdx], grayRing[currentIdx], d2);
+    bitwise_and(d1, d2, anded);
+    threshold(anded, anded, currentThreshold, 255, THRESH_BINARY);
+    erode(anded, motion, kernel_ero);
     
+    detectTicks = getTickCount();
     motionDetectData = detectMotion(motion(Rect(CAM_WIDTH_OFFSET, 0, 640-(CAM_WIDTH_OFFSET * 2), 480)), currentDeviation, currentMotionTrigger);
+    detectMsec = (double)(getTickCount() - detectTicks) * 1000.0 / getTickFrequency();
+
+    detectSumMsec += detectMsec;
+    if (detectMsec > detectMaxMsec) detectMaxMsec = detectMsec;
+    if ((frameCnt % REPORT_FRAMES) == (REPORT_FRAMES - 1)) {
+      cout << "detectMotion: ave " << detectSumMsec / REPORT_FRAMES << " msec, max "
+           << detectMaxMsec << " msec over " << REPORT_FRAMES << " frames" << endl;
+      cout << "saves: queued " << savesQueued << ", written " << savesWritten
+           << ", failed " << savesFailed << ", dropped " << savesDropped << endl;
+      detectSumMsec = 0.0;
+      detectMaxMsec = 0.0;
+    }
+
+#ifdef CHECK_DETECT
+    {
+      detectTicks = getTickCount();
+      MotionDetectData_t reference = detectMotionReference(motion(Rect(CAM_WIDTH_OFFSET, 0, 640-(CAM_WIDTH_OFFSET * 2), 480)), currentDeviation, currentMotionTrigger);
+      double referenceMsec = (double)(getTickCount() - detectTicks) * 1000.0 / getTickFrequency();
+
+      if (reference.numberOfChanges != motionDetectData.numberOfChanges ||
+          fabs(reference.stddev[0] - motionDetectData.stddev[0]) > 1e-6)
+        cout << "MISMATCH frame " << frameCnt << ": changes " << motionDetectData.numberOfChanges
+             << " vs " << reference.numberOfChanges << ", stddev " << motionDetectData.stddev[0]
+             << " vs " << reference.stddev[0] << endl;
+
+      cout << "frame " << frameCnt << ": fused " << detectMsec << " msec, reference "
+           << referenceMsec << " msec" << endl;
+    }
+#endif
 
     /* 
-    * I think it's self-descriptive. We pick 4 different ROIs and copy
-    * the frames we need into them. Piece of cake!
+    * I think it's self-descriptive. We pick 4 different ROIs and write
+    * the frames we need straight into them. Piece of cake!
+    *
+    * Every ROI is fully overwritten each frame, so the display is never cleared,
+    * and the tracked view is drawn in place rather than in a separate copy.
     */
-    display = Scalar(0, 0, 0);
-    
-    result_saved.copyTo(resultTracked);
+#ifdef SHOW_DIFF
+    cvtColor(d1, display(Rect(result_saved.cols * 0, result_saved.rows * 0, result_saved.cols, result_saved.rows)), COLOR_GRAY2RGB);
+    cvtColor(d2, display(Rect(result_saved.cols * 1, result_saved.rows * 0, result_saved.cols, result_saved.rows)), COLOR_GRAY2RGB);
+#endif
+    cvtColor(motion, maskView, COLOR_GRAY2RGB);
+    result_saved.copyTo(trackedView);
+
+    numberOfBoxes = 0;
     if (motionDetectData.isMotion) {
-      findContours(motion, contours, RETR_EXTERNAL, CHAIN_APPROX_SIMPLE, Point(0, 0));
-      for( int i = 0; i < contours.size(); i++ ) {
-         boundingR = boundingRect(contours[i]);
-         rectangle(resultTracked, boundingR.tl(), boundingR.br(), Scalar(0, 255, 0), 2, LINE_AA , 0);
+      // labels is preallocated, stats holds one small row per blob
+      numberOfBlobs = connectedComponentsWithStats(motion, labels, stats, centroids, 8, CV_32S);
+      for( int i = 1; i < numberOfBlobs; i++ ) { // label 0 is the background
+         boundingR = Rect(stats.at<int>(i, CC_STAT_LEFT), stats.at<int>(i, CC_STAT_TOP),
+                          stats.at<int>(i, CC_STAT_WIDTH), stats.at<int>(i, CC_STAT_HEIGHT));
+         rectangle(trackedView, boundingR.tl(), boundingR.br(), Scalar(0, 255, 0), 2, LINE_AA , 0);
+
+         if (stats.at<int>(i, CC_STAT_AREA) >= MIN_BLOB_AREA && numberOfBoxes < MAX_TARGETS) {
+           mtk_box_t &box = blobBoxes[numberOfBoxes++];
+           box.x = boundingR.x; box.y = boundingR.y;
+           box.w = boundingR.width; box.h = boundingR.height;
+         }
        }
     }
-    
-#ifdef SHOW_DIFF
-    cvtColor(d1, d1, COLOR_GRAY2RGB);
-    d1.copyTo(display(Rect(result_saved.cols * 0, result_saved.rows * 0, result_saved.cols, result_saved.rows)));
-    cvtColor(d2, d2, COLOR_GRAY2RGB);
-    d2.copyTo(display(Rect(result_saved.cols * 1, result_saved.rows * 0, result_saved.cols, result_saved.rows)));
-    cvtColor(motion, motion, COLOR_GRAY2RGB);
-    motion.copyTo(display(Rect(result_saved.cols * 0, result_saved.rows * 1, result_saved.cols, result_saved.rows)));
-    resultTracked.copyTo(display(Rect(result_saved.cols * 1, result_saved.rows * 1, result_saved.cols, result_saved.rows)));
-#else
-    cvtColor(motion, motion, COLOR_GRAY2RGB);
-    motion.copyTo(display(Rect(result_saved.cols * 0, result_saved.rows * 0, result_saved.cols, result_saved.rows)));
-    resultTracked.copyTo(display(Rect(result_saved.cols * 1, result_saved.rows * 0, result_saved.cols, result_saved.rows)));
-#endif
+
+    // every frame, so targets coast through frames without motion
+    mtk_step(&tracker, blobBoxes, numberOfBoxes, 1.0f);
+    {
+      double trackMsec = tracker.predict_msec + tracker.associate_msec + tracker.update_msec;
+      trackSumMsec += trackMsec;
+      if (trackMsec > trackMaxMsec) trackMaxMsec = trackMsec;
+      trackTargets += tracker.count;
+    }
+    if ((frameCnt % REPORT_FRAMES) == (REPORT_FRAMES - 1)) {
+      cout << "tracker: ave " << trackSumMsec / REPORT_FRAMES << " msec, max " << trackMaxMsec
+           << " msec, ave " << (double)trackTargets / REPORT_FRAMES << " targets" << endl;
+      trackSumMsec = 0.0;
+      trackMaxMsec = 0.0;
+      trackTargets = 0;
+    }
+
+    for (int i = 0; i < tracker.count; i++) {
+      if (!mtk_confirmed(&tracker, i)) continue;
+      mtk_box_t box = mtk_target_box(&tracker, i);
+      Rect targetR(cvRound(box.x), cvRound(box.y), cvRound(box.w), cvRound(box.h));
+      rectangle(trackedView, targetR.tl(), targetR.br(), Scalar(0, 255, 255), 1, LINE_AA, 0);
+      putText(trackedView, to_string(tracker.id[i]), targetR.tl() + Point(2, 12),
+              FONT_HERSHEY_PLAIN, 1, Scalar(0, 255, 255), 1, LINE_AA);
+    }
 
     drawnStringStream.str("");
     drawnStringStream << "Mean: " << motionDetectData.mean[0];
@@ -252,11 +569,16 @@ int main (int argc, char * const argv[])
     textOrg.y = 80;
     putText(display, drawnStringStream.str(), textOrg, FONT_HERSHEY_COMPLEX_SMALL, 1, Scalar::all(255), 2, 8);
 
+    drawnStringStream.str("");
+    drawnStringStream << "Detect: " << detectMsec << " msec";
+    textOrg.x = 10;
+    textOrg.y = 110;
+    putText(display, drawnStringStream.str(), textOrg, FONT_HERSHEY_COMPLEX_SMALL, 1, Scalar::all(255), 2, 8);
+
     // save detected frames
     if (motionDetectData.isMotion) 
     {
-      //if (numberOfSequence > 0) saveImg(result_saved, DIRECTORY, EXTENSION, FILE_FORMAT, numberOfSequence, 1);
-      saveImg(result_saved, DIRECTORY_DETECT, EXTENSION, FILE_FORMAT, frameCnt, 1);
+      queueSaveImg(result_saved, DIRECTORY_DETECT, frameCnt, 1);
       numberOfSequence++;
     } 
     else
@@ -267,15 +589,26 @@ int main (int argc, char * const argv[])
     // save every nth frame to compare detected frames to
     if((frameCnt % 10) ==  0)
     {
-      saveImg(result_saved, DIRECTORY_COLLECT, EXTENSION, FILE_FORMAT, frameCnt, 0);
+      queueSaveImg(result_saved, DIRECTORY_COLLECT, frameCnt, 0);
     }
     
     imshow(WINDOW_NAME, display);
     frameCnt++;
-    waitKey (DELAY_IN_MSEC);
+    if (waitKey (DELAY_IN_MSEC) == ESCAPE_KEY)
+      running = false;
   }
   
   camera.release();
+
+  // let the saver finish what is already queued
+  saverStop = true;
+  sem_post(&saveSlotsFilled);
+  pthread_join(saverThread, NULL);
+
+  cout << "saves: queued " << savesQueued << ", written " << savesWritten
+       << ", failed " << savesFailed << ", dropped " << savesDropped << endl;
+
+  mtk_free(&tracker);
   
   return 0;
 }
@@ -0,0 +1,342 @@
+#include <iostream>
+#include <stdio.h>
+#include <time.h>
+#include <algorithm>
+#include <opencv2/core.hpp>
+#include <opencv2/highgui.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/videoio.hpp>
+#include <opencv2/video.hpp>
+using namespace cv;
+using namespace std;
+
+// Adaptive dense optical flow
+//
+// denseoptflow.cpp always runs Farneback on the full frame with fixed
+// parameters (0.5, 3, 15, 3, 5, 1.2).  Here flow is computed on a pyrDown
+// level of the frame, optionally only inside motion ROIs found by cheap
+// frame differencing, and a controller walks a ladder of (level, iterations)
+// settings to hold the flow time per frame under a latency budget.
+//
+// Modes:
+//   full    - fixed full resolution, original parameters, for comparison
+//   pyramid - whole frame at the level chosen by the controller
+//   roi     - only the padded bounding boxes of changed regions, at the
+//             level chosen by the controller, zero flow elsewhere
+//
+// Flow is scaled back up to the capture size for display, so the
+// visualization matches denseoptflow.cpp regardless of level.
+
+#define MAX_LEVEL (3)
+#define MAX_ROIS (8)
+
+// difference threshold and dilation for the ROI mask, on the coarsest level
+#define ROI_DIFF_THRESHOLD (12)
+#define ROI_DILATE (3)
+
+// Above this fraction of the frame in ROIs, one full-frame call is cheaper
+#define ROI_MAX_FRACTION (0.5)
+
+// controller: smoothing of measured flow time, hysteresis, and frames to hold
+// after each change so the average settles before the next decision
+#define EWMA_ALPHA (0.2)
+#define BUDGET_HIGH (1.0)
+#define BUDGET_LOW (0.6)
+#define HOLD_FRAMES (10)
+
+enum { MODE_FULL, MODE_PYRAMID, MODE_ROI };
+
+// Cheapest last; each rung roughly 1.5-4x cheaper than the one before
+static const struct
+{
+    int level;
+    int iterations;
+} ladder[] =
+{
+    { 0, 3 }, { 0, 2 }, { 1, 3 }, { 1, 2 }, { 2, 3 }, { 2, 2 }, { 3, 2 }, { 3, 1 }
+};
+
+#define LADDER_RUNGS ((int)(sizeof(ladder)/sizeof(ladder[0])))
+
+
+static double now_msec(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return ((double)t.tv_sec * 1000.0) + ((double)t.tv_nsec / 1000000.0);
+}
+
+
+// Build the gray pyramid in place, levels[0] is full resolution
+static void build_levels(const Mat &gray, Mat levels[MAX_LEVEL+1])
+{
+    gray.copyTo(levels[0]);
+    for (int l = 1; l <= MAX_LEVEL; l++)
+        pyrDown(levels[l-1], levels[l]);
+}
+
+
+// Changed regions between two coarse frames, returned in level coordinates
+static int find_motion_rois(const Mat &prevCoarse, const Mat &nextCoarse, int coarseToLevel,
+                            Size levelSize, int pad, Mat &diff, Mat &labels, Mat &stats,
+                            Mat &centroids, Rect rois[MAX_ROIS])
+{
+    int n, count = 0;
+    Rect frameRect(0, 0, levelSize.width, levelSize.height);
+
+    absdiff(prevCoarse, nextCoarse, diff);
+    threshold(diff, diff, ROI_DIFF_THRESHOLD, 255, THRESH_BINARY);
+    dilate(diff, diff, getStructuringElement(MORPH_RECT, Size(ROI_DILATE, ROI_DILATE)));
+
+    n = connectedComponentsWithStats(diff, labels, stats, centroids, 8, CV_32S);
+
+    // label 0 is background, keep the largest MAX_ROIS blobs
+    vector<pair<int,int> > byArea;
+    for (int i = 1; i < n; i++)
+        byArea.push_back(make_pair(stats.at<int>(i, CC_STAT_AREA), i));
+    sort(byArea.rbegin(), byArea.rend());
+
+    for (size_t k = 0; k < byArea.size() && count < MAX_ROIS; k++)
+    {
+        int i = byArea[k].second;
+        Rect r(stats.at<int>(i, CC_STAT_LEFT) * coarseToLevel - pad,
+               stats.at<int>(i, CC_STAT_TOP) * coarseToLevel - pad,
+               stats.at<int>(i, CC_STAT_WIDTH) * coarseToLevel + 2*pad,
+               stats.at<int>(i, CC_STAT_HEIGHT) * coarseToLevel + 2*pad);
+        rois[count++] = r & frameRect;
+    }
+
+    // overlapping boxes would compute the same flow twice, merge them
+    for (int i = 0; i < count; i++)
+    {
+        for (int j = i + 1; j < count; j++)
+        {
+            if ((rois[i] & rois[j]).area() > 0)
+            {
+                rois[i] = rois[i] | rois[j];
+                rois[j--] = rois[--count];
+                i = -1;
+                break;
+            }
+        }
+    }
+
+    return count;
+}
+
+
+static const string keys =
+    "{ help h     |      | print this help message }"
+    "{ @video     | slow_traffic_small.mp4 | input video file or camera index }"
+    "{ mode m     | pyramid | full, pyramid or roi }"
+    "{ budget b   | 20   | target flow time per frame in msec }"
+    "{ nodisplay n |     | run without imshow, print statistics only }";
+
+int main(int argc, char **argv)
+{
+    CommandLineParser parser(argc, argv, keys);
+    parser.about("Adaptive resolution and ROI dense optical flow.");
+
+    if (parser.has("help"))
+    {
+        parser.printMessage();
+        return 0;
+    }
+
+    string input = parser.get<string>("@video");
+    string modeName = parser.get<string>("mode");
+    double budget = parser.get<double>("budget");
+    bool display = !parser.has("nodisplay");
+
+    if (!parser.check())
+    {
+        parser.printErrors();
+        return 0;
+    }
+
+    int mode = modeName == "full" ? MODE_FULL : (modeName == "roi" ? MODE_ROI : MODE_PYRAMID);
+
+    VideoCapture capture;
+    if (input.size() == 1 && isdigit(input[0]))
+        capture.open(input[0] - '0');
+    else
+        capture.open(samples::findFile(input));
+
+    if (!capture.isOpened()){
+        //error in opening the video input
+        cerr << "Unable to open file!" << endl;
+        return 0;
+    }
+
+    Mat frame, gray;
+    Mat prevLevels[MAX_LEVEL+1], nextLevels[MAX_LEVEL+1];
+    Mat flow, flowFull, diff, labels, stats, centroids;
+    Mat flow_parts[2], magnitude, angle, magn_norm, _hsv[3], hsv, hsv8, bgr;
+    Rect rois[MAX_ROIS];
+    int numRois = 0;
+
+    int rung = 0, hold = 0, level, iterations;
+    double flowEwma = 0.0, flowTime, frameStart, frameTime;
+    double sumFrame = 0.0, sumFlow = 0.0;
+    unsigned int frames = 0, overBudget = 0;
+    vector<double> frameTimes;
+
+    capture >> frame;
+    if (frame.empty())
+    {
+        cerr << "No frames in input!" << endl;
+        return 0;
+    }
+
+    cvtColor(frame, gray, COLOR_BGR2GRAY);
+    build_levels(gray, prevLevels);
+    _hsv[1] = Mat::ones(frame.size(), CV_32F);
+
+    printf("mode %s, budget %.1lf msec, %dx%d\n", modeName.c_str(), budget, frame.cols, frame.rows);
+
+    while(true)
+    {
+        capture >> frame;
+        if (frame.empty())
+            break;
+
+        frameStart = now_msec();
+
+        cvtColor(frame, gray, COLOR_BGR2GRAY);
+        build_levels(gray, nextLevels);
+
+        if (mode == MODE_FULL)
+        {
+            level = 0;
+            iterations = 3;
+        }
+        else
+        {
+            level = ladder[rung].level;
+            iterations = ladder[rung].iterations;
+        }
+
+        Mat &prev = prevLevels[level];
+        Mat &next = nextLevels[level];
+
+        flowTime = now_msec();
+
+        if (mode == MODE_ROI)
+        {
+            // pad by the Farneback window plus pyramid reach so ROI borders see real data
+            int pad = 15 + (1 << 3);
+            flow.create(next.size(), CV_32FC2);
+            flow = Scalar::all(0);
+
+            numRois = find_motion_rois(prevLevels[MAX_LEVEL], nextLevels[MAX_LEVEL], 1 << (MAX_LEVEL - level),
+                                       next.size(), pad, diff, labels, stats, centroids, rois);
+
+            int roiArea = 0;
+            for (int i = 0; i < numRois; i++)
+                roiArea += rois[i].area();
+
+            if (roiArea > ROI_MAX_FRACTION * next.total())
+            {
+                calcOpticalFlowFarneback(prev, next, flow, 0.5, 3, 15, iterations, 5, 1.2, 0);
+                numRois = -1;
+            }
+            else
+            {
+                for (int i = 0; i < numRois; i++)
+                {
+                    Mat roiFlow = flow(rois[i]);
+                    calcOpticalFlowFarneback(prev(rois[i]), next(rois[i]), roiFlow, 0.5, 3, 15, iterations, 5, 1.2, 0);
+                }
+            }
+        }
+        else
+        {
+            calcOpticalFlowFarneback(prev, next, flow, 0.5, 3, 15, iterations, 5, 1.2, 0);
+        }
+
+        flowTime = now_msec() - flowTime;
+
+        // controller, only moves after the average settles from the last change
+        flowEwma = (frames == 0) ? flowTime : (EWMA_ALPHA * flowTime) + ((1.0 - EWMA_ALPHA) * flowEwma);
+
+        if (mode != MODE_FULL && hold-- <= 0)
+        {
+            if (flowEwma > budget * BUDGET_HIGH && rung < LADDER_RUNGS - 1)
+            {
+                rung++;
+                hold = HOLD_FRAMES;
+                printf("over budget (%.2lf msec), now level %d, %d iterations\n", flowEwma, ladder[rung].level, ladder[rung].iterations);
+            }
+            else if (flowEwma < budget * BUDGET_LOW && rung > 0)
+            {
+                rung--;
+                hold = HOLD_FRAMES;
+                printf("under budget (%.2lf msec), now level %d, %d iterations\n", flowEwma, ladder[rung].level, ladder[rung].iterations);
+            }
+        }
+
+        for (int l = 0; l <= MAX_LEVEL; l++)
+            swap(prevLevels[l], nextLevels[l]);
+
+        frameTime = now_msec() - frameStart;
+        frameTimes.push_back(frameTime);
+        sumFrame += frameTime;
+        sumFlow += flowTime;
+        if (flowTime > budget) overBudget++;
+        frames++;
+
+        if (!display)
+        {
+            printf("frame %u: level %d, iter %d, rois %d, flow %.2lf msec, frame %.2lf msec\n",
+                   frames, level, iterations, mode == MODE_ROI ? numRois : 0, flowTime, frameTime);
+            continue;
+        }
+
+        // back to capture size, displacements scale with the level too
+        resize(flow, flowFull, frame.size(), 0, 0, INTER_LINEAR);
+        if (level > 0)
+            flowFull *= (double)(1 << level);
+
+        // visualization
+        split(flowFull, flow_parts);
+        cartToPolar(flow_parts[0], flow_parts[1], magnitude, angle, true);
+        normalize(magnitude, magn_norm, 0.0f, 1.0f, NORM_MINMAX);
+        angle *= ((1.f / 360.f) * (180.f / 255.f));
+
+        //build hsv image
+        _hsv[0] = angle;
+        _hsv[2] = magn_norm;
+        merge(_hsv, 3, hsv);
+        hsv.convertTo(hsv8, CV_8U, 255.0);
+        cvtColor(hsv8, bgr, COLOR_HSV2BGR);
+
+        if (mode == MODE_ROI && numRois > 0)
+            for (int i = 0; i < numRois; i++)
+                rectangle(bgr, Rect(rois[i].x << level, rois[i].y << level,
+                                    rois[i].width << level, rois[i].height << level), Scalar(255,255,255), 1);
+
+        char text[80];
+        snprintf(text, sizeof(text), "L%d it%d flow %.1f ms", level, iterations, flowTime);
+        putText(bgr, text, Point(10, 20), FONT_HERSHEY_PLAIN, 1.2, Scalar(255,255,255), 1, LINE_AA);
+
+        imshow("adaptive flow", bgr);
+
+        int keyboard = waitKey(1);
+
+        if (keyboard == 'q' || keyboard == 27)
+            break;
+    }
+
+    if (frames > 0)
+    {
+        sort(frameTimes.begin(), frameTimes.end());
+        printf("%u frames, flow ave %.2lf msec, frame ave %.2lf msec, p95 %.2lf msec, max %.2lf msec\n",
+               frames, sumFlow / frames, sumFrame / frames,
+               frameTimes[(frames * 95) / 100], frameTimes[frames - 1]);
+        printf("flow over %.1lf msec budget on %u frames (%.1lf%%)\n",
+               budget, overBudget, 100.0 * overBudget / frames);
+    }
+
+    return 0;
+}
@@ -1,4 +1,8 @@
 #include <iostream>
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
 #include <opencv2/core.hpp>
 #include <opencv2/highgui.hpp>
 #include <opencv2/imgproc.hpp>
@@ -6,9 +10,146 @@
 #include <opencv2/video.hpp>
 using namespace cv;
 using namespace std;
+
+// Dense optical flow as a three stage pipeline
+//
+//   decode thread: capture >> frame, cvtColor to gray    -> gray ring
+//   flow thread:   calcOpticalFlowFarneback(prev, next)  -> flow ring
+//   main thread:   split/cartToPolar/normalize/HSV, imshow
+//
+// Each ring is a fixed set of Mats allocated once from the first frame, with
+// a pair of counting semaphores for free and filled slots.  As long as the
+// rings have slack, the flow stage never waits on decode or display, so on a
+// multi-core board throughput approaches the rate of the flow stage alone.
+
+#define GRAY_SLOTS (4) // flow thread always holds one as its previous frame
+#define FLOW_SLOTS (3)
+
+// waitKey delay; the original 30 msec would make the display the bottleneck
+#define RENDER_DELAY_MSEC (1)
+
+typedef struct
+{
+    Mat gray;
+    bool eos;
+} GraySlot_t;
+
+typedef struct
+{
+    Mat flow;
+    bool eos;
+} FlowSlot_t;
+
+static GraySlot_t graySlot[GRAY_SLOTS];
+static FlowSlot_t flowSlot[FLOW_SLOTS];
+static int grayHead = 0, grayTail = 0, flowHead = 0, flowTail = 0;
+static sem_t grayFree, grayFilled, flowFree, flowFilled;
+
+static VideoCapture capture;
+static volatile bool abortPipeline = false;
+
+// busy time per stage and time the flow stage spent starved or blocked
+static double decodeMsec = 0.0, flowMsec = 0.0, renderMsec = 0.0, flowWaitMsec = 0.0;
+static unsigned int decodeCnt = 0, flowCnt = 0, renderCnt = 0;
+
+
+static double now_msec(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return ((double)t.tv_sec * 1000.0) + ((double)t.tv_nsec / 1000000.0);
+}
+
+
+void *decodeService(void *threadp)
+{
+    Mat frame;
+    double start;
+
+    while (!abortPipeline)
+    {
+        sem_wait(&grayFree);
+        if (abortPipeline) break;
+
+        GraySlot_t &slot = graySlot[grayTail];
+
+        start = now_msec();
+        capture >> frame;
+        slot.eos = frame.empty();
+        if (!slot.eos)
+            cvtColor(frame, slot.gray, COLOR_BGR2GRAY);
+        decodeMsec += now_msec() - start;
+        decodeCnt++;
+
+        grayTail = (grayTail + 1) % GRAY_SLOTS;
+        sem_post(&grayFilled);
+
+        if (slot.eos) break;
+    }
+
+    return NULL;
+}
+
+
+void *flowService(void *threadp)
+{
+    int prev = -1, next;
+    double start;
+
+    while (1)
+    {
+        start = now_msec();
+        sem_wait(&grayFilled);
+        flowWaitMsec += now_msec() - start;
+        if (abortPipeline) break;
+
+        next = grayHead;
+        grayHead = (grayHead + 1) % GRAY_SLOTS;
+
+        if (graySlot[next].eos)
+        {
+            sem_wait(&flowFree);
+            flowSlot[flowTail].eos = true;
+            flowTail = (flowTail + 1) % FLOW_SLOTS;
+            sem_post(&flowFilled);
+            break;
+        }
+
+        if (prev >= 0)
+        {
+            start = now_msec();
+            sem_wait(&flowFree);
+            flowWaitMsec += now_msec() - start;
+            if (abortPipeline) break;
+
+            start = now_msec();
+            calcOpticalFlowFarneback(graySlot[prev].gray, graySlot[next].gray, flowSlot[flowTail].flow,
+                                     0.5, 3, 15, 3, 5, 1.2, 0);
+            flowMsec += now_msec() - start;
+            flowCnt++;
+
+            flowSlot[flowTail].eos = false;
+            flowTail = (flowTail + 1) % FLOW_SLOTS;
+            sem_post(&flowFilled);
+
+            // the previous frame is no longer needed, hand its slot back to decode
+            sem_post(&grayFree);
+        }
+
+        prev = next;
+    }
+
+    return NULL;
+}
+
+
 int main(int argc, char *argv[])
 {
     char inputvideo[80]="slow_traffic_small.mp4";
+    pthread_t decodeThread, flowThread;
+    double start, pipelineStart, elapsed;
+    int i;
 
     if(argc == 2)
     {
@@ -20,7 +161,7 @@ int main(int argc, char *argv[])
         printf("Using default input file %s\n", inputvideo);
     }
 
-    VideoCapture capture(samples::findFile(inputvideo));
+    capture.open(samples::findFile(inputvideo));
 
     if (!capture.isOpened()){
         //error in opening the video input
@@ -28,48 +169,106 @@ int main(int argc, char *argv[])
         return 0;
     }
 
-    Mat frame1, prvs;
+    Mat frame1;
 
     capture >> frame1;
 
-    cvtColor(frame1, prvs, COLOR_BGR2GRAY);
+    if (frame1.empty())
+    {
+        cerr << "No frames in input!" << endl;
+        return 0;
+    }
+
+    // allocate every pipeline and visualization buffer once, from the first frame
+    for (i = 0; i < GRAY_SLOTS; i++)
+        graySlot[i].gray.create(frame1.size(), CV_8UC1);
+    for (i = 0; i < FLOW_SLOTS; i++)
+        flowSlot[i].flow.create(frame1.size(), CV_32FC2);
+
+    Mat flow_parts[2], magnitude, angle, magn_norm;
+    Mat _hsv[3], hsv, hsv8, bgr;
+    flow_parts[0].create(frame1.size(), CV_32F);
+    flow_parts[1].create(frame1.size(), CV_32F);
+    magnitude.create(frame1.size(), CV_32F);
+    angle.create(frame1.size(), CV_32F);
+    magn_norm.create(frame1.size(), CV_32F);
+    hsv.create(frame1.size(), CV_32FC3);
+    hsv8.create(frame1.size(), CV_8UC3);
+    bgr.create(frame1.size(), CV_8UC3);
+    _hsv[1] = Mat::ones(frame1.size(), CV_32F);
+
+    // first frame goes straight into the ring as the flow thread's first "previous"
+    cvtColor(frame1, graySlot[0].gray, COLOR_BGR2GRAY);
+    graySlot[0].eos = false;
+    grayTail = 1;
+
+    sem_init(&grayFree, 0, GRAY_SLOTS - 1);
+    sem_init(&grayFilled, 0, 1);
+    sem_init(&flowFree, 0, FLOW_SLOTS);
+    sem_init(&flowFilled, 0, 0);
+
+    pipelineStart = now_msec();
+
+    pthread_create(&decodeThread, NULL, decodeService, NULL);
+    pthread_create(&flowThread, NULL, flowService, NULL);
 
     while(true)
     {
-        Mat frame2, next;
-        capture >> frame2;
+        sem_wait(&flowFilled);
+
+        FlowSlot_t &slot = flowSlot[flowHead];
 
-        if (frame2.empty())
+        if (slot.eos)
             break;
 
-        cvtColor(frame2, next, COLOR_BGR2GRAY);
-        Mat flow(prvs.size(), CV_32FC2);
-        calcOpticalFlowFarneback(prvs, next, flow, 0.5, 3, 15, 3, 5, 1.2, 0);
+        start = now_msec();
 
         // visualization
-        Mat flow_parts[2];
-        split(flow, flow_parts);
-        Mat magnitude, angle, magn_norm;
+        split(slot.flow, flow_parts);
+
+        // done with the flow field, let the flow thread reuse the slot
+        flowHead = (flowHead + 1) % FLOW_SLOTS;
+        sem_post(&flowFree);
+
         cartToPolar(flow_parts[0], flow_parts[1], magnitude, angle, true);
         normalize(magnitude, magn_norm, 0.0f, 1.0f, NORM_MINMAX);
         angle *= ((1.f / 360.f) * (180.f / 255.f));
 
         //build hsv image
-        Mat _hsv[3], hsv, hsv8, bgr;
         _hsv[0] = angle;
-        _hsv[1] = Mat::ones(angle.size(), CV_32F);
         _hsv[2] = magn_norm;
         merge(_hsv, 3, hsv);
         hsv.convertTo(hsv8, CV_8U, 255.0);
         cvtColor(hsv8, bgr, COLOR_HSV2BGR);
 
+        renderMsec += now_msec() - start;
+        renderCnt++;
+
         imshow("frame2", bgr);
 
-        int keyboard = waitKey(30);
+        int keyboard = waitKey(RENDER_DELAY_MSEC);
 
         if (keyboard == 'q' || keyboard == 27)
+        {
+            // wake any stage blocked on a ring so it sees the abort
+            abortPipeline = true;
+            sem_post(&flowFree);
+            sem_post(&grayFree);
+            sem_post(&grayFilled);
             break;
-
-        prvs = next;
+        }
     }
+
+    pthread_join(decodeThread, NULL);
+    pthread_join(flowThread, NULL);
+
+    elapsed = now_msec() - pipelineStart;
+
+    printf("%u flow frames in %lf sec, %lf FPS\n", flowCnt, elapsed / 1000.0, (double)flowCnt * 1000.0 / elapsed);
+    printf("decode ave %lf msec, flow ave %lf msec, render ave %lf msec\n",
+           decodeCnt ? decodeMsec / decodeCnt : 0.0,
+           flowCnt ? flowMsec / flowCnt : 0.0,
+           renderCnt ? renderMsec / renderCnt : 0.0);
+    printf("flow stage busy %4.1lf%%, waiting on decode or render %4.1lf%%\n",
+           100.0 * flowMsec / elapsed, 100.0 * flowWaitMsec / elapsed);
 }
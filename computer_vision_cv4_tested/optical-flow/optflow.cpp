@@ -1,4 +1,10 @@
 #include <iostream>
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <algorithm>
+#include <numeric>
 #include <opencv2/core.hpp>
 #include <opencv2/highgui.hpp>
 #include <opencv2/imgproc.hpp>
@@ -6,6 +12,73 @@
 #include <opencv2/video.hpp>
 using namespace cv;
 using namespace std;
+
+// Tracker engine
+//
+// Points are tracked every frame with calcOpticalFlowPyrLK.  When fewer than
+// the re-detect threshold survive, the current gray frame is handed to a
+// detector thread running goodFeaturesToTrack, so the tracking loop never
+// pays for detection.  The detector fills the back one of two feature sets
+// and flips it to the front when done; the tracker picks it up on a later
+// frame, carries the new corners from the detection frame to the current
+// frame with one more LK call, and adds those not already near a live track.
+
+#define MAX_FEATURES (100)
+#define MIN_DISTANCE (7)
+
+// report tracking cost and survival every 100 frames
+#define REPORT_FRAMES (100)
+
+typedef struct
+{
+    vector<Point2f> points;
+    Mat gray;               // frame the points were detected in
+    unsigned int frame;     // index of that frame
+    double detectMsec;
+} FeatureSet_t;
+
+static FeatureSet_t featureSet[2];
+static int frontSet = 0;
+static bool detectPending = false, detectReady = false, abortDetect = false;
+static pthread_mutex_t setLock = PTHREAD_MUTEX_INITIALIZER;
+static sem_t detectRequest;
+
+
+static double now_msec(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return ((double)t.tv_sec * 1000.0) + ((double)t.tv_nsec / 1000000.0);
+}
+
+
+void *detectService(void *threadp)
+{
+    double start;
+
+    while (1)
+    {
+        sem_wait(&detectRequest);
+        if (abortDetect) break;
+
+        // the back set is ours until we flip it
+        FeatureSet_t &set = featureSet[1 - frontSet];
+
+        start = now_msec();
+        goodFeaturesToTrack(set.gray, set.points, MAX_FEATURES, 0.3, MIN_DISTANCE, Mat(), 7, false, 0.04);
+        set.detectMsec = now_msec() - start;
+
+        pthread_mutex_lock(&setLock);
+        frontSet = 1 - frontSet;
+        detectReady = true;
+        pthread_mutex_unlock(&setLock);
+    }
+
+    return NULL;
+}
+
+
 int main(int argc, char **argv)
 {
     const string about =
@@ -14,7 +87,8 @@ int main(int argc, char **argv)
         "  https://www.bogotobogo.com/python/OpenCV_Python/images/mean_shift_tracking/slow_traffic_small.mp4";
     const string keys =
         "{ h help |      | print this help message }"
-        "{ @image |<none>| path to image file }";
+        "{ @image |<none>| path to image file }"
+        "{ threshold t | 50 | re-detect when fewer points than this are tracked }";
     CommandLineParser parser(argc, argv, keys);
     parser.about(about);
     if (parser.has("help"))
@@ -23,6 +97,7 @@ int main(int argc, char **argv)
         return 0;
     }
     string filename = parser.get<string>("@image");
+    unsigned int redetectThreshold = parser.get<unsigned int>("threshold");
     if (!parser.check())
     {
         parser.printErrors();
@@ -45,43 +120,162 @@ int main(int argc, char **argv)
         colors.push_back(Scalar(r,g,b));
     }
     Mat old_frame, old_gray;
-    vector<Point2f> p0, p1;
+    vector<Point2f> p0, p1, fresh;
+    vector<unsigned int> id0, id1, age0, age1;
+    unsigned int nextId = 0, frameCnt = 0;
     // Take first frame and find corners in it
     capture >> old_frame;
     cvtColor(old_frame, old_gray, COLOR_BGR2GRAY);
-    goodFeaturesToTrack(old_gray, p0, 100, 0.3, 7, Mat(), 7, false, 0.04);
+    goodFeaturesToTrack(old_gray, p0, MAX_FEATURES, 0.3, MIN_DISTANCE, Mat(), 7, false, 0.04);
+    for(uint i = 0; i < p0.size(); i++)
+    {
+        id0.push_back(nextId++);
+        age0.push_back(0);
+    }
     // Create a mask image for drawing purposes
     Mat mask = Mat::zeros(old_frame.size(), old_frame.type());
+
+    pthread_t detectThread;
+    sem_init(&detectRequest, 0, 0);
+    pthread_create(&detectThread, NULL, detectService, NULL);
+
+    // statistics, per report window and for the whole run
+    vector<double> trackTimes;
+    double windowTrack = 0.0, windowMax = 0.0, detectMsec = 0.0, detectLag = 0.0;
+    unsigned long tracked = 0, survived = 0, lost = 0, lifetimeSum = 0, added = 0;
+    unsigned int redetects = 0, windowFrames = 0;
+
+    TermCriteria criteria = TermCriteria((TermCriteria::COUNT) + (TermCriteria::EPS), 10, 0.03);
+    vector<uchar> status;
+    vector<float> err;
+    Mat frame, frame_gray, img;
+
     while(true){
-        Mat frame, frame_gray;
         capture >> frame;
         if (frame.empty())
             break;
         cvtColor(frame, frame_gray, COLOR_BGR2GRAY);
+        frameCnt++;
+
+        double start = now_msec();
+
         // calculate optical flow
-        vector<uchar> status;
-        vector<float> err;
-        TermCriteria criteria = TermCriteria((TermCriteria::COUNT) + (TermCriteria::EPS), 10, 0.03);
-        calcOpticalFlowPyrLK(old_gray, frame_gray, p0, p1, status, err, Size(15,15), 2, criteria);
+        p1.clear();
+        if (!p0.empty())
+            calcOpticalFlowPyrLK(old_gray, frame_gray, p0, p1, status, err, Size(15,15), 2, criteria);
+
+        id1.clear();
+        age1.clear();
         vector<Point2f> good_new;
         for(uint i = 0; i < p0.size(); i++)
         {
             // Select good points
             if(status[i] == 1) {
                 good_new.push_back(p1[i]);
+                id1.push_back(id0[i]);
+                age1.push_back(age0[i] + 1);
                 // draw the tracks
-                line(mask,p1[i], p0[i], colors[i], 2);
-                circle(frame, p1[i], 5, colors[i], -1);
+                line(mask,p1[i], p0[i], colors[id0[i] % 100], 2);
+                circle(frame, p1[i], 5, colors[id0[i] % 100], -1);
+            }
+            else {
+                lifetimeSum += age0[i];
+                lost++;
             }
         }
-        Mat img;
+        tracked += p0.size();
+        survived += good_new.size();
+
+        // merge a finished detection, carried forward from its frame to this one
+        pthread_mutex_lock(&setLock);
+        bool ready = detectReady;
+        detectReady = false;
+        pthread_mutex_unlock(&setLock);
+
+        if (ready)
+        {
+            FeatureSet_t &set = featureSet[frontSet];
+            detectPending = false;
+            redetects++;
+            detectMsec += set.detectMsec;
+            detectLag += frameCnt - set.frame;
+
+            if (!set.points.empty())
+                calcOpticalFlowPyrLK(set.gray, frame_gray, set.points, fresh, status, err, Size(15,15), 2, criteria);
+
+            for(uint i = 0; i < set.points.size() && good_new.size() < MAX_FEATURES; i++)
+            {
+                if (status[i] != 1)
+                    continue;
+
+                bool nearTrack = false;
+                for(uint j = 0; j < good_new.size() && !nearTrack; j++)
+                {
+                    Point2f d = fresh[i] - good_new[j];
+                    nearTrack = (d.x*d.x + d.y*d.y) < (MIN_DISTANCE*MIN_DISTANCE);
+                }
+
+                if (!nearTrack)
+                {
+                    good_new.push_back(fresh[i]);
+                    id1.push_back(nextId++);
+                    age1.push_back(0);
+                    added++;
+                }
+            }
+        }
+
+        // too few left, hand this frame to the detector unless it is still busy
+        if (good_new.size() < redetectThreshold && !detectPending)
+        {
+            FeatureSet_t &set = featureSet[1 - frontSet];
+            frame_gray.copyTo(set.gray);
+            set.frame = frameCnt;
+            detectPending = true;
+            sem_post(&detectRequest);
+        }
+
+        double trackTime = now_msec() - start;
+        trackTimes.push_back(trackTime);
+        windowTrack += trackTime;
+        windowMax = std::max(windowMax, trackTime);
+
+        if (++windowFrames == REPORT_FRAMES)
+        {
+            printf("frame %u: track ave %.3lf msec, max %.3lf msec, %zu points, survival %.1lf%%, %u redetects\n",
+                   frameCnt, windowTrack / windowFrames, windowMax, good_new.size(),
+                   tracked ? 100.0 * survived / tracked : 0.0, redetects);
+            windowTrack = windowMax = 0.0;
+            windowFrames = 0;
+        }
+
         add(frame, mask, img);
         imshow("Frame", img);
         int keyboard = waitKey(30);
         if (keyboard == 'q' || keyboard == 27)
             break;
         // Now update the previous frame and previous points
-        old_gray = frame_gray.clone();
-        p0 = good_new;
+        swap(old_gray, frame_gray);
+        p0.swap(good_new);
+        id0.swap(id1);
+        age0.swap(age1);
+    }
+
+    abortDetect = true;
+    sem_post(&detectRequest);
+    pthread_join(detectThread, NULL);
+
+    if (!trackTimes.empty())
+    {
+        sort(trackTimes.begin(), trackTimes.end());
+        printf("%u frames, track ave %.3lf msec, p99 %.3lf msec, max %.3lf msec\n", frameCnt,
+               std::accumulate(trackTimes.begin(), trackTimes.end(), 0.0) / trackTimes.size(),
+               trackTimes[(trackTimes.size() * 99) / 100], trackTimes.back());
+        printf("per-frame survival %.1lf%%, %lu tracks lost, ave lifetime %.1lf frames, %lu added\n",
+               tracked ? 100.0 * survived / tracked : 0.0, lost,
+               lost ? (double)lifetimeSum / lost : 0.0, added);
+        printf("%u redetects, detect ave %.3lf msec off the tracking thread, merged %.1lf frames later\n",
+               redetects, redetects ? detectMsec / redetects : 0.0,
+               redetects ? detectLag / redetects : 0.0);
     }
 }
@@ -0,0 +1,181 @@
+// Per-frame image pyramid cache, see pyrcache.h
+
+#include <time.h>
+#include <math.h>
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "pyrcache.h"
+
+using namespace cv;
+
+
+static double now_msec(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return ((double)t.tv_sec * 1000.0) + ((double)t.tv_nsec / 1000000.0);
+}
+
+
+int pyrcache_init(pyrcache_t *c, Size size, int levels, Size lk_win)
+{
+    if(levels < 1 || levels > PYR_MAX_LEVELS)
+        return -1;
+
+    c->levels = levels;
+    c->size = size;
+    c->border = lk_win;
+    c->cur = 0;
+    c->nscaled = 0;
+    c->frames = c->level_hits = c->scaled_hits = c->scaled_misses = 0;
+    c->build_msec = c->scaled_msec = 0.0;
+
+    // same level sizes as pyrDown's default, same border as buildOpticalFlowPyramid
+    for(int s = 0; s < 2; s++)
+    {
+        pyr_set_t &set = c->set[s];
+        Size sz = size;
+
+        set.lk.clear();
+        for(int l = 0; l < levels; l++)
+        {
+            set.buf[l].create(sz.height + 2 * lk_win.height, sz.width + 2 * lk_win.width, CV_8UC1);
+            set.level[l] = set.buf[l](Rect(lk_win.width, lk_win.height, sz.width, sz.height));
+            set.lk.push_back(set.level[l]);
+            sz = Size((sz.width + 1) / 2, (sz.height + 1) / 2);
+        }
+        set.frame = 0;
+    }
+
+    return 0;
+}
+
+
+void pyrcache_build(pyrcache_t *c, const Mat &frame)
+{
+    double start = now_msec();
+
+    c->cur ^= 1;
+    pyr_set_t &set = c->set[c->cur];
+
+    CV_Assert(frame.size() == c->size);
+
+    // every destination is a view of the right size, so nothing is reallocated
+    if(frame.channels() == 3)
+        cvtColor(frame, set.level[0], COLOR_BGR2GRAY);
+    else
+        frame.copyTo(set.level[0]);
+
+    for(int l = 0; l < c->levels; l++)
+    {
+        if(l > 0)
+            pyrDown(set.level[l - 1], set.level[l], set.level[l].size());
+
+        // fill the border around the view in place, as buildOpticalFlowPyramid does
+        copyMakeBorder(set.level[l], set.buf[l], c->border.height, c->border.height,
+                       c->border.width, c->border.width, BORDER_REFLECT_101 | BORDER_ISOLATED);
+    }
+
+    set.frame = ++c->frames;
+    c->build_msec += now_msec() - start;
+}
+
+
+const Mat &pyrcache_level(pyrcache_t *c, int level, int age)
+{
+    const pyr_set_t &set = c->set[age ? c->cur ^ 1 : c->cur];
+
+    CV_Assert(level >= 0 && level < c->levels && set.frame != 0);
+    c->level_hits++;
+
+    return set.level[level];
+}
+
+
+const std::vector<Mat> &pyrcache_lk(pyrcache_t *c, int age)
+{
+    const pyr_set_t &set = c->set[age ? c->cur ^ 1 : c->cur];
+
+    CV_Assert(set.frame != 0);
+    c->level_hits++;
+
+    return set.lk;
+}
+
+
+const Mat &pyrcache_scaled(pyrcache_t *c, double scale)
+{
+    const pyr_set_t &set = c->set[c->cur];
+    int slot = -1;
+
+    CV_Assert(scale >= 1.0);
+
+    // exact octaves are the levels themselves
+    int octave = (int)floor(log2(scale) + 1e-9);
+    if(octave < c->levels && fabs(scale - (double)(1 << octave)) < 1e-9)
+    {
+        c->scaled_hits++;
+        return set.level[octave];
+    }
+
+    for(int i = 0; i < c->nscaled; i++)
+        if(fabs(c->scale[i] - scale) < 1e-9)
+        {
+            slot = i;
+            break;
+        }
+
+    if(slot >= 0 && c->scaled_frame[slot] == c->frames)
+    {
+        c->scaled_hits++;
+        return c->scaled[slot];
+    }
+
+    if(slot < 0)
+    {
+        if(c->nscaled < PYR_MAX_SCALED)
+            slot = c->nscaled++;
+        else
+        {
+            // table full: reuse the entry used longest ago
+            slot = 0;
+            for(int i = 1; i < PYR_MAX_SCALED; i++)
+                if(c->scaled_frame[i] < c->scaled_frame[slot])
+                    slot = i;
+        }
+        c->scale[slot] = scale;
+    }
+
+    double start = now_msec();
+    Size sz(cvRound(c->size.width / scale), cvRound(c->size.height / scale));
+    int src = octave < c->levels ? octave : c->levels - 1;
+
+    // the smallest level still at least as big as the result
+    while(src > 0 && (set.level[src].cols < sz.width || set.level[src].rows < sz.height))
+        src--;
+
+    resize(set.level[src], c->scaled[slot], sz, 0, 0, INTER_LINEAR);
+    c->scaled_frame[slot] = c->frames;
+    c->scaled_misses++;
+    c->scaled_msec += now_msec() - start;
+
+    return c->scaled[slot];
+}
+
+
+size_t pyrcache_bytes(const pyrcache_t *c)
+{
+    size_t bytes = 0;
+
+    for(int s = 0; s < 2; s++)
+        for(int l = 0; l < c->levels; l++)
+            bytes += c->set[s].buf[l].total() * c->set[s].buf[l].elemSize();
+
+    for(int i = 0; i < c->nscaled; i++)
+        bytes += c->scaled[i].total() * c->scaled[i].elemSize();
+
+    return bytes;
+}
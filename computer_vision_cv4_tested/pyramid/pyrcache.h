@@ -0,0 +1,82 @@
+// Per-frame image pyramid cache
+//
+// optflow's calcOpticalFlowPyrLK, denseoptflow's Farneback and hogpeople's
+// HOG each turn the same camera frame into gray and then into their own
+// pyramid.  LK even rebuilds the previous frame's pyramid on every call.
+// When several of them run on one camera, that is the same work done three
+// or four times per frame, with a set of buffers for each.
+//
+// The cache does it once per frame:
+//
+//   - one gray conversion and one octave pyramid (pyrDown, vectorized in
+//     OpenCV), into buffers allocated on the first frame and reused
+//   - each level is stored inside a buffer with a border of the LK window
+//     already filled in, which is the layout buildOpticalFlowPyramid
+//     produces, so pyrcache_lk() can be passed straight to
+//     calcOpticalFlowPyrLK for both the previous and the current frame
+//   - the previous frame's levels are kept, so LK and dense flow get their
+//     "prev" image for free
+//   - arbitrary scales, e.g. HOG's 1.05 steps, are resized from the nearest
+//     octave at or above the wanted size and cached for the rest of the
+//     frame, so detectors asking for the same scale share one image
+//
+// Every image handed out is a view into the cache and stays valid until the
+// next pyrcache_build() (or the one after, for the previous frame).
+
+#ifndef PYRCACHE_H
+#define PYRCACHE_H
+
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+
+#define PYR_MAX_LEVELS (8)
+#define PYR_MAX_SCALED (32)
+
+typedef struct
+{
+    cv::Mat buf[PYR_MAX_LEVELS];    // level plus border
+    cv::Mat level[PYR_MAX_LEVELS];  // the level itself, a view into buf
+    std::vector<cv::Mat> lk;        // level[0..levels-1], for calcOpticalFlowPyrLK
+    unsigned long frame;            // which frame this set holds, 0 for none
+} pyr_set_t;
+
+typedef struct
+{
+    int levels;
+    cv::Size size, border;
+
+    pyr_set_t set[2];               // current and previous frame, alternating
+    int cur;
+
+    double scale[PYR_MAX_SCALED];
+    cv::Mat scaled[PYR_MAX_SCALED];
+    unsigned long scaled_frame[PYR_MAX_SCALED];
+    int nscaled;
+
+    // statistics
+    unsigned long frames, level_hits, scaled_hits, scaled_misses;
+    double build_msec, scaled_msec;
+} pyrcache_t;
+
+// Frame size, number of octave levels (full size is level 0) and the LK
+// window size whose border the levels are padded with
+int pyrcache_init(pyrcache_t *c, cv::Size size, int levels, cv::Size lk_win);
+
+// Gray and pyramid for a new frame, BGR or gray; the last one becomes "previous"
+void pyrcache_build(pyrcache_t *c, const cv::Mat &frame);
+
+// Octave level of the current (age 0) or previous (age 1) frame
+const cv::Mat &pyrcache_level(pyrcache_t *c, int level, int age);
+
+// Levels of the current or previous frame in the layout calcOpticalFlowPyrLK
+// accepts in place of an image; use maxLevel = levels - 1 or less
+const std::vector<cv::Mat> &pyrcache_lk(pyrcache_t *c, int age);
+
+// Current frame at size / scale, scale >= 1
+const cv::Mat &pyrcache_scaled(pyrcache_t *c, double scale);
+
+// Bytes held by the cache
+size_t pyrcache_bytes(const pyrcache_t *c);
+
+#endif
@@ -0,0 +1,323 @@
+// Pyramid cache demo and benchmark
+//
+// Runs three analytics on every frame of one video, the way optflow,
+// denseoptflow and hogpeople would if they ran on the same camera:
+//
+//   sparse flow   calcOpticalFlowPyrLK on up to MAX_FEATURES corners
+//   dense flow    calcOpticalFlowFarneback on the half-size gray frame
+//   people        HOG window search over a ladder of scales
+//
+// Each frame is processed twice.  The "separate" pass does what the
+// programs do today: each analytic converts the frame to gray itself, LK
+// builds both pyramids inside every call, dense flow downsizes its own copy
+// and HOG resizes its own scale ladder.  The "cached" pass builds one
+// pyrcache per frame and all three consume it.  Both passes see the same
+// frame and the same points, and their results are compared.
+//
+// Every REPORT_FRAMES frames the time of each pass per analytic, the time
+// saved and the memory each keeps is reported.
+//
+// Usage: pyrcache_demo [video] [--frames=N] [--nohog] [--display]
+
+#include <stdio.h>
+#include <time.h>
+#include <iostream>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/highgui.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/objdetect.hpp>
+#include <opencv2/videoio.hpp>
+#include <opencv2/video.hpp>
+
+#include "pyrcache.h"
+
+using namespace cv;
+using namespace std;
+
+#define REPORT_FRAMES (100)
+
+// sparse flow, as in optflow.cpp
+#define MAX_FEATURES (100)
+#define MIN_FEATURES (20)
+#define LK_WIN (15)
+#define LK_MAX_LEVEL (2)
+
+// pyramid levels kept: LK needs LK_MAX_LEVEL + 1, dense flow uses level 1
+#define CACHE_LEVELS (LK_MAX_LEVEL + 1)
+
+// HOG scale ladder, coarser than detectMultiScale's default 1.05 to keep
+// the demo near real time; every scale is shared through the cache
+#define HOG_SCALE_STEP (1.2)
+#define HOG_MAX_SCALES (8)
+
+enum { STAGE_GRAY = 0, STAGE_LK, STAGE_DENSE, STAGE_HOG, STAGE_COUNT };
+static const char *stageName[STAGE_COUNT] = { "gray/pyramid", "sparse flow", "dense flow", "hog" };
+
+
+static double now_msec(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return ((double)t.tv_sec * 1000.0) + ((double)t.tv_nsec / 1000000.0);
+}
+
+
+static size_t mat_bytes(const Mat &m)
+{
+    return m.empty() ? 0 : (size_t)(m.dataend - m.datastart);
+}
+
+
+// HOG over a list of already scaled images, boxes mapped back to full size
+static void hog_ladder(HOGDescriptor &hog, const vector<const Mat *> &imgs, const vector<double> &scales,
+                       vector<Rect> &found)
+{
+    vector<Point> locations;
+
+    found.clear();
+    for(size_t i = 0; i < imgs.size(); i++)
+    {
+        hog.detect(*imgs[i], locations, 0.0, Size(8, 8));
+        for(size_t k = 0; k < locations.size(); k++)
+            found.push_back(Rect(cvRound(locations[k].x * scales[i]), cvRound(locations[k].y * scales[i]),
+                                 cvRound(hog.winSize.width * scales[i]), cvRound(hog.winSize.height * scales[i])));
+    }
+    groupRectangles(found, 2, 0.2);
+}
+
+
+// Stage times since the last report, then cleared
+static void report(unsigned int from, unsigned int to, double *sepMsec, double *cachedMsec, bool useHog,
+                   size_t sepBytes, const pyrcache_t *cache)
+{
+    double sepTotal = 0.0, cachedTotal = 0.0;
+    unsigned int n = to - from;
+
+    printf("frames %u-%u, msec/frame   separate   cached\n", from + 1, to);
+    for(int s = 0; s < STAGE_COUNT; s++)
+    {
+        if(s == STAGE_HOG && !useHog) continue;
+        printf("  %-14s        %8.3f %8.3f\n", stageName[s], sepMsec[s] / n, cachedMsec[s] / n);
+        sepTotal += sepMsec[s];
+        cachedTotal += cachedMsec[s];
+        sepMsec[s] = cachedMsec[s] = 0.0;
+    }
+    printf("  %-14s        %8.3f %8.3f   saved %.3f msec/frame (%.1f%%)\n", "total",
+           sepTotal / n, cachedTotal / n, (sepTotal - cachedTotal) / n,
+           sepTotal > 0.0 ? 100.0 * (sepTotal - cachedTotal) / sepTotal : 0.0);
+    printf("  memory: separate %.2f MB, cache %.2f MB; %lu scaled hits, %lu resizes\n",
+           sepBytes / 1048576.0, pyrcache_bytes(cache) / 1048576.0, cache->scaled_hits, cache->scaled_misses);
+}
+
+
+int main(int argc, char **argv)
+{
+    CommandLineParser parser(argc, argv,
+        "{help h ||}"
+        "{@video | ../optical-flow/slow_traffic_small.mp4 | input video}"
+        "{frames | 0 | stop after this many frames, 0 for the whole video}"
+        "{nohog | | leave the HOG detector out}"
+        "{display | | show the cached pass results}");
+
+    if(parser.has("help"))
+    {
+        parser.printMessage();
+        return 0;
+    }
+
+    VideoCapture capture(parser.get<String>("@video"));
+    if(!capture.isOpened())
+    {
+        cerr << "Unable to open " << parser.get<String>("@video") << endl;
+        return 0;
+    }
+
+    unsigned int limit = parser.get<unsigned int>("frames");
+    bool useHog = !parser.has("nohog"), display = parser.has("display");
+
+    Mat frame;
+    if(!capture.read(frame))
+        return 0;
+
+    const Size frameSize = frame.size(), winSize(LK_WIN, LK_WIN);
+    const Size halfSize((frameSize.width + 1) / 2, (frameSize.height + 1) / 2);  // pyrDown's size
+    TermCriteria criteria((TermCriteria::COUNT) + (TermCriteria::EPS), 10, 0.03);
+    HOGDescriptor hog;
+    hog.setSVMDetector(HOGDescriptor::getDefaultPeopleDetector());
+
+    // scales whose images are at least one HOG window
+    vector<double> hogScales;
+    for(double s = 1.0; hogScales.size() < HOG_MAX_SCALES; s *= HOG_SCALE_STEP)
+    {
+        if(frameSize.width / s < hog.winSize.width || frameSize.height / s < hog.winSize.height)
+            break;
+        hogScales.push_back(s);
+    }
+
+    // separate pass state: each analytic's own gray images
+    Mat lkPrev, lkGray, densePrev, denseGray, denseFull, hogGray, denseFlowSep;
+    vector<Mat> hogOwn(hogScales.size());
+    vector<Mat> lkPyrPrev, lkPyrCur;   // only to measure what LK builds inside
+
+    // cached pass state
+    pyrcache_t cache;
+    Mat denseFlowCached;
+    if(pyrcache_init(&cache, frameSize, CACHE_LEVELS, winSize) < 0)
+        return -1;
+
+    vector<Point2f> p0, pSep, pCached;
+    vector<uchar> statusSep, statusCached;
+    vector<float> err;
+    vector<Rect> peopleSep, peopleCached;
+
+    double sepMsec[STAGE_COUNT] = {0}, cachedMsec[STAGE_COUNT] = {0};
+    double pointDiff = 0.0, flowDiff = 0.0;
+    unsigned long pointsCompared = 0, peopleMismatch = 0;
+    unsigned int frames = 0, reported = 0;
+    size_t sepBytes = 0;
+    double t;
+
+    // prime both passes with the first frame
+    cvtColor(frame, lkPrev, COLOR_BGR2GRAY);
+    resize(lkPrev, densePrev, halfSize, 0, 0, INTER_AREA);
+    pyrcache_build(&cache, frame);
+    goodFeaturesToTrack(lkPrev, p0, MAX_FEATURES, 0.3, 7, Mat(), 7, false, 0.04);
+
+    while(capture.read(frame) && (limit == 0 || frames < limit))
+    {
+        frames++;
+
+        // ---- separate: every analytic starts from the BGR frame ----
+
+        t = now_msec();
+        cvtColor(frame, lkGray, COLOR_BGR2GRAY);
+        cvtColor(frame, denseFull, COLOR_BGR2GRAY);
+        if(useHog) cvtColor(frame, hogGray, COLOR_BGR2GRAY);
+        sepMsec[STAGE_GRAY] += now_msec() - t;
+
+        t = now_msec();
+        if(!p0.empty())
+            calcOpticalFlowPyrLK(lkPrev, lkGray, p0, pSep, statusSep, err, winSize, LK_MAX_LEVEL, criteria);
+        sepMsec[STAGE_LK] += now_msec() - t;
+
+        t = now_msec();
+        resize(denseFull, denseGray, halfSize, 0, 0, INTER_AREA);
+        calcOpticalFlowFarneback(densePrev, denseGray, denseFlowSep, 0.5, 3, 15, 3, 5, 1.2, 0);
+        sepMsec[STAGE_DENSE] += now_msec() - t;
+
+        if(useHog)
+        {
+            vector<const Mat *> imgs;
+
+            t = now_msec();
+            for(size_t i = 0; i < hogScales.size(); i++)
+            {
+                Size sz(cvRound(frameSize.width / hogScales[i]), cvRound(frameSize.height / hogScales[i]));
+                if(i == 0)
+                    hogOwn[i] = hogGray;
+                else
+                    resize(hogGray, hogOwn[i], sz, 0, 0, INTER_LINEAR);
+                imgs.push_back(&hogOwn[i]);
+            }
+            hog_ladder(hog, imgs, hogScales, peopleSep);
+            sepMsec[STAGE_HOG] += now_msec() - t;
+        }
+
+        // ---- cached: one gray and pyramid, shared ----
+
+        t = now_msec();
+        pyrcache_build(&cache, frame);
+        cachedMsec[STAGE_GRAY] += now_msec() - t;
+
+        t = now_msec();
+        if(!p0.empty())
+            calcOpticalFlowPyrLK(pyrcache_lk(&cache, 1), pyrcache_lk(&cache, 0), p0, pCached, statusCached, err,
+                                 winSize, LK_MAX_LEVEL, criteria);
+        cachedMsec[STAGE_LK] += now_msec() - t;
+
+        // level 1 is pyrDown rather than INTER_AREA, close but not identical
+        t = now_msec();
+        calcOpticalFlowFarneback(pyrcache_level(&cache, 1, 1), pyrcache_level(&cache, 1, 0), denseFlowCached,
+                                 0.5, 3, 15, 3, 5, 1.2, 0);
+        cachedMsec[STAGE_DENSE] += now_msec() - t;
+
+        if(useHog)
+        {
+            vector<const Mat *> imgs;
+
+            t = now_msec();
+            for(size_t i = 0; i < hogScales.size(); i++)
+                imgs.push_back(&pyrcache_scaled(&cache, hogScales[i]));
+            hog_ladder(hog, imgs, hogScales, peopleCached);
+            cachedMsec[STAGE_HOG] += now_msec() - t;
+
+            if(peopleCached.size() != peopleSep.size())
+                peopleMismatch++;
+        }
+
+        // ---- compare ----
+
+        for(size_t i = 0; i < p0.size(); i++)
+            if(statusSep[i] && statusCached[i])
+            {
+                pointDiff += norm(pSep[i] - pCached[i]);
+                pointsCompared++;
+            }
+        flowDiff += norm(denseFlowSep, denseFlowCached, NORM_L1) / (double)denseFlowSep.total();
+
+        // what the separate pass holds: its own grays, LK's two pyramids, HOG's ladder
+        if(frames == 1)
+        {
+            buildOpticalFlowPyramid(lkPrev, lkPyrPrev, winSize, LK_MAX_LEVEL, false);
+            buildOpticalFlowPyramid(lkGray, lkPyrCur, winSize, LK_MAX_LEVEL, false);
+            for(size_t l = 0; l < lkPyrCur.size(); l++)
+                sepBytes += mat_bytes(lkPyrPrev[l]) + mat_bytes(lkPyrCur[l]);
+            sepBytes += mat_bytes(lkPrev) + mat_bytes(lkGray) + mat_bytes(denseFull) +
+                        mat_bytes(densePrev) + mat_bytes(denseGray) + mat_bytes(hogGray);
+            for(size_t i = 1; i < hogOwn.size(); i++)
+                sepBytes += mat_bytes(hogOwn[i]);
+        }
+
+        // both passes continue from the separate pass's points
+        vector<Point2f> good;
+        for(size_t i = 0; i < p0.size(); i++)
+            if(statusSep[i])
+                good.push_back(pSep[i]);
+        p0 = good;
+        if(p0.size() < MIN_FEATURES)
+            goodFeaturesToTrack(lkGray, p0, MAX_FEATURES, 0.3, 7, Mat(), 7, false, 0.04);
+
+        swap(lkPrev, lkGray);
+        swap(densePrev, denseGray);
+
+        if(display)
+        {
+            Mat shown = frame.clone();
+            for(size_t i = 0; i < peopleCached.size(); i++)
+                rectangle(shown, peopleCached[i], Scalar(0, 255, 0), 2);
+            for(size_t i = 0; i < pCached.size(); i++)
+                if(statusCached[i])
+                    circle(shown, pCached[i], 3, Scalar(0, 0, 255), -1);
+            imshow("pyrcache", shown);
+            if(waitKey(1) == 27)
+                break;
+        }
+
+        if(frames % REPORT_FRAMES == 0)
+        {
+            report(reported, frames, sepMsec, cachedMsec, useHog, sepBytes, &cache);
+            printf("  agreement: LK points differ by %.4f px on average, dense flow by %.4f px, "
+                   "%lu frames with a different person count\n",
+                   pointsCompared ? pointDiff / pointsCompared : 0.0, flowDiff / frames, peopleMismatch);
+            reported = frames;
+        }
+    }
+
+    if(frames > reported)
+        report(reported, frames, sepMsec, cachedMsec, useHog, sepBytes, &cache);
+
+    return 0;
+}
@@ -2,35 +2,71 @@
  * @file calibrate_camera_pov.cpp
  * @author Feras Alshehri (falshehri@mail.csuchico.edu)
  * @brief Use to calibrate the point of view of camera. 
- * @version 0.1
+ *
+ * Frames are captured and shown at full rate.  Chessboard detection runs on
+ * a pool of worker threads: each one looks for the board on a downscaled
+ * preview first (findChessboardCorners is the slow part, and it is much
+ * slower on a full frame with no board in it), and only when it is found are
+ * the corners scaled back up and refined with cornerSubPix at full
+ * resolution.  A frame is handed to a worker only if one is idle, so
+ * detection never holds up the preview.
+ *
+ * Detected views are kept only if they differ enough from the views already
+ * kept (board position, size and tilt), up to MAX_VIEWS.  When the set is
+ * full, a new view replaces the most redundant one if that spreads the set
+ * further.  This bounds calibrateCamera's cost however long the session
+ * runs.  Each time the set changes, a calibration thread re-runs
+ * calibrateCamera starting from the previous result
+ * (CALIB_USE_INTRINSIC_GUESS), so every refinement is a few iterations.
+ *
+ * keys: u toggles the undistorted preview, s saves the calibration, ESC
+ *       quits (and saves).
+ *
+ * @version 0.2
  * @date 2022-09-30
  *
  * @build_with:
- * g++ calibrate_camera_pov.cpp -o calibrate_camera_pov `pkg-config --libs opencv4`
- * -I/usr/include/opencv4/
+ * make calibrate_camera_pov (links capture_source.o)
  *
  * @copyright Copyright (c) 2022
  *
  */
 
+#include <algorithm>
+#include <array>
+#include <cfloat>
+#include <cmath>
 #include <iostream>
+#include <opencv2/calib3d.hpp>
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui.hpp>
+#include <opencv2/imgproc.hpp>
 #include <opencv2/videoio.hpp>
+#include <pthread.h>
+#include <semaphore.h>
 #include <string>
 #include <time.h>
+#include <vector>
+
+#include "capture_source.h"
 
 #define WIN_TITLE "TEST"
 #define ESC_ASCII 27
 
 #define NUM_OF_FRAMES 1300
-#define USE_GSTREAMER 1
-// gStreamer parameters
+
+// detection and calibration
+#define DETECT_WORKERS 2
+#define MAX_WORKERS 8
+#define PREVIEW_SCALE 0.5    // board search on a frame this much smaller
+#define MIN_VIEWS 5          // calibrate once this many views are kept
+#define MAX_VIEWS 25         // bound on the views passed to calibrateCamera
+#define MIN_VIEW_DISTANCE 0.08 // how different a view must be to be kept
+#define RESULT_SLOTS 16
+// capture parameters, the source itself is probed at startup
 #define CAPTURE_WIDTH 1280 // 1280
 #define CAPTURE_HEIGHT 720 // 720
-#define DISPLAY_WIDTH CAPTURE_WIDTH
-#define DISPLAY_HEIGHT CAPTURE_HEIGHT
-#define FRAMERATE 60.0
+#define FRAMERATE 60
 #define FLIP_MODE 0
 
 /**
@@ -48,82 +84,294 @@ std::string get_time_ns(std::string sep = "_") {
 }
 
 /**
- * @brief this is needed to load a CSI camera configurations via gStreamer.
- * source: https://github.com/JetsonHacksNano/CSI-Camera/blob/master/simple_camera.cpp
+ * @brief monotonic time in msec, for the stage timings.
+ */
+static double now_msec(void) {
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return ((double)t.tv_sec * 1000.0) + ((double)t.tv_nsec / 1000000.0);
+}
+
+typedef struct {
+    std::vector<cv::Point2f> corners; // full resolution, refined
+    double                   pose[4]; // center x, center y, size, tilt, all 0..1
+    double                   msec;    // preview search plus refinement
+    bool                     found;
+} detection_t;
+
+typedef struct {
+    int          idx;
+    cv::Mat      gray;      // full resolution frame handed to this worker
+    cv::Mat      preview;
+    sem_t        start;
+    volatile int busy;
+    pthread_t    thread;
+} detect_worker_t;
+
+static detect_worker_t workers[MAX_WORKERS];
+static int             num_workers = DETECT_WORKERS;
+static cv::Size        board_size(9, 6);
+static volatile bool   abort_workers = false;
+
+// finished detections, many producers (workers), one consumer (main loop)
+static detection_t     results[RESULT_SLOTS];
+static int             result_head = 0, result_tail = 0;
+static pthread_mutex_t result_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// kept views and the calibration computed from them
+typedef struct {
+    std::vector<std::vector<cv::Point2f>> image_points;
+    std::vector<std::array<double, 4>>    poses;
+    std::vector<cv::Point3f>              board;
+    cv::Size                              image_size;
+
+    // written by the calibration thread under lock
+    cv::Mat      camera_matrix, dist_coeffs;
+    double       rms;
+    unsigned int runs;
+    double       last_msec;
+    bool         valid;
+
+    bool            dirty, stop;
+    pthread_mutex_t lock;
+    pthread_cond_t  changed;
+    pthread_t       thread;
+} calibration_t;
+
+static calibration_t calib;
+
+
+/**
+ * @brief where the board is and how it is held, for judging view diversity.
  *
- * @param capture_width width of captured frame.
- * @param capture_height height of captured frame.
- * @param display_width width of frame to be displayed.
- * @param display_height width of frame to be displayed.
- * @param framerate frame rate of stream.
- * @param flip_method flip frame if necessary, 90 deg intervals.
- *                    (0 = 0 deg, 1 = 90 deg, 2 = 180 deg, 3 = 270 deg).
- * @return std::string a string to be passed as gStreamer command line arguments.
+ * Center and size are relative to the frame; tilt compares the lengths of
+ * the first and last corner rows, which differ when the board is turned
+ * away from the camera.
  */
-static std::string gstreamer_pipeline(int capture_width, int capture_height,
-                                      int display_width, int display_height,
-                                      int framerate, int flip_method) {
-
-    return "nvarguscamerasrc ! video/x-raw(memory:NVMM), width=(int)" +
-           std::to_string(capture_width) + ", height=(int)" +
-           std::to_string(capture_height) + ", framerate=(fraction)" +
-           std::to_string(framerate) +
-           "/1 ! nvvidconv flip-method=" + std::to_string(flip_method) +
-           " ! video/x-raw, width=(int)" + std::to_string(display_width) +
-           ", height=(int)" + std::to_string(display_height) +
-           ", format=(string)BGRx ! videoconvert ! video/x-raw, format=(string)BGR ! "
-           "appsink";
+static void board_pose(const std::vector<cv::Point2f> &c, cv::Size frame, double pose[4]) {
+    cv::Rect2f box   = cv::boundingRect(c);
+    int        w     = board_size.width;
+    double     top   = cv::norm(c[w - 1] - c[0]);
+    double     bot   = cv::norm(c[c.size() - 1] - c[c.size() - w]);
+    double     left  = cv::norm(c[c.size() - w] - c[0]);
+    double     right = cv::norm(c[c.size() - 1] - c[w - 1]);
+
+    pose[0] = (box.x + box.width / 2.0) / frame.width;
+    pose[1] = (box.y + box.height / 2.0) / frame.height;
+    pose[2] = std::sqrt((double)box.area() / frame.area());
+    pose[3] = 0.5 * (std::fabs(top - bot) / std::max(top, bot) + std::fabs(left - right) / std::max(left, right));
 }
 
+
+static double pose_distance(const double *a, const double *b) {
+    double d = 0.0;
+
+    for (int i = 0; i < 4; i++) { d += (a[i] - b[i]) * (a[i] - b[i]); }
+    return std::sqrt(d);
+}
+
+
 /**
- * @brief initialize and test camera stream.
+ * @brief one detection worker: preview search, then full resolution refinement.
+ */
+static void *detect_service(void *threadp) {
+    detect_worker_t         *w = (detect_worker_t *)threadp;
+    std::vector<cv::Point2f> corners;
+    detection_t              d;
+
+    while (1) {
+        sem_wait(&w->start);
+        if (abort_workers) { break; }
+
+        double start = now_msec();
+
+        cv::resize(w->gray, w->preview, cv::Size(), PREVIEW_SCALE, PREVIEW_SCALE, cv::INTER_AREA);
+        d.found = cv::findChessboardCorners(w->preview, board_size, corners,
+                                            cv::CALIB_CB_ADAPTIVE_THRESH | cv::CALIB_CB_NORMALIZE_IMAGE |
+                                                cv::CALIB_CB_FAST_CHECK);
+        if (d.found) {
+            for (size_t i = 0; i < corners.size(); i++) { corners[i] *= (float)(1.0 / PREVIEW_SCALE); }
+
+            // the preview is good to about a pixel at its scale, so the window
+            // has to cover that much at full resolution
+            int win = std::max(5, (int)std::ceil(2.0 / PREVIEW_SCALE) + 3);
+            cv::cornerSubPix(w->gray, corners, cv::Size(win, win), cv::Size(-1, -1),
+                             cv::TermCriteria(cv::TermCriteria::EPS + cv::TermCriteria::COUNT, 30, 0.01));
+            d.corners = corners;
+            board_pose(corners, w->gray.size(), d.pose);
+        }
+        d.msec = now_msec() - start;
+
+        pthread_mutex_lock(&result_lock);
+        if ((result_head + 1) % RESULT_SLOTS != result_tail) {
+            results[result_head] = d;
+            result_head          = (result_head + 1) % RESULT_SLOTS;
+        }
+        pthread_mutex_unlock(&result_lock);
+
+        w->busy = 0;
+    }
+
+    return NULL;
+}
+
+
+/**
+ * @brief keep a detected view if it adds diversity, replacing the most
+ * redundant view once MAX_VIEWS are kept.
  *
- * @param cam_stream VideoCapture object to tie it to the camera device.
- * @return true initialized and tested successfully.
- * @return false failed to initialize camera stream.
+ * @return true if the kept set changed.
  */
-static bool init_camera_stream(cv::VideoCapture &cam_stream) {
-
-    cv::Mat temp_frame;
-    bool    ok = false;
-
-#if USE_GSTREAMER
-    // initialize video stream from a CSI camera device
-    std::string pipeline =
-        gstreamer_pipeline(CAPTURE_WIDTH, CAPTURE_HEIGHT, DISPLAY_WIDTH, DISPLAY_HEIGHT,
-                           FRAMERATE, FLIP_MODE);
-
-    cam_stream.open(pipeline, cv::CAP_GSTREAMER);
-#else
-    // initialize video stream from a USB camera device
-    cam_stream.open(0);
-#endif /* USE_GSTREAMER */
-
-    // ensure stream is open, and grab one frame to make sure it's not empty
-    if (cam_stream.isOpened()) {
-        cam_stream >> temp_frame;
-        if (!temp_frame.empty()) { ok = true; }
-    } else {
-        ok = false;
+static bool select_view(const detection_t &d) {
+    std::array<double, 4> pose = {d.pose[0], d.pose[1], d.pose[2], d.pose[3]};
+    double                nearest = 1e9;
+    size_t                n = calib.poses.size();
+
+    for (size_t i = 0; i < n; i++) { nearest = std::min(nearest, pose_distance(pose.data(), calib.poses[i].data())); }
+    if (nearest < MIN_VIEW_DISTANCE) { return false; }
+
+    if (n < MAX_VIEWS) {
+        calib.image_points.push_back(d.corners);
+        calib.poses.push_back(pose);
+        return true;
     }
 
-    // handle error if any
-    // if (!ok) { handle_error(error_failed_cam_init); }
+    // the kept view closest to another kept view is the one worth least
+    size_t worst = 0;
+    double worst_d = 1e9;
+    for (size_t i = 0; i < n; i++) {
+        double own = 1e9;
+        for (size_t j = 0; j < n; j++) {
+            if (i != j) { own = std::min(own, pose_distance(calib.poses[i].data(), calib.poses[j].data())); }
+        }
+        if (own < worst_d) {
+            worst_d = own;
+            worst   = i;
+        }
+    }
+    if (nearest <= worst_d) { return false; }
 
-    return ok;
+    calib.image_points[worst] = d.corners;
+    calib.poses[worst]        = pose;
+    return true;
 }
 
-int main(void) {
+
+/**
+ * @brief re-run calibrateCamera whenever the kept views change.
+ */
+static void *calibrate_service(void *threadp) {
+    std::vector<std::vector<cv::Point2f>> image_points;
+    std::vector<std::vector<cv::Point3f>> object_points;
+    std::vector<cv::Mat>                  rvecs, tvecs;
+    cv::Mat                               K, dist;
+    int                                   flags;
+
+    while (1) {
+        pthread_mutex_lock(&calib.lock);
+        while (!calib.dirty && !calib.stop) { pthread_cond_wait(&calib.changed, &calib.lock); }
+        if (calib.stop && !calib.dirty) {
+            pthread_mutex_unlock(&calib.lock);
+            break;
+        }
+        image_points = calib.image_points;
+        calib.dirty  = false;
+        flags        = 0;
+        if (calib.valid) {
+            calib.camera_matrix.copyTo(K);
+            calib.dist_coeffs.copyTo(dist);
+            flags = cv::CALIB_USE_INTRINSIC_GUESS;
+        }
+        pthread_mutex_unlock(&calib.lock);
+
+        object_points.assign(image_points.size(), calib.board);
+
+        double start = now_msec();
+        double rms   = cv::calibrateCamera(object_points, image_points, calib.image_size, K, dist, rvecs, tvecs,
+                                           flags,
+                                           cv::TermCriteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS,
+                                                            flags ? 10 : 30, DBL_EPSILON));
+        double msec = now_msec() - start;
+
+        pthread_mutex_lock(&calib.lock);
+        K.copyTo(calib.camera_matrix);
+        dist.copyTo(calib.dist_coeffs);
+        calib.rms       = rms;
+        calib.last_msec = msec;
+        calib.valid     = true;
+        calib.runs++;
+        pthread_mutex_unlock(&calib.lock);
+
+        printf("calibration %u: %zu views, rms %.3f px, %.1f msec%s\n", calib.runs, image_points.size(), rms,
+               msec, flags ? " (from previous)" : "");
+    }
+
+    return NULL;
+}
+
+
+static void save_calibration(const std::string &name) {
+    pthread_mutex_lock(&calib.lock);
+    if (calib.valid) {
+        cv::FileStorage fs(name, cv::FileStorage::WRITE);
+        fs << "image_width" << calib.image_size.width;
+        fs << "image_height" << calib.image_size.height;
+        fs << "board_width" << board_size.width;
+        fs << "board_height" << board_size.height;
+        fs << "views" << (int)calib.image_points.size();
+        fs << "rms" << calib.rms;
+        fs << "camera_matrix" << calib.camera_matrix;
+        fs << "distortion_coefficients" << calib.dist_coeffs;
+        printf("saved %s\n", name.c_str());
+    }
+    pthread_mutex_unlock(&calib.lock);
+}
+
+
+/**
+ * @brief entry point.
+ *
+ * usage: calibrate_camera_pov [argus|v4l2-mjpeg|v4l2-raw|v4l2|test]
+ *                             [--cols=9] [--rows=6] [--square=25] [--workers=2]
+ *                             [--out=camera_calibration.yml]
+ *
+ * @return int
+ */
+int main(int argc, char *argv[]) {
     cv::Mat      src_frame; // source frames
+    cv::Mat      gray, shown, map1, map2;
     long double  t_i;
     long double  t_f;
-    unsigned int frames_counter = 0;
-    int          user_input     = 0;
+    unsigned int frames_counter = 0, frames_total = 0;
+    unsigned int handed = 0, found = 0, kept = 0;
+    unsigned int calib_seen = 0;
+    double       detect_msec = 0.0, worst_msec = 0.0;
+    int          user_input = 0;
+    bool         undistort = false;
+    std::vector<cv::Point2f> last_corners;
+
+    cv::CommandLineParser parser(argc, argv,
+                                 "{help h ||}"
+                                 "{@source | auto | capture source name}"
+                                 "{cols | 9 | inner corners per board row}"
+                                 "{rows | 6 | inner corners per board column}"
+                                 "{square | 25 | square size, in the units wanted for the calibration}"
+                                 "{workers | 2 | detection threads}"
+                                 "{out | camera_calibration.yml | calibration output}");
+    if (parser.has("help")) {
+        parser.printMessage();
+        return 0;
+    }
+    board_size  = cv::Size(parser.get<int>("cols"), parser.get<int>("rows"));
+    num_workers = std::min(MAX_WORKERS, std::max(1, parser.get<int>("workers")));
+    std::string out = parser.get<std::string>("out");
 
     // init camera
     std::cout << "initializing...";
     cv::VideoCapture cam_stream;
-    if (!init_camera_stream(cam_stream)) {
+    if (!capture_source_start(cam_stream, parser.get<std::string>("@source"),
+                              CAPTURE_WIDTH, CAPTURE_HEIGHT, FRAMERATE, FLIP_MODE, NULL)) {
         std::cerr << "[FAILED]" << std::endl;
         exit(-1);
     }
@@ -131,15 +379,37 @@ int main(void) {
     // test camera
     std::cout << "[OK]" << std::endl;
 
+    // board corners in board coordinates, the same for every view
+    for (int y = 0; y < board_size.height; y++) {
+        for (int x = 0; x < board_size.width; x++) {
+            calib.board.push_back(cv::Point3f(x * parser.get<float>("square"), y * parser.get<float>("square"), 0));
+        }
+    }
+    calib.valid = calib.dirty = calib.stop = false;
+    calib.runs  = 0;
+    pthread_mutex_init(&calib.lock, NULL);
+    pthread_cond_init(&calib.changed, NULL);
+    pthread_create(&calib.thread, NULL, calibrate_service, NULL);
+
+    for (int i = 0; i < num_workers; i++) {
+        workers[i].idx  = i;
+        workers[i].busy = 0;
+        sem_init(&workers[i].start, 0, 0);
+        pthread_create(&workers[i].thread, NULL, detect_service, &workers[i]);
+    }
+
     // create a window to display our video
     cv::namedWindow(WIN_TITLE);
 
     t_i = std::stold(get_time_ns("."));
 
-    while (user_input != ESC_ASCII) {
+    while (user_input != ESC_ASCII && frames_total < NUM_OF_FRAMES) {
 
         // capture frame from stream
         cam_stream >> src_frame;
+        if (src_frame.empty()) { break; }
+        frames_total++;
+        calib.image_size = src_frame.size();
 
         t_f = std::stold(get_time_ns("."));
 
@@ -149,19 +419,100 @@ int main(void) {
         } else {
             // @TODO: find a better way too show FPS instead of spamming stdout
             std::cout << "fps=" << frames_counter << "(over " << t_f - t_i << " s)"
-                      << std::endl;
+                      << ", handed " << handed << ", found " << found << ", kept " << kept
+                      << ", detect " << (handed ? detect_msec / handed : 0.0) << " msec" << std::endl;
             frames_counter = 0;
             t_i            = t_f;
         }
 
+        // hand the frame to an idle worker, if there is one
+        for (int i = 0; i < num_workers; i++) {
+            if (!workers[i].busy) {
+                cv::cvtColor(src_frame, workers[i].gray, cv::COLOR_BGR2GRAY);
+                workers[i].busy = 1;
+                sem_post(&workers[i].start);
+                handed++;
+                break;
+            }
+        }
+
+        // collect finished detections
+        pthread_mutex_lock(&result_lock);
+        while (result_tail != result_head) {
+            detection_t &d = results[result_tail];
+
+            detect_msec += d.msec;
+            worst_msec = std::max(worst_msec, d.msec);
+            if (d.found) {
+                found++;
+                last_corners = d.corners;
+
+                pthread_mutex_lock(&calib.lock);
+                if (select_view(d)) {
+                    kept++;
+                    if (calib.image_points.size() >= MIN_VIEWS) {
+                        calib.dirty = true;
+                        pthread_cond_signal(&calib.changed);
+                    }
+                }
+                pthread_mutex_unlock(&calib.lock);
+            } else {
+                last_corners.clear();
+            }
+            result_tail = (result_tail + 1) % RESULT_SLOTS;
+        }
+        pthread_mutex_unlock(&result_lock);
+
+        // new calibration: rebuild the undistortion maps once, remap each frame
+        pthread_mutex_lock(&calib.lock);
+        if (calib.valid && calib.runs != calib_seen) {
+            cv::initUndistortRectifyMap(calib.camera_matrix, calib.dist_coeffs, cv::Mat(),
+                                        calib.camera_matrix, calib.image_size, CV_16SC2, map1, map2);
+            calib_seen = calib.runs;
+        }
+        pthread_mutex_unlock(&calib.lock);
+
+        if (undistort && !map1.empty()) {
+            cv::remap(src_frame, shown, map1, map2, cv::INTER_LINEAR);
+        } else {
+            shown = src_frame;
+            if (!last_corners.empty()) { cv::drawChessboardCorners(shown, board_size, last_corners, true); }
+        }
+
+        char status[128];
+        snprintf(status, sizeof(status), "views %zu/%d  rms %.3f  %s", calib.image_points.size(), MAX_VIEWS,
+                 calib.valid ? calib.rms : 0.0, undistort ? "undistorted" : "");
+        cv::putText(shown, status, cv::Point(20, 30), cv::FONT_HERSHEY_SIMPLEX, 0.8, cv::Scalar(0, 255, 0), 2);
+
         // show frame
-        cv::imshow(WIN_TITLE, src_frame);
+        cv::imshow(WIN_TITLE, shown);
 
         // check for user input
-        user_input = cv::waitKey(5);
+        user_input = cv::waitKey(1);
+        if (user_input == 'u') { undistort = !undistort; }
+        if (user_input == 's') { save_calibration(out); }
     }
 
-    // cleanup
+    // cleanup: finish the pending calibration, then stop everything
+    abort_workers = true;
+    for (int i = 0; i < num_workers; i++) {
+        sem_post(&workers[i].start);
+        pthread_join(workers[i].thread, NULL);
+        sem_destroy(&workers[i].start);
+    }
+
+    pthread_mutex_lock(&calib.lock);
+    calib.stop = true;
+    pthread_cond_signal(&calib.changed);
+    pthread_mutex_unlock(&calib.lock);
+    pthread_join(calib.thread, NULL);
+
+    printf("%u frames, %u handed to workers, %u boards found, %u views kept, %zu used\n", frames_total, handed,
+           found, kept, calib.image_points.size());
+    printf("detection %.1f msec average, %.1f worst; %u calibrations, last %.1f msec\n",
+           handed ? detect_msec / handed : 0.0, worst_msec, calib.runs, calib.last_msec);
+    save_calibration(out);
+
     cv::destroyWindow(WIN_TITLE);
     cam_stream.release();
-}
\ No newline at end of file
+}
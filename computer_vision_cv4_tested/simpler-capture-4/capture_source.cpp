@@ -0,0 +1,333 @@
+/**
+ * @file capture_source.cpp
+ * @brief Probe capture pipelines and keep the lowest-latency one open.
+ *
+ * See capture_source.h
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include <algorithm>
+
+#include <opencv2/core/core.hpp>
+
+#ifdef HAVE_GSTREAMER
+#include <gst/gst.h>
+#include <gst/app/gstappsink.h>
+#endif
+
+#include "capture_source.h"
+
+// appsink settings every GStreamer candidate ends with: newest frame only
+#define APPSINK_NAME   "capsrc_sink"
+#define APPSINK_LATEST "appsink name=" APPSINK_NAME " drop=true max-buffers=1 sync=false"
+
+// longest wait for one probe frame
+#define PROBE_TIMEOUT_MSEC (2000)
+
+static const char *source_names[CAPSRC_COUNT] = {
+    "argus", "v4l2-mjpeg", "v4l2-raw", "v4l2", "test"
+};
+
+
+static double now_msec(void) {
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return ((double)t.tv_sec * 1000.0) + ((double)t.tv_nsec / 1000000.0);
+}
+
+
+capture_source_config_t capture_source_default_config(void) {
+    capture_source_config_t cfg;
+
+    cfg.width        = 1280;
+    cfg.height       = 720;
+    cfg.framerate    = 60;
+    cfg.flip_method  = 0;
+    cfg.device       = "/dev/video0";
+    cfg.probe_frames = 30;
+
+    return cfg;
+}
+
+
+const char *capture_source_name(capture_source_kind_t kind) {
+    return (kind >= 0 && kind < CAPSRC_COUNT) ? source_names[kind] : "auto";
+}
+
+
+capture_source_kind_t capture_source_parse(const std::string &name) {
+    for (int k = 0; k < CAPSRC_COUNT; k++) {
+        if (name == source_names[k]) { return (capture_source_kind_t)k; }
+    }
+    return CAPSRC_AUTO;
+}
+
+
+std::string capture_source_pipeline(capture_source_kind_t kind, const capture_source_config_t &cfg) {
+    std::string size = "width=(int)" + std::to_string(cfg.width) + ", height=(int)" +
+                       std::to_string(cfg.height);
+    std::string rate = "framerate=(fraction)" + std::to_string(cfg.framerate) + "/1";
+
+    switch (kind) {
+    case CAPSRC_ARGUS:
+        // the original Jetson CSI pipeline from gstream_cap.cpp
+        return "nvarguscamerasrc ! video/x-raw(memory:NVMM), " + size + ", " + rate +
+               " ! nvvidconv flip-method=" + std::to_string(cfg.flip_method) +
+               " ! video/x-raw, " + size +
+               ", format=(string)BGRx ! videoconvert ! video/x-raw, format=(string)BGR ! " APPSINK_LATEST;
+
+    case CAPSRC_V4L2_MJPEG:
+        // USB cameras reach full rate at 720p only with MJPEG over USB 2.0
+        return "v4l2src device=" + cfg.device + " io-mode=2 ! image/jpeg, " + size + ", " + rate +
+               " ! jpegdec ! videoconvert ! video/x-raw, format=(string)BGR ! " APPSINK_LATEST;
+
+    case CAPSRC_V4L2_RAW:
+        return "v4l2src device=" + cfg.device + " io-mode=2 ! video/x-raw, format=(string)YUY2, " + size +
+               " ! videoconvert ! video/x-raw, format=(string)BGR ! " APPSINK_LATEST;
+
+    case CAPSRC_TEST:
+        return "videotestsrc is-live=true pattern=ball ! video/x-raw, " + size + ", " + rate +
+               " ! videoconvert ! video/x-raw, format=(string)BGR ! " APPSINK_LATEST;
+
+    default:
+        return "";
+    }
+}
+
+
+#ifdef HAVE_GSTREAMER
+/**
+ * @brief run a launch string and time frames straight off its appsink.
+ *
+ * Each sample's age is the pipeline clock when it is pulled minus its
+ * buffer's PTS as running time plus the pipeline base time, all on the
+ * pipeline clock, so nothing depends on how OpenCV reports position.
+ *
+ * @param latency  one entry per frame, msec.
+ * @param t_first  now_msec() when the first frame was pulled.
+ * @param t_last   and the last.
+ * @return true    if all frames arrived.
+ */
+static bool gst_measure(const std::string &launch, int frames, std::vector<double> &latency,
+                        double *t_first, double *t_last) {
+    GError     *err = NULL;
+    GstElement *pipeline, *sink;
+    bool        ok = true;
+
+    if (!gst_is_initialized()) { gst_init(NULL, NULL); }
+
+    pipeline = gst_parse_launch(launch.c_str(), &err);
+    if (err) {
+        g_error_free(err);
+        if (pipeline) { gst_object_unref(pipeline); }
+        return false;
+    }
+    if (!pipeline) { return false; }
+
+    sink = gst_bin_get_by_name(GST_BIN(pipeline), APPSINK_NAME);
+    if (!sink || gst_element_set_state(pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+        if (sink) { gst_object_unref(sink); }
+        gst_object_unref(pipeline);
+        return false;
+    }
+
+    for (int i = 0; i < frames; i++) {
+        GstSample *sample = gst_app_sink_try_pull_sample(GST_APP_SINK(sink),
+                                                         PROBE_TIMEOUT_MSEC * GST_MSECOND);
+        if (!sample) {
+            ok = false;
+            break;
+        }
+
+        GstClock    *clock = gst_element_get_clock(pipeline);
+        GstClockTime now   = clock ? gst_clock_get_time(clock) : GST_CLOCK_TIME_NONE;
+        GstBuffer   *buf   = gst_sample_get_buffer(sample);
+        GstClockTime pts   = buf ? GST_BUFFER_PTS(buf) : GST_CLOCK_TIME_NONE;
+        GstClockTime run   = GST_CLOCK_TIME_NONE;
+
+        if (GST_CLOCK_TIME_IS_VALID(pts)) {
+            run = gst_segment_to_running_time(gst_sample_get_segment(sample), GST_FORMAT_TIME, pts);
+        }
+
+        *t_last = now_msec();
+        if (i == 0) { *t_first = *t_last; }
+
+        // a source that doesn't stamp its buffers still works, its latency is just unknown
+        if (GST_CLOCK_TIME_IS_VALID(now) && GST_CLOCK_TIME_IS_VALID(run)) {
+            GstClockTimeDiff age = GST_CLOCK_DIFF(run + gst_element_get_base_time(pipeline), now);
+            latency.push_back((double)age / (double)GST_MSECOND);
+        }
+
+        if (clock) { gst_object_unref(clock); }
+        gst_sample_unref(sample);
+    }
+
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(sink);
+    gst_object_unref(pipeline);
+
+    return ok;
+}
+#endif
+
+
+capture_source_probe_t capture_source_probe(cv::VideoCapture &cap, capture_source_kind_t kind,
+                                            const capture_source_config_t &cfg) {
+    capture_source_probe_t probe;
+    std::vector<double>    latency;
+    cv::Mat                frame;
+    double                 t_open, t_first = 0.0, t_now = 0.0;
+    bool                   gstreamer = (kind != CAPSRC_V4L2);
+    bool                   measured  = false; // GStreamer already timed the burst
+
+    probe.kind             = kind;
+    probe.pipeline         = capture_source_pipeline(kind, cfg);
+    probe.ok               = false;
+    probe.open_msec        = 0.0;
+    probe.fps              = 0.0;
+    probe.latency_msec     = -1.0;
+    probe.latency_max_msec = -1.0;
+    probe.jitter_msec      = -1.0;
+
+    cap.release();
+
+    t_open = now_msec();
+
+    if (gstreamer) {
+#ifdef HAVE_GSTREAMER
+        if (!gst_measure(probe.pipeline, cfg.probe_frames, latency, &t_first, &t_now)) { return probe; }
+        measured = true;
+#endif
+        // the stream the caller keeps still goes through OpenCV
+        cap.open(probe.pipeline, cv::CAP_GSTREAMER);
+    } else {
+        cap.open(cfg.device, cv::CAP_V4L2);
+        if (cap.isOpened()) {
+            cap.set(cv::CAP_PROP_FOURCC, cv::VideoWriter::fourcc('M', 'J', 'P', 'G'));
+            cap.set(cv::CAP_PROP_FRAME_WIDTH, cfg.width);
+            cap.set(cv::CAP_PROP_FRAME_HEIGHT, cfg.height);
+            cap.set(cv::CAP_PROP_FPS, cfg.framerate);
+            cap.set(cv::CAP_PROP_BUFFERSIZE, 1);
+        }
+    }
+
+    if (!cap.isOpened()) { return probe; }
+
+    // one frame to confirm OpenCV gets the stream when GStreamer already
+    // timed it, otherwise the whole burst
+    for (int i = 0; i < (measured ? 1 : cfg.probe_frames); i++) {
+        if (!cap.read(frame) || frame.empty()) {
+            cap.release();
+            return probe;
+        }
+        if (measured) { continue; }
+
+        t_now = now_msec();
+        if (i == 0) { t_first = t_now; }
+
+        // the driver's CLOCK_MONOTONIC capture time, the same clock as now_msec()
+        if (!gstreamer) { latency.push_back(t_now - cap.get(cv::CAP_PROP_POS_MSEC)); }
+    }
+
+    probe.ok        = true;
+    probe.open_msec = t_first - t_open;
+    if (cfg.probe_frames > 1) {
+        probe.fps = (cfg.probe_frames - 1) * 1000.0 / (t_now - t_first);
+    }
+
+    if (!latency.empty()) {
+        std::sort(latency.begin(), latency.end());
+        probe.latency_msec     = latency[latency.size() / 2];
+        probe.latency_max_msec = latency.back();
+        probe.jitter_msec      = latency.back() - latency.front();
+    }
+
+    return probe;
+}
+
+
+// a known latency beats an unknown one, then the lower median wins
+static bool lower_latency(const capture_source_probe_t &a, const capture_source_probe_t &b) {
+    if ((a.latency_msec >= 0.0) != (b.latency_msec >= 0.0)) { return a.latency_msec >= 0.0; }
+    return a.latency_msec < b.latency_msec;
+}
+
+
+bool capture_source_open(cv::VideoCapture &cap, const capture_source_config_t &cfg,
+                         capture_source_kind_t want, capture_source_kind_t *chosen,
+                         std::vector<capture_source_probe_t> *report) {
+    std::vector<capture_source_probe_t> probes;
+    int                                 best = -1;
+
+    if (want != CAPSRC_AUTO) {
+        probes.push_back(capture_source_probe(cap, want, cfg));
+        if (probes[0].ok) { best = want; }
+    } else {
+        for (int k = 0; k < CAPSRC_COUNT; k++) {
+            cv::VideoCapture trial;
+            capture_source_probe_t p = capture_source_probe(trial, (capture_source_kind_t)k, cfg);
+            trial.release();
+            probes.push_back(p);
+
+            // the test pattern is only a stand-in when no camera works at all
+            if (!p.ok || (k == CAPSRC_TEST && best >= 0)) { continue; }
+            if (best < 0 || lower_latency(p, probes[best])) { best = k; }
+        }
+
+        // reopen the winner; the probe streams were closed so the device is free
+        if (best >= 0) {
+            probes[best] = capture_source_probe(cap, (capture_source_kind_t)best, cfg);
+            if (!probes[best].ok) { best = -1; }
+        }
+    }
+
+    if (report) { *report = probes; }
+    if (chosen && best >= 0) { *chosen = (capture_source_kind_t)best; }
+
+    return best >= 0;
+}
+
+
+void capture_source_print(const std::vector<capture_source_probe_t> &report) {
+    for (size_t i = 0; i < report.size(); i++) {
+        const capture_source_probe_t &p = report[i];
+
+        if (p.ok && p.latency_msec >= 0.0) {
+            printf("  %-10s  %6.1f fps, latency median %6.2f max %6.2f jitter %6.2f msec, first frame %7.1f msec\n",
+                   capture_source_name(p.kind), p.fps, p.latency_msec, p.latency_max_msec, p.jitter_msec,
+                   p.open_msec);
+        } else if (p.ok) {
+            printf("  %-10s  %6.1f fps, latency unknown, first frame %7.1f msec\n",
+                   capture_source_name(p.kind), p.fps, p.open_msec);
+        } else {
+            printf("  %-10s  not available\n", capture_source_name(p.kind));
+        }
+    }
+}
+
+
+bool capture_source_start(cv::VideoCapture &cap, const std::string &want, int width, int height,
+                          int framerate, int flip_method, capture_source_kind_t *chosen) {
+    capture_source_config_t             cfg = capture_source_default_config();
+    capture_source_kind_t               kind;
+    std::vector<capture_source_probe_t> report;
+    bool                                ok;
+
+    cfg.width       = width;
+    cfg.height      = height;
+    cfg.framerate   = framerate;
+    cfg.flip_method = flip_method;
+
+    ok = capture_source_open(cap, cfg, capture_source_parse(want), &kind, &report);
+
+    printf("\n");
+    capture_source_print(report);
+    if (ok) {
+        printf("using %s\n", capture_source_name(kind));
+        if (chosen) { *chosen = kind; }
+    }
+
+    return ok;
+}
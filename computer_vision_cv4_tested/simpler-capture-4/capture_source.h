@@ -0,0 +1,142 @@
+/**
+ * @file capture_source.h
+ * @brief Capture source selection shared by gstream_cap, calibrate_camera_pov and recorder.
+ *
+ * Instead of one hard-coded Jetson nvarguscamerasrc pipeline, each candidate
+ * source is opened in turn, a short burst of frames is read from it, and the
+ * one with the lowest measured capture-to-read latency is kept open.  The
+ * candidates, in probe order:
+ *
+ *   argus       - nvarguscamerasrc CSI camera (Jetson), nvvidconv to BGRx
+ *   v4l2-mjpeg  - v4l2src USB camera delivering MJPEG, jpegdec
+ *   v4l2-raw    - v4l2src USB camera delivering raw YUYV
+ *   v4l2        - OpenCV's own V4L2 backend, MJPG, one driver buffer
+ *                 (for OpenCV builds without GStreamer)
+ *   test        - videotestsrc, live, only used when no camera works
+ *
+ * Every GStreamer pipeline ends in "appsink drop=true max-buffers=1
+ * sync=false", so a slow consumer always gets the newest frame instead of
+ * working through a queue of stale ones.
+ *
+ * Latency is the age of each probe frame when the consumer gets it, read
+ * back to back so the consumer is always waiting, measured against the
+ * clock the frame was stamped on:
+ *
+ *   v4l2       read() return time minus CAP_PROP_POS_MSEC, which for
+ *              OpenCV's V4L2 backend is the driver's CLOCK_MONOTONIC
+ *              capture timestamp
+ *   GStreamer  the pipeline clock when the sample is pulled from the
+ *              appsink minus the buffer's PTS converted to running time
+ *              plus the pipeline base time, i.e. capture to appsink.
+ *              POS_MSEC can't be used here, OpenCV answers it with a
+ *              position query rather than from the buffer.  This needs
+ *              the GStreamer API, so it is only built with HAVE_GSTREAMER
+ *              (the Makefile sets it when pkg-config finds
+ *              gstreamer-app-1.0); without it, or for a source that
+ *              doesn't stamp its buffers, the candidate is opened and
+ *              timed but its latency is unknown, and it ranks after any
+ *              source whose latency is known.
+ *
+ * The source with the lowest median latency wins.  Jitter, the spread
+ * between the lowest and highest latency of the burst, is reported next to
+ * it but does not decide anything.
+ */
+
+#ifndef CAPTURE_SOURCE_H
+#define CAPTURE_SOURCE_H
+
+#include <string>
+#include <vector>
+
+#include <opencv2/videoio.hpp>
+
+typedef enum {
+    CAPSRC_ARGUS = 0,
+    CAPSRC_V4L2_MJPEG,
+    CAPSRC_V4L2_RAW,
+    CAPSRC_V4L2,
+    CAPSRC_TEST,
+    CAPSRC_COUNT,
+    CAPSRC_AUTO = CAPSRC_COUNT
+} capture_source_kind_t;
+
+typedef struct {
+    int         width;
+    int         height;
+    int         framerate;
+    int         flip_method;  // argus only, 90 deg steps
+    std::string device;       // v4l2 device node, e.g. /dev/video0
+    int         probe_frames; // frames read from each candidate
+} capture_source_config_t;
+
+typedef struct {
+    capture_source_kind_t kind;
+    std::string           pipeline;     // GStreamer launch string, empty for v4l2
+    bool                  ok;           // opened and delivered probe_frames frames
+    double                open_msec;    // open() until the first frame
+    double                fps;          // rate over the probe frames
+    double                latency_msec; // median capture-to-read latency, < 0 if unknown
+    double                latency_max_msec;
+    double                jitter_msec;  // highest minus lowest latency of the burst
+} capture_source_probe_t;
+
+/**
+ * @brief defaults: 1280x720 at 60 fps, /dev/video0, 30 probe frames.
+ */
+capture_source_config_t capture_source_default_config(void);
+
+/**
+ * @brief short name of a source kind ("argus", "v4l2-mjpeg", ...).
+ */
+const char *capture_source_name(capture_source_kind_t kind);
+
+/**
+ * @brief parse a short name back to a kind, CAPSRC_AUTO if not recognized.
+ */
+capture_source_kind_t capture_source_parse(const std::string &name);
+
+/**
+ * @brief GStreamer pipeline for a kind, empty string for CAPSRC_V4L2.
+ */
+std::string capture_source_pipeline(capture_source_kind_t kind, const capture_source_config_t &cfg);
+
+/**
+ * @brief open one kind of source and measure it over cfg.probe_frames frames.
+ *
+ * @param cap left open when the probe succeeds.
+ */
+capture_source_probe_t capture_source_probe(cv::VideoCapture &cap, capture_source_kind_t kind,
+                                            const capture_source_config_t &cfg);
+
+/**
+ * @brief open the lowest-latency working source, or only the requested one.
+ *
+ * @param cap      opened on success.
+ * @param want     CAPSRC_AUTO to probe everything, otherwise just that kind.
+ * @param chosen   kind that was opened.
+ * @param report   every probe result, printed by capture_source_print().
+ * @return true    if a source is open.
+ */
+bool capture_source_open(cv::VideoCapture &cap, const capture_source_config_t &cfg,
+                         capture_source_kind_t want, capture_source_kind_t *chosen,
+                         std::vector<capture_source_probe_t> *report);
+
+/**
+ * @brief one line per probe: kind, result, fps, latency and jitter.
+ */
+void capture_source_print(const std::vector<capture_source_probe_t> &report);
+
+/**
+ * @brief open a source at the given size and rate and print the probe report.
+ *
+ * What the capture programs call at startup: the default config with these
+ * settings, capture_source_open() on the source named by want ("auto" or a
+ * kind name), then the report and the kind that was opened.
+ *
+ * @param chosen kind that was opened, may be NULL.
+ * @return true  if a source is open.
+ */
+bool capture_source_start(cv::VideoCapture &cap, const std::string &want, int width, int height,
+                          int framerate, int flip_method, capture_source_kind_t *chosen);
+
+#endif /* CAPTURE_SOURCE_H */
@@ -1,44 +1,160 @@
 /*
  *
- *  Example by Sam Siewert 
+ *  Example by Sam Siewert
  *
- *  Updated 1/24/2022 for OpenCV 4.x for Jetson nano 2g 
+ *  Updated 1/24/2022 for OpenCV 4.x for Jetson nano 2g
+ *
+ *  Frames now come from netcapture's grabber thread, which keeps only the
+ *  newest decoded frame, so processing that is slower than the stream skips
+ *  frames instead of falling further and further behind.  Every
+ *  REPORT_FRAMES processed frames the capture-to-process latency is reported.
+ *
+ *  Usage: ipcapture [url or video file] [--work=msec] [--frames=N] [--nodisplay]
+ *
+ *  A video file is looped at its own frame rate as a stand-in camera.
+ *  --work adds a simulated processing time per frame.
  *
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <math.h>
+#include <time.h>
 #include <iostream>
+#include <vector>
+#include <algorithm>
 
 #include <opencv2/opencv.hpp>
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
 
+#include "netcapture.h"
+
 using namespace cv;
 using namespace std;
 
+#define REPORT_FRAMES (100)
+
+// how long to wait for a frame before saying so
+#define FRAME_TIMEOUT_MSEC (2000)
+
+
+static double now_msec(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return ((double)t.tv_sec * 1000.0) + ((double)t.tv_nsec / 1000000.0);
+}
+
+
+static double percentile(vector<double> &v, double p)
+{
+    size_t k = (size_t)(p * (v.size() - 1));
+
+    nth_element(v.begin(), v.begin() + k, v.end());
+    return v[k];
+}
+
+
+static void report(vector<double> &age, vector<double> &total, unsigned long skipped,
+                   unsigned long decoded, double seconds)
+{
+    printf("%zu frames, %.1f fps processed, %.1f fps decoded, %lu skipped | "
+           "age at take p50 %.1f p99 %.1f msec | capture to processed p50 %.1f p95 %.1f p99 %.1f max %.1f msec\n",
+           total.size(), total.size() / seconds, decoded / seconds, skipped,
+           percentile(age, 0.50), percentile(age, 0.99),
+           percentile(total, 0.50), percentile(total, 0.95), percentile(total, 0.99),
+           *max_element(total.begin(), total.end()));
+}
+
+
 int main( int argc, char** argv )
 {
-    cv::VideoCapture vcap;
+    netcapture_t nc;
     cv::Mat image;
+    vector<double> age, total;
+    double captured, taken, start, work_msec;
+    unsigned long skipped, skipped_window = 0, decoded_mark = 0, processed = 0, limit;
+    bool display;
+
+    CommandLineParser parser(argc, argv,
+        "{help h ||}"
+        // This works with a Microseven IP security camera
+        "{@source | rtsp://172.19.172.216/11 | stream URL, or a video file to loop}"
+        "{work | 0 | simulated processing time per frame, msec}"
+        "{frames | 0 | stop after this many processed frames, 0 for no limit}"
+        "{nodisplay | | no window}");
+
+    if(parser.has("help"))
+    {
+        parser.printMessage();
+        return 0;
+    }
 
-    // This works with a Microseven IP security camera
-    const std::string videoStreamAddress = "rtsp://172.19.172.216/11";
+    const std::string videoStreamAddress = parser.get<string>("@source");
+    work_msec = parser.get<double>("work");
+    limit = parser.get<unsigned long>("frames");
+    display = !parser.has("nodisplay");
 
     //open the video stream and make sure it's opened
-    if(!vcap.open(videoStreamAddress)) {
+    if(netcapture_start(&nc, videoStreamAddress) < 0) {
         std::cout << "Error opening video stream or file" << std::endl;
         return -1;
     }
+    if(nc.loop_file)
+        printf("looping %s at %.1f fps as a stand-in camera\n", videoStreamAddress.c_str(), nc.file_fps);
 
-    for(;;) 
+    age.reserve(REPORT_FRAMES);
+    total.reserve(REPORT_FRAMES);
+    start = now_msec();
+
+    for(;;)
     {
-        if(!vcap.read(image)) 
+        if(!netcapture_take(&nc, image, &captured, &skipped, FRAME_TIMEOUT_MSEC))
 	{
+            if(nc.eof) break;
             std::cout << "No frame" << std::endl;
-            cv::waitKey();
+            continue;
+        }
+        taken = now_msec();
+        skipped_window += skipped;
+
+        // stand-in for real work on the frame
+        if(work_msec > 0.0)
+        {
+            struct timespec ts = { (time_t)(work_msec / 1000.0), (long)(fmod(work_msec, 1000.0) * 1.0e6) };
+            nanosleep(&ts, NULL);
         }
 
-        cv::imshow("Output Window", image);
-        if(cv::waitKey(1) >= 0) break;
-    }   
+        if(display)
+        {
+            cv::imshow("Output Window", image);
+            if(cv::waitKey(1) >= 0) break;
+        }
+
+        age.push_back(taken - captured);
+        total.push_back(now_msec() - captured);
+        processed++;
+
+        if(total.size() == REPORT_FRAMES)
+        {
+            double now = now_msec();
+            report(age, total, skipped_window, nc.decoded - decoded_mark, (now - start) / 1000.0);
+            age.clear();
+            total.clear();
+            skipped_window = 0;
+            decoded_mark = nc.decoded;
+            start = now;
+        }
+
+        if(limit && processed >= limit) break;
+    }
+
+    netcapture_stop(&nc);
+
+    printf("%lu processed, %lu decoded, %lu never processed, %lu read errors, read %.2f msec/frame\n",
+           processed, nc.decoded, nc.overwritten, nc.read_errors,
+           nc.decoded ? nc.decode_msec / nc.decoded : 0.0);
+
+    return 0;
 };
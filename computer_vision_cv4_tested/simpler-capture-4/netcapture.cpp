@@ -0,0 +1,169 @@
+/**
+ * @file netcapture.cpp
+ * @brief Latest-wins network stream capture.
+ *
+ * See netcapture.h
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+
+#include "netcapture.h"
+
+// consecutive failed reads from a live stream before giving up
+#define MAX_READ_ERRORS (50)
+
+
+static double now_msec(void) {
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return ((double)t.tv_sec * 1000.0) + ((double)t.tv_nsec / 1000000.0);
+}
+
+
+static void *grabberService(void *threadp) {
+    netcapture_t   *nc = (netcapture_t *)threadp;
+    struct timespec next;
+    long            period_ns = 0;
+    int             errors = 0;
+
+    if (nc->loop_file) {
+        period_ns = (long)(1.0e9 / nc->file_fps);
+        clock_gettime(CLOCK_MONOTONIC, &next);
+    }
+
+    while (!nc->stop) {
+        double start = now_msec();
+
+        if (!nc->cap.read(nc->back) || nc->back.empty()) {
+            if (nc->loop_file) {
+                // rewind, the stand-in camera never ends
+                nc->cap.set(cv::CAP_PROP_POS_FRAMES, 0);
+                if (++errors < 2) { continue; }
+            } else if (++errors < MAX_READ_ERRORS) {
+                nc->read_errors++;
+                continue;
+            }
+
+            pthread_mutex_lock(&nc->lock);
+            nc->eof = true;
+            pthread_cond_broadcast(&nc->fresh);
+            pthread_mutex_unlock(&nc->lock);
+            break;
+        }
+        errors = 0;
+
+        double done = now_msec();
+        nc->decoded++;
+        nc->decode_msec += done - start;
+
+        // publish: the previous ready frame, if never taken, is lost here
+        pthread_mutex_lock(&nc->lock);
+        cv::swap(nc->back, nc->ready);
+        if (nc->ready_seq > nc->taken_seq) { nc->overwritten++; }
+        nc->ready_seq++;
+        nc->ready_msec = done;
+        pthread_cond_signal(&nc->fresh);
+        pthread_mutex_unlock(&nc->lock);
+
+        // a file decodes as fast as the CPU allows, pace it like a camera
+        if (nc->loop_file) {
+            next.tv_nsec += period_ns;
+            while (next.tv_nsec >= 1000000000L) {
+                next.tv_nsec -= 1000000000L;
+                next.tv_sec++;
+            }
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        }
+    }
+
+    return NULL;
+}
+
+
+int netcapture_start(netcapture_t *nc, const std::string &source) {
+    nc->source      = source;
+    nc->loop_file   = (source.find("://") == std::string::npos);
+    nc->ready_seq   = 0;
+    nc->taken_seq   = 0;
+    nc->ready_msec  = 0.0;
+    nc->stop        = false;
+    nc->eof         = false;
+    nc->decoded     = 0;
+    nc->overwritten = 0;
+    nc->read_errors = 0;
+    nc->decode_msec = 0.0;
+
+    // FFmpeg buffers RTSP generously by default; ask for low delay over TCP
+    // unless the user has set their own options
+    if (!nc->loop_file) {
+        setenv("OPENCV_FFMPEG_CAPTURE_OPTIONS", "rtsp_transport;tcp|fflags;nobuffer|flags;low_delay", 0);
+    }
+
+    if (!nc->cap.open(source)) { return -1; }
+
+    // honored by some backends, the grabber thread is what keeps it empty anyway
+    nc->cap.set(cv::CAP_PROP_BUFFERSIZE, 1);
+
+    nc->file_fps = nc->cap.get(cv::CAP_PROP_FPS);
+    if (nc->file_fps <= 0.0 || nc->file_fps > 240.0) { nc->file_fps = 30.0; }
+
+    pthread_mutex_init(&nc->lock, NULL);
+    pthread_cond_init(&nc->fresh, NULL);
+
+    if (pthread_create(&nc->thread, NULL, grabberService, nc) != 0) {
+        perror("pthread_create grabber");
+        nc->cap.release();
+        return -1;
+    }
+
+    return 0;
+}
+
+
+bool netcapture_take(netcapture_t *nc, cv::Mat &frame, double *captured, unsigned long *skipped,
+                     int timeout_msec) {
+    struct timespec deadline;
+    bool            got = false;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_msec / 1000;
+    deadline.tv_nsec += (long)(timeout_msec % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_nsec -= 1000000000L;
+        deadline.tv_sec++;
+    }
+
+    pthread_mutex_lock(&nc->lock);
+
+    while (nc->ready_seq == nc->taken_seq && !nc->eof) {
+        if (pthread_cond_timedwait(&nc->fresh, &nc->lock, &deadline) == ETIMEDOUT) { break; }
+    }
+
+    if (nc->ready_seq > nc->taken_seq) {
+        cv::swap(nc->ready, nc->front);
+        if (skipped) { *skipped = nc->ready_seq - nc->taken_seq - 1; }
+        if (captured) { *captured = nc->ready_msec; }
+        nc->taken_seq = nc->ready_seq;
+        got = true;
+    }
+
+    pthread_mutex_unlock(&nc->lock);
+
+    frame = nc->front;
+
+    return got;
+}
+
+
+void netcapture_stop(netcapture_t *nc) {
+    nc->stop = true;
+    pthread_join(nc->thread, NULL);
+
+    pthread_mutex_destroy(&nc->lock);
+    pthread_cond_destroy(&nc->fresh);
+    nc->cap.release();
+}
@@ -0,0 +1,77 @@
+/**
+ * @file netcapture.h
+ * @brief Network stream capture that always hands out the newest frame.
+ *
+ * Reading an RTSP stream with VideoCapture on the processing thread means
+ * every frame the processing is too slow for waits in the decoder's buffer,
+ * and the delay between the camera and what is processed grows without
+ * bound.  Here a grabber thread reads and decodes the stream at its own rate
+ * and publishes each frame into a single latest-wins slot.  The consumer
+ * takes whatever is newest; frames it never took are overwritten and
+ * counted, never queued.
+ *
+ * Three Mats are swapped, never copied: the grabber decodes into its back
+ * buffer, swaps it with the ready slot under the mutex, and the consumer
+ * swaps the ready slot with its front buffer when it takes a frame.
+ *
+ * A source that is not a URL (no "://") is treated as a stand-in camera: the
+ * file is looped forever and paced at its own frame rate.  For an actual
+ * network stream from a file, ffmpeg can serve one over HTTP:
+ *
+ *   ffmpeg -re -stream_loop -1 -i clip.mp4 -c copy -f mpegts -listen 1 http://127.0.0.1:8080
+ *   ./ipcapture http://127.0.0.1:8080
+ */
+
+#ifndef NETCAPTURE_H
+#define NETCAPTURE_H
+
+#include <pthread.h>
+#include <string>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/videoio.hpp>
+
+typedef struct {
+    cv::VideoCapture cap;
+    std::string      source;
+    bool             loop_file;
+    double           file_fps;
+
+    // back is the grabber's, ready is shared, front is the consumer's
+    cv::Mat          back, ready, front;
+    double           ready_msec;      // when ready finished decoding, CLOCK_MONOTONIC
+    unsigned long    ready_seq;       // 0 until the first frame
+    unsigned long    taken_seq;
+
+    pthread_mutex_t  lock;
+    pthread_cond_t   fresh;
+    pthread_t        thread;
+    volatile bool    stop;
+    volatile bool    eof;
+
+    // grabber statistics
+    unsigned long    decoded, overwritten, read_errors;
+    double           decode_msec;
+} netcapture_t;
+
+/**
+ * @brief open the source and start the grabber thread.
+ *
+ * @return 0 or -1 if the source could not be opened.
+ */
+int netcapture_start(netcapture_t *nc, const std::string &source);
+
+/**
+ * @brief take the newest frame not taken yet, waiting up to timeout_msec.
+ *
+ * @param frame        refers to the consumer's buffer until the next call.
+ * @param captured     when the frame finished decoding, msec CLOCK_MONOTONIC.
+ * @param skipped      frames overwritten since the previous take.
+ * @return true if a new frame was taken, false on timeout or end of stream.
+ */
+bool netcapture_take(netcapture_t *nc, cv::Mat &frame, double *captured, unsigned long *skipped,
+                     int timeout_msec);
+
+void netcapture_stop(netcapture_t *nc);
+
+#endif /* NETCAPTURE_H */
@@ -0,0 +1,364 @@
+/**
+ * @file recorder.cpp
+ * @brief Record or transcode video with encoding decoupled from capture.
+ *
+ * videowriter.cpp reads, processes and writes every frame on one thread, so
+ * whenever VideoWriter stalls (a slow keyframe, the disk flushing, a new file
+ * being created) capture stalls with it and a live camera loses frames.
+ *
+ * Here the capture loop only reads frames into a ring of preallocated slots,
+ * and an encoder thread drains the ring into VideoWriter:
+ *
+ *   capture --> [free slots] --> read into slot --> [filled slots] --> encoder
+ *      ^                                                                 |
+ *      +------------------------- slot returned <------------------------+
+ *
+ * From a live camera the capture loop never waits: when every slot is full
+ * the new frame is dropped and counted, so capture timing is unaffected by
+ * the encoder.  From a file nothing is dropped, the reader waits instead.
+ *
+ * The output rolls over to a new file every --segment minutes of capture
+ * time, so a long unattended recording is a series of bounded files and a
+ * crash loses at most one segment.
+ *
+ * Usage: recorder [source] [--out=prefix] [--segment=minutes] [--fourcc=MJPG]
+ *                 [--queue=slots] [--channel=R|G|B] [--frames=N]
+ *
+ *   source is a capture_source name (auto, argus, v4l2-mjpeg, v4l2-raw,
+ *   v4l2, test) or a video file to transcode.  Ctrl-C stops a live
+ *   recording cleanly.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/videoio.hpp>
+
+#include "capture_source.h"
+
+using namespace std;
+using namespace cv;
+
+// Capture and encoder stats every REPORT_SECONDS
+#define REPORT_SECONDS (10)
+
+// A write slower than this is counted as an encoder hiccup
+#define HICCUP_MSEC (100.0)
+
+#define MAX_QUEUE_SLOTS (256)
+
+typedef struct {
+    Mat          frame;     // allocated by the first read, then reused
+    double       captured;  // msec, CLOCK_MONOTONIC
+    unsigned int sequence;
+    bool         last;      // end of stream marker, frame is not written
+} RecordSlot_t;
+
+// Single producer (capture loop), single consumer (encoder thread) ring
+static RecordSlot_t recordQueue[MAX_QUEUE_SLOTS];
+static int          queueSlots = 32;
+static sem_t        slotsFree, slotsFilled;
+
+typedef struct {
+    string prefix;
+    string fourcc;
+    double fps;
+    Size   size;
+    double segmentMsec;
+    int    channel;         // -1 keeps all three, otherwise 0 B, 1 G, 2 R
+} RecordConfig_t;
+
+static RecordConfig_t config;
+
+// written by the encoder thread, read by the reports
+static volatile unsigned int framesWritten = 0, segments = 0, hiccups = 0;
+static volatile double encodeBusyMsec = 0.0, worstWriteMsec = 0.0;
+
+static volatile sig_atomic_t stop = 0;
+
+
+static void handle_sigint(int sig)
+{
+    stop = 1;
+}
+
+
+static double now_msec(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return ((double)t.tv_sec * 1000.0) + ((double)t.tv_nsec / 1000000.0);
+}
+
+
+// prefix_YYYYmmdd_HHMMSS_NNN.avi, wall clock time so segments sort by name
+static string segment_name(const string &prefix, unsigned int number)
+{
+    char      stamp[32];
+    time_t    t = time(NULL);
+    struct tm local;
+
+    localtime_r(&t, &local);
+    strftime(stamp, sizeof(stamp), "%Y%m%d_%H%M%S", &local);
+
+    snprintf(stamp + strlen(stamp), sizeof(stamp) - strlen(stamp), "_%03u", number);
+
+    return prefix + "_" + stamp + ".avi";
+}
+
+
+static bool open_segment(VideoWriter &writer, string &name)
+{
+    const char *f = config.fourcc.c_str();
+
+    name = segment_name(config.prefix, segments + 1);
+    writer.release();
+
+    return writer.open(name, VideoWriter::fourcc(f[0], f[1], f[2], f[3]), config.fps, config.size, true);
+}
+
+
+void *encoderService(void *threadp)
+{
+    VideoWriter  writer;
+    string       name;
+    Mat          keep;
+    Scalar       mask(255, 255, 255);
+    double       segmentStart = 0.0, start, elapsed;
+    unsigned int segmentFrames = 0;
+    int          tail = 0;
+    bool         failed = false;
+
+    if (config.channel >= 0) {
+        mask = Scalar(0, 0, 0);
+        mask[config.channel] = 255;
+    }
+
+    while (1) {
+        sem_wait(&slotsFilled);
+        RecordSlot_t &slot = recordQueue[tail];
+
+        if (slot.last) { break; }
+
+        // after a failed open keep draining until the marker, so capture can finish
+        if (failed) {
+            sem_post(&slotsFree);
+            tail = (tail + 1) % queueSlots;
+            continue;
+        }
+
+        // segments follow capture time, not how far behind the encoder is
+        if (!writer.isOpened() || slot.captured - segmentStart >= config.segmentMsec) {
+            if (writer.isOpened()) {
+                printf("segment %u: %s, %u frames\n", segments, name.c_str(), segmentFrames);
+            }
+            if (!open_segment(writer, name)) {
+                fprintf(stderr, "could not open %s for write\n", name.c_str());
+                failed = true;
+                stop   = 1;
+                sem_post(&slotsFree);
+                tail = (tail + 1) % queueSlots;
+                continue;
+            }
+            segments++;
+            segmentStart  = slot.captured;
+            segmentFrames = 0;
+        }
+
+        start = now_msec();
+
+        // videowriter's split/zero/merge is one masking pass
+        if (config.channel >= 0) {
+            bitwise_and(slot.frame, mask, keep);
+            writer.write(keep);
+        } else {
+            writer.write(slot.frame);
+        }
+
+        elapsed = now_msec() - start;
+        encodeBusyMsec += elapsed;
+        if (elapsed > worstWriteMsec) { worstWriteMsec = elapsed; }
+        if (elapsed > HICCUP_MSEC) { hiccups++; }
+
+        framesWritten++;
+        segmentFrames++;
+
+        sem_post(&slotsFree);
+        tail = (tail + 1) % queueSlots;
+    }
+
+    if (writer.isOpened()) {
+        printf("segment %u: %s, %u frames\n", segments, name.c_str(), segmentFrames);
+    }
+
+    return NULL;
+}
+
+
+static void report(const char *label, unsigned int captured, unsigned int dropped,
+                   double seconds, int maxDepth)
+{
+    printf("%s: %.1f s, captured %u (%.2f fps), written %u, dropped %u, "
+           "encode %.2f fps (%.2f msec/frame, worst %.1f, %u hiccups), queue peak %d/%d\n",
+           label, seconds, captured, captured / seconds, framesWritten, dropped,
+           encodeBusyMsec > 0.0 ? 1000.0 * framesWritten / encodeBusyMsec : 0.0,
+           framesWritten ? encodeBusyMsec / framesWritten : 0.0, worstWriteMsec, hiccups,
+           maxDepth, queueSlots);
+}
+
+
+int main(int argc, char *argv[])
+{
+    CommandLineParser parser(argc, argv,
+        "{help h ||}"
+        "{@source | auto | capture source name (auto, argus, v4l2-mjpeg, v4l2-raw, v4l2, test) or video file}"
+        "{out o | rec | output file prefix}"
+        "{segment | 10 | minutes per output file}"
+        "{fourcc | MJPG | output codec}"
+        "{queue | 32 | frame slots between capture and encoder}"
+        "{channel | | keep only the R, G or B channel}"
+        "{frames | 0 | stop after this many frames, 0 for no limit}");
+
+    if (parser.has("help")) {
+        parser.printMessage();
+        return 0;
+    }
+
+    string           source = parser.get<string>("@source");
+    VideoCapture     cap;
+    pthread_t        encoderThread;
+    bool             live;
+    unsigned int     limit = parser.get<unsigned int>("frames");
+    unsigned int     captured = 0, dropped = 0;
+    int              head = 0, depth, maxDepth = 0;
+    double           start, lastReport;
+    Mat              scratch;
+
+    config.prefix      = parser.get<string>("out");
+    config.fourcc      = parser.get<string>("fourcc");
+    config.segmentMsec = parser.get<double>("segment") * 60.0 * 1000.0;
+    config.channel     = -1;
+    if (parser.has("channel")) {
+        switch (parser.get<string>("channel")[0]) {
+        case 'R': config.channel = 2; break;
+        case 'G': config.channel = 1; break;
+        case 'B': config.channel = 0; break;
+        }
+    }
+    if (config.fourcc.size() != 4) {
+        cerr << "fourcc must be four characters" << endl;
+        return -1;
+    }
+
+    queueSlots = parser.get<int>("queue");
+    if (queueSlots < 2) { queueSlots = 2; }
+    if (queueSlots > MAX_QUEUE_SLOTS) { queueSlots = MAX_QUEUE_SLOTS; }
+
+    // a camera source name, otherwise a file to transcode
+    live = (source == "auto" || capture_source_parse(source) != CAPSRC_AUTO);
+    if (live) {
+        capture_source_config_t cfg = capture_source_default_config();
+
+        if (!capture_source_start(cap, source, cfg.width, cfg.height, cfg.framerate, cfg.flip_method, NULL)) {
+            cerr << "no capture source available" << endl;
+            return -1;
+        }
+        config.fps = cfg.framerate;
+    } else {
+        if (!cap.open(source)) {
+            cerr << "Could not open the input video: " << source << endl;
+            return -1;
+        }
+        config.fps = cap.get(CAP_PROP_FPS);
+    }
+    if (config.fps <= 0.0) { config.fps = 30.0; }
+
+    // the first frame fixes the output size
+    if (!cap.read(recordQueue[0].frame) || recordQueue[0].frame.empty()) {
+        cerr << "no frames from " << source << endl;
+        return -1;
+    }
+    config.size = recordQueue[0].frame.size();
+    recordQueue[0].captured = now_msec();
+    recordQueue[0].sequence = captured++;
+    recordQueue[0].last     = false;
+    head = 1;
+
+    printf("%dx%d at %.1f fps, %d slots, %.1f minute segments, %s\n", config.size.width,
+           config.size.height, config.fps, queueSlots, config.segmentMsec / 60000.0,
+           live ? "dropping frames when the encoder falls behind" : "no drops, reader waits for the encoder");
+
+    sem_init(&slotsFree, 0, queueSlots - 1);
+    sem_init(&slotsFilled, 0, 1);
+    if (pthread_create(&encoderThread, NULL, encoderService, NULL) != 0) {
+        perror("pthread_create encoder");
+        return -1;
+    }
+
+    signal(SIGINT, handle_sigint);
+    start = lastReport = now_msec();
+
+    while (!stop && (limit == 0 || captured < limit)) {
+        bool haveSlot;
+
+        if (live) {
+            haveSlot = (sem_trywait(&slotsFree) == 0);
+        } else {
+            sem_wait(&slotsFree);
+            haveSlot = true;
+        }
+
+        // a full queue still reads the frame, so the camera is drained at its rate
+        Mat &dst = haveSlot ? recordQueue[head].frame : scratch;
+        if (!cap.read(dst) || dst.empty()) {
+            if (haveSlot) { sem_post(&slotsFree); }
+            break;
+        }
+        captured++;
+
+        if (!haveSlot) {
+            dropped++;
+        } else {
+            recordQueue[head].captured = now_msec();
+            recordQueue[head].sequence = captured - 1;
+            recordQueue[head].last     = false;
+            head = (head + 1) % queueSlots;
+            sem_post(&slotsFilled);
+        }
+
+        sem_getvalue(&slotsFilled, &depth);
+        if (depth > maxDepth) { maxDepth = depth; }
+
+        if (now_msec() - lastReport >= REPORT_SECONDS * 1000.0) {
+            lastReport = now_msec();
+            report("recording", captured, dropped, (lastReport - start) / 1000.0, maxDepth);
+        }
+    }
+
+    // end of stream marker behind whatever is still queued
+    sem_wait(&slotsFree);
+    recordQueue[head].last = true;
+    sem_post(&slotsFilled);
+
+    cout << "capture finished, waiting for the encoder" << endl;
+    pthread_join(encoderThread, NULL);
+
+    report("total", captured, dropped, (now_msec() - start) / 1000.0, maxDepth);
+    printf("%u segments\n", segments);
+
+    sem_destroy(&slotsFree);
+    sem_destroy(&slotsFilled);
+    cap.release();
+
+    return 0;
+}
@@ -0,0 +1,341 @@
+/*
+ *  Separable, cache-blocked convolution, see sepconv.h
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sepconv.h"
+
+// L1 data cache size when sysconf doesn't know it
+#define DEFAULT_L1_BYTES (32 * 1024)
+
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
+static const char *kernel_names[SEP_KERNELS] = { "box3", "box5", "box7", "gauss3", "gauss5", "gauss7" };
+
+static const int kernel_radius[SEP_KERNELS] = { 1, 2, 3, 1, 2, 3 };
+
+// center weight first, then one side; the other side mirrors it
+static const int kernel_weights[SEP_KERNELS][SEP_MAX_RADIUS + 1] =
+{
+    { 1, 1, 0, 0 },
+    { 1, 1, 1, 0 },
+    { 1, 1, 1, 1 },
+    { 2, 1, 0, 0 },
+    { 6, 4, 1, 0 },
+    { 20, 15, 6, 1 }
+};
+
+
+static ALWAYS_INLINE unsigned clampi(int v, int hi)
+{
+    return v < 0 ? 0 : (v > hi ? hi : v);
+}
+
+
+// One tile: rows y0..y1-1 and pixels x0..x1-1 of out.  Everything after
+// tmp is a literal at every call site, so this is compiled once per kernel
+// and channel count with the taps unrolled and the divide by a constant.
+static ALWAYS_INLINE void sep_tile(const unsigned char *in, unsigned char *out,
+                                   unsigned width, unsigned height,
+                                   unsigned x0, unsigned x1, unsigned y0, unsigned y1,
+                                   uint16_t *tmp,
+                                   const int c, const int r,
+                                   const int w0, const int w1, const int w2, const int w3,
+                                   const int sum)
+{
+    const int w[SEP_MAX_RADIUS + 1] = { w0, w1, w2, w3 };
+    const size_t stride = (size_t)width * c;
+    const unsigned tw = x1 - x0, rows = (y1 - y0) + 2 * r;
+    const unsigned lim = width > (unsigned)r ? width - r : 0;
+    const unsigned xs = x0 > (unsigned)r ? x0 : (unsigned)r;          // first pixel with all taps inside
+    const unsigned xe = x1 < lim ? x1 : lim;                            // and one past the last
+    const size_t base = (size_t)x0 * c;
+    const uint32_t total = (uint32_t)sum * sum;
+    unsigned j, x, k;
+    size_t i;
+
+    // horizontal pass, tile_h + 2r input rows into tmp
+    for(j = 0; j < rows; j++)
+    {
+        const unsigned char *p = in + clampi((int)y0 - r + (int)j, height - 1) * stride;
+        uint16_t *t = tmp + (size_t)j * tw * c;
+
+        // pixels whose taps reach past the left or right edge repeat the edge pixel
+        for(x = x0; x < x1; x++)
+        {
+            if(x == xs && xs < xe)
+                x = xe;
+            if(x >= x1)
+                break;
+
+            for(k = 0; k < (unsigned)c; k++)
+            {
+                int m, v = w[0] * p[x * c + k];
+
+                for(m = 1; m <= r; m++)
+                    v += w[m] * (p[clampi((int)x - m, width - 1) * c + k] +
+                                 p[clampi((int)x + m, width - 1) * c + k]);
+                t[x * c + k - base] = v;
+            }
+        }
+
+        // the rest, straight line code over the row
+        for(i = (size_t)xs * c; i < (size_t)xe * c; i++)
+        {
+            uint16_t v = w0 * p[i] + w1 * (p[i-c] + p[i+c]);
+
+            if(r >= 2) v += w2 * (p[i-2*c] + p[i+2*c]);
+            if(r >= 3) v += w3 * (p[i-3*c] + p[i+3*c]);
+            t[i - base] = v;
+        }
+    }
+
+    // vertical pass, from tmp into the output rows
+    for(j = 0; j < y1 - y0; j++)
+    {
+        const uint16_t *t = tmp + (size_t)(j + r) * tw * c;
+        const size_t n = (size_t)tw * c;
+        unsigned char *o = out + (size_t)(y0 + j) * stride + (size_t)x0 * c;
+
+        for(i = 0; i < n; i++)
+        {
+            uint32_t v = w0 * t[i] + w1 * (t[i-n] + t[i+n]);
+
+            if(r >= 2) v += w2 * (t[i-2*n] + t[i+2*n]);
+            if(r >= 3) v += w3 * (t[i-3*n] + t[i+3*n]);
+            o[i] = (v + total / 2) / total;
+        }
+    }
+}
+
+
+// one tile function per kernel and channel count
+#define SEP_SPECIALIZE(NAME, R, W0, W1, W2, W3, SUM)                                            \
+static void tile_##NAME(const unsigned char *in, unsigned char *out, unsigned width,            \
+                        unsigned height, unsigned channels, unsigned x0, unsigned x1,           \
+                        unsigned y0, unsigned y1, uint16_t *tmp)                                \
+{                                                                                               \
+    if(channels == 3)                                                                           \
+        sep_tile(in, out, width, height, x0, x1, y0, y1, tmp, 3, R, W0, W1, W2, W3, SUM);       \
+    else                                                                                        \
+        sep_tile(in, out, width, height, x0, x1, y0, y1, tmp, 1, R, W0, W1, W2, W3, SUM);       \
+}
+
+SEP_SPECIALIZE(box3,   1, 1, 1, 0, 0, 3)
+SEP_SPECIALIZE(box5,   2, 1, 1, 1, 0, 5)
+SEP_SPECIALIZE(box7,   3, 1, 1, 1, 1, 7)
+SEP_SPECIALIZE(gauss3, 1, 2, 1, 0, 0, 4)
+SEP_SPECIALIZE(gauss5, 2, 6, 4, 1, 0, 16)
+SEP_SPECIALIZE(gauss7, 3, 20, 15, 6, 1, 64)
+
+typedef void (*tile_fn_t)(const unsigned char *, unsigned char *, unsigned, unsigned, unsigned,
+                          unsigned, unsigned, unsigned, unsigned, uint16_t *);
+
+static const tile_fn_t tile_fn[SEP_KERNELS] =
+{
+    tile_box3, tile_box5, tile_box7, tile_gauss3, tile_gauss5, tile_gauss7
+};
+
+
+// one band of rows of the current job, tile by tile
+static void run_band(struct sep_pool_t *pool, int idx)
+{
+    unsigned first = (unsigned)(((unsigned long)pool->height * idx) / pool->threads);
+    unsigned last = (unsigned)(((unsigned long)pool->height * (idx + 1)) / pool->threads);
+    tile_fn_t fn = tile_fn[pool->kernel];
+    uint16_t *tmp = pool->worker[idx].tmp;
+    unsigned y, x, y1, x1;
+
+    for(y = first; y < last; y = y1)
+    {
+        y1 = y + pool->job_tile_h < last ? y + pool->job_tile_h : last;
+
+        for(x = 0; x < pool->width; x = x1)
+        {
+            x1 = x + pool->job_tile_w < pool->width ? x + pool->job_tile_w : pool->width;
+            fn(pool->in, pool->out, pool->width, pool->height, pool->channels, x, x1, y, y1, tmp);
+        }
+    }
+}
+
+
+static void *workerService(void *threadp)
+{
+    struct sep_worker_t *w = (struct sep_worker_t *)threadp;
+    struct sep_pool_t *pool = w->pool;
+
+    for(;;)
+    {
+        sem_wait(&w->go);
+        if(pool->stop) break;
+
+        run_band(pool, w->idx);
+        sem_post(&pool->done);
+    }
+
+    return NULL;
+}
+
+
+int sep_pool_start(struct sep_pool_t *pool, int threads, unsigned tile_w, unsigned tile_h)
+{
+    long l1 = sysconf(_SC_LEVEL1_DCACHE_SIZE);
+    int i;
+
+    if(threads < 1 || threads > SEP_MAX_THREADS)
+        return -1;
+
+    pool->threads = threads;
+    pool->stop = 0;
+    pool->tile_w = tile_w;
+    pool->tile_h = tile_h;
+
+    // half of L1 for the sums, the rest for the input and output rows going by
+    pool->tile_bytes = (l1 > 0 ? (size_t)l1 : DEFAULT_L1_BYTES) / 2;
+
+    sem_init(&pool->done, 0, 0);
+
+    for(i = 0; i < threads; i++)
+    {
+        pool->worker[i].idx = i;
+        pool->worker[i].pool = pool;
+        pool->worker[i].tmp = NULL;
+        pool->worker[i].tmp_len = 0;
+    }
+
+    // worker 0 is the caller
+    for(i = 1; i < threads; i++)
+    {
+        sem_init(&pool->worker[i].go, 0, 0);
+
+        if(pthread_create(&pool->worker[i].thread, NULL, workerService, &pool->worker[i]) != 0)
+        {
+            perror("pthread_create");
+            sem_destroy(&pool->worker[i].go);
+            pool->threads = i;
+            sep_pool_stop(pool);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+int sep_run(struct sep_pool_t *pool, sep_kernel_t kernel,
+            const unsigned char *in, unsigned char *out,
+            unsigned width, unsigned height, unsigned channels)
+{
+    unsigned r = sep_kernel_radius(kernel), tw, th;
+    size_t need;
+    int i;
+
+    if(kernel >= SEP_KERNELS || (channels != 1 && channels != 3) || width == 0 || height == 0)
+        return -1;
+
+    th = pool->tile_h ? pool->tile_h : SEP_DEFAULT_TILE_H;
+    if(th > height) th = height;
+
+    if(pool->tile_w)
+        tw = pool->tile_w;
+    else
+    {
+        tw = (unsigned)(pool->tile_bytes / ((th + 2 * r) * channels * sizeof(uint16_t)));
+        tw = tw > 16 ? tw & ~15u : 16;
+    }
+    if(tw > width) tw = width;
+
+    // grow the workers' tile buffers if this job needs more
+    need = (size_t)(th + 2 * r) * tw * channels;
+    for(i = 0; i < pool->threads; i++)
+        if(pool->worker[i].tmp_len < need)
+        {
+            free(pool->worker[i].tmp);
+            if((pool->worker[i].tmp = malloc(need * sizeof(uint16_t))) == NULL)
+            {
+                pool->worker[i].tmp_len = 0;
+                return -1;
+            }
+            pool->worker[i].tmp_len = need;
+        }
+
+    pool->kernel = kernel;
+    pool->in = in;
+    pool->out = out;
+    pool->width = width;
+    pool->height = height;
+    pool->channels = channels;
+    pool->job_tile_w = tw;
+    pool->job_tile_h = th;
+
+    for(i = 1; i < pool->threads; i++)
+        sem_post(&pool->worker[i].go);
+
+    run_band(pool, 0);
+
+    for(i = 1; i < pool->threads; i++)
+        sem_wait(&pool->done);
+
+    return 0;
+}
+
+
+void sep_pool_stop(struct sep_pool_t *pool)
+{
+    int i;
+
+    pool->stop = 1;
+    for(i = 1; i < pool->threads; i++)
+    {
+        sem_post(&pool->worker[i].go);
+        pthread_join(pool->worker[i].thread, NULL);
+        sem_destroy(&pool->worker[i].go);
+    }
+    for(i = 0; i < pool->threads; i++)
+        free(pool->worker[i].tmp);
+    sem_destroy(&pool->done);
+}
+
+
+unsigned sep_kernel_radius(sep_kernel_t kernel)
+{
+    return kernel < SEP_KERNELS ? kernel_radius[kernel] : 0;
+}
+
+
+const char *sep_kernel_name(sep_kernel_t kernel)
+{
+    return kernel < SEP_KERNELS ? kernel_names[kernel] : "?";
+}
+
+
+int sep_kernel_parse(const char *name, sep_kernel_t *kernel)
+{
+    int k;
+
+    for(k = 0; k < SEP_KERNELS; k++)
+        if(strcmp(name, kernel_names[k]) == 0)
+        {
+            *kernel = (sep_kernel_t)k;
+            return 0;
+        }
+
+    return -1;
+}
+
+
+void sep_kernel_weights(sep_kernel_t kernel, int *weights, int *sum)
+{
+    int r = kernel_radius[kernel], m;
+
+    *sum = 0;
+    for(m = -r; m <= r; m++)
+    {
+        weights[m + r] = kernel_weights[kernel][m < 0 ? -m : m];
+        *sum += weights[m + r];
+    }
+}
@@ -0,0 +1,226 @@
+/*
+ *  Benchmark matrix for the separable convolution library
+ *
+ *  Usage: sepconv_bench [-t threads] [-n iterations] [-c 1|3] [-k kernel] [-s WxH]
+ *
+ *  For every kernel (box3 ... gauss7, or just -k), every resolution (VGA,
+ *  1080p and 4K, or just -s) and 1, 2, 4 ... up to -t threads, times a frame
+ *  tiled as sepconv sizes it by default and untiled (one tile per band,
+ *  i.e. a full-width intermediate), and reports msec per frame, Mpixel/s
+ *  and the speedup of tiling and of threads.
+ *
+ *  Before timing, each kernel's output is checked pixel for pixel against
+ *  a direct 2D convolution with the same edge handling and rounding.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sepconv.h"
+
+#define DEFAULT_ITERATIONS (10)
+#define CHECK_COLS (97)
+#define CHECK_ROWS (61)
+
+static const unsigned resolutions[][2] = { { 640, 480 }, { 1920, 1080 }, { 3840, 2160 } };
+
+#define RESOLUTIONS (sizeof(resolutions) / sizeof(resolutions[0]))
+
+
+static double now_msec(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return ((double)t.tv_sec * 1000.0) + ((double)t.tv_nsec / 1000000.0);
+}
+
+
+static unsigned clamp(int v, unsigned n)
+{
+    return v < 0 ? 0 : ((unsigned)v >= n ? n - 1 : (unsigned)v);
+}
+
+
+static void fill(unsigned char *buf, size_t bytes)
+{
+    size_t i;
+
+    for(i = 0; i < bytes; i++)
+        buf[i] = (unsigned char)rand();
+}
+
+
+// the (2r+1)^2 sum the separable passes stand in for, on an odd sized
+// image so the tiles and bands don't line up with anything
+static int check(sep_kernel_t kernel, unsigned channels, int threads)
+{
+    const unsigned width = CHECK_COLS, height = CHECK_ROWS;
+    int r = (int)sep_kernel_radius(kernel), w[2 * SEP_MAX_RADIUS + 1], sum;
+    size_t bytes = (size_t)width * height * channels;
+    unsigned char *in = malloc(bytes), *out = malloc(bytes);
+    struct sep_pool_t pool;
+    unsigned long bad = 0;
+    unsigned x, y, c, total;
+    int dx, dy;
+
+    if(!in || !out)
+        exit(-1);
+
+    sep_kernel_weights(kernel, w, &sum);
+    total = (unsigned)(sum * sum);
+    fill(in, bytes);
+
+    // tiles much smaller than the image, so the tile edges get exercised
+    if(sep_pool_start(&pool, threads, 13, 5) < 0 ||
+       sep_run(&pool, kernel, in, out, width, height, channels) < 0)
+        exit(-1);
+    sep_pool_stop(&pool);
+
+    for(y = 0; y < height; y++)
+        for(x = 0; x < width; x++)
+            for(c = 0; c < channels; c++)
+            {
+                unsigned s = 0;
+
+                for(dy = -r; dy <= r; dy++)
+                    for(dx = -r; dx <= r; dx++)
+                        s += w[dy + r] * w[dx + r] *
+                             in[((size_t)clamp((int)y + dy, height) * width + clamp((int)x + dx, width)) * channels + c];
+
+                if(out[((size_t)y * width + x) * channels + c] != (s + total / 2) / total)
+                    bad++;
+            }
+
+    free(in);
+    free(out);
+
+    if(bad)
+        printf("%s, %u channel(s): %lu samples differ from the direct 2D sum\n",
+               sep_kernel_name(kernel), channels, bad);
+    return bad ? -1 : 0;
+}
+
+
+// msec per frame
+static double bench_one(sep_kernel_t kernel, int threads, int tiled, const unsigned char *img,
+                        unsigned char *out, unsigned width, unsigned height, unsigned channels,
+                        int iterations)
+{
+    struct sep_pool_t pool;
+    double start, elapsed;
+    int it;
+
+    if(sep_pool_start(&pool, threads, tiled ? 0 : width, tiled ? 0 : height) < 0)
+        return -1.0;
+
+    // once untimed, to fault in the output and the tile buffers
+    if(sep_run(&pool, kernel, img, out, width, height, channels) < 0)
+    {
+        sep_pool_stop(&pool);
+        return -1.0;
+    }
+
+    start = now_msec();
+    for(it = 0; it < iterations; it++)
+        sep_run(&pool, kernel, img, out, width, height, channels);
+    elapsed = (now_msec() - start) / iterations;
+
+    sep_pool_stop(&pool);
+
+    return elapsed;
+}
+
+
+static void bench(sep_kernel_t kernel, unsigned width, unsigned height, unsigned channels,
+                  int max_threads, int iterations)
+{
+    size_t bytes = (size_t)width * height * channels;
+    unsigned char *img = malloc(bytes), *out = malloc(bytes);
+    double one_msec = 0.0, tiled, untiled;
+    int threads;
+
+    if(!img || !out)
+        exit(-1);
+    fill(img, bytes);
+
+    printf("%s %ux%u, %u channel(s), %d iterations\n", sep_kernel_name(kernel), width, height,
+           channels, iterations);
+
+    for(threads = 1; ; threads = threads * 2 < max_threads ? threads * 2 : max_threads)
+    {
+        untiled = bench_one(kernel, threads, 0, img, out, width, height, channels, iterations);
+        tiled = bench_one(kernel, threads, 1, img, out, width, height, channels, iterations);
+        if(threads == 1) one_msec = tiled;
+
+        printf("  %2d thread(s)  untiled %9.3f msec  tiled %9.3f msec %8.1f Mpixel/s  "
+               "tiling %5.2fx  threads %5.2fx\n",
+               threads, untiled, tiled, (double)width * height / 1.0e3 / tiled,
+               untiled / tiled, one_msec / tiled);
+
+        if(threads >= max_threads) break;
+    }
+
+    free(img);
+    free(out);
+}
+
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-t threads] [-n iterations] [-c 1|3] [-k kernel] [-s WxH]\n", prog);
+    exit(-1);
+}
+
+
+int main(int argc, char *argv[])
+{
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN), iterations = DEFAULT_ITERATIONS, opt;
+    int only_kernel = 0, failed = 0;
+    sep_kernel_t kernel = SEP_BOX3;
+    unsigned channels = 3, cols = 0, rows = 0, res;
+    int k;
+
+    while((opt = getopt(argc, argv, "t:n:c:k:s:h")) != -1)
+    {
+        switch(opt)
+        {
+            case 't': threads = atoi(optarg); break;
+            case 'n': iterations = atoi(optarg); break;
+            case 'c': channels = (unsigned)atoi(optarg); break;
+            case 'k': if(sep_kernel_parse(optarg, &kernel) < 0) usage(argv[0]); only_kernel = 1; break;
+            case 's': if(sscanf(optarg, "%ux%u", &cols, &rows) != 2) usage(argv[0]); break;
+            default:  usage(argv[0]);
+        }
+    }
+    if(iterations < 1 || (channels != 1 && channels != 3))
+        usage(argv[0]);
+
+    if(threads < 1) threads = 1;
+    if(threads > SEP_MAX_THREADS) threads = SEP_MAX_THREADS;
+
+    for(k = 0; k < SEP_KERNELS; k++)
+    {
+        failed |= check((sep_kernel_t)k, 1, threads) < 0;
+        failed |= check((sep_kernel_t)k, 3, threads) < 0;
+    }
+    printf("all kernels %s the direct 2D sum\n\n", failed ? "do NOT match" : "match");
+    if(failed)
+        return -1;
+
+    for(k = 0; k < SEP_KERNELS; k++)
+    {
+        if(only_kernel && (sep_kernel_t)k != kernel)
+            continue;
+
+        if(cols && rows)
+            bench((sep_kernel_t)k, cols, rows, channels, threads, iterations);
+        else
+            for(res = 0; res < RESOLUTIONS; res++)
+                bench((sep_kernel_t)k, resolutions[res][0], resolutions[res][1], channels, threads, iterations);
+    }
+
+    return 0;
+}
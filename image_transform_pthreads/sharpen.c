@@ -0,0 +1,378 @@
+/*
+ *  Sharpen, blur or edge-detect a PPM or PGM image with the xform engine
+ *
+ *  Usage: sharpen [-k sharpen|blur|edge] [-t threads] [-u] [-o output.ppm]
+ *                 [-B [-n iterations] [-s WxH]] [-v reference.ppm]
+ *                 [-C cactus-reference.ppm] image.ppm
+ *
+ *  Default is the sharpen kernel on one thread per core, workers pinned,
+ *  written to transformed.ppm.  -u leaves the workers unpinned.
+ *
+ *  -B times the kernel at 1, 2, 4 ... up to -t threads on the image and on
+ *  a synthetic WxH frame (3840x2160 unless -s says otherwise) and reports
+ *  the speedup over one thread.
+ *
+ *  -v checks the engine's output for the -k kernel against a reference PPM
+ *  or PGM of the same size, byte for byte, and passes only if every sample
+ *  is identical.
+ *
+ *  -C is a looser check made for one file only, the course's sharpen
+ *  reference, whose header and pixels don't line up with its input:
+ *
+ *      sharpen -C Cactus-120kpixel-sharpen.ppm Cactus-120kpixel.ppm
+ *
+ *  See cactus_compare() for how that reference was made and what is
+ *  tolerated.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "xform.h"
+#include "../pnmio/pnmio.h"
+
+#define DEFAULT_ITERATIONS (20)
+#define DEFAULT_SYNTH_COLS (3840)
+#define DEFAULT_SYNTH_ROWS (2160)
+
+// The Cactus reference sharpen output was made by a program that skipped a fixed
+// 21-byte header, written for a shorter comment than this file's, and read
+// the 400x300 pixels from there on; it then wrote those 21 bytes and its
+// 360000 bytes of result.  That is why the reference is 17 bytes shorter
+// than the input.
+#define REFERENCE_HEADER_BYTES (21)
+
+
+static double now_msec(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return ((double)t.tv_sec * 1000.0) + ((double)t.tv_nsec / 1000000.0);
+}
+
+
+static unsigned char *map_file(const char *file, size_t *len)
+{
+    struct stat st;
+    void *map;
+    int fd;
+
+    if((fd = open(file, O_RDONLY)) < 0)
+    {
+        perror(file);
+        return NULL;
+    }
+
+    if(fstat(fd, &st) < 0 || st.st_size == 0)
+    {
+        fprintf(stderr, "%s: empty or unreadable\n", file);
+        close(fd);
+        return NULL;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+    {
+        perror("mmap");
+        return NULL;
+    }
+
+    *len = st.st_size;
+    return (unsigned char *)map;
+}
+
+
+// Run the engine on the same bytes the Cactus reference program read and
+// compare.
+//
+// Besides being misaligned, the reference is not a clean sharpen: its
+// threads left some pixels unsharpened (a whole row at a band boundary and
+// a few pixels at the end of every row), and in its lower bands the left
+// and right columns were sharpened with neighbors wrapped from the adjacent
+// rows.  So every interior pixel of the reference must either be exactly
+// the engine's result or be the untouched input, and both kinds are
+// counted; border pixels are only counted.  Passes when no interior pixel
+// is anything else.
+static int cactus_compare(struct xform_pool_t *pool, const char *input, const char *reference,
+                          const unsigned char *in, size_t in_len, const unsigned char *ref, size_t ref_len)
+{
+    struct pnm_image_t hdr;
+    unsigned char *out;
+    const unsigned char *src, *res;
+    size_t bytes, p;
+    unsigned long match = 0, unsharpened = 0, differ = 0, border_same = 0, border_differ = 0;
+    unsigned x, y, c;
+    int header_ok;
+
+    if(pnm_parse(&hdr, in, in_len) < 0)
+    {
+        fprintf(stderr, "%s: not an 8-bit binary PGM or PPM\n", input);
+        return -1;
+    }
+
+    bytes = hdr.bytes;
+    if(in_len < REFERENCE_HEADER_BYTES + bytes || ref_len != REFERENCE_HEADER_BYTES + bytes)
+    {
+        fprintf(stderr, "%s is %zu bytes, expected %zu for a %ux%u reference\n",
+                reference, ref_len, REFERENCE_HEADER_BYTES + bytes, hdr.width, hdr.height);
+        return -1;
+    }
+
+    src = in + REFERENCE_HEADER_BYTES;
+    res = ref + REFERENCE_HEADER_BYTES;
+    if((out = malloc(bytes)) == NULL)
+        return -1;
+
+    xform_run(pool, XFORM_SHARPEN, src, out, hdr.width, hdr.height, hdr.channels);
+
+    header_ok = memcmp(in, ref, REFERENCE_HEADER_BYTES) == 0;
+
+    for(y = 0; y < hdr.height; y++)
+        for(x = 0; x < hdr.width; x++)
+        {
+            int same = 1, engine = 1;
+
+            p = ((size_t)y * hdr.width + x) * hdr.channels;
+            for(c = 0; c < hdr.channels; c++)
+            {
+                same &= res[p+c] == src[p+c];
+                engine &= res[p+c] == out[p+c];
+            }
+
+            if(x == 0 || y == 0 || x == hdr.width - 1 || y == hdr.height - 1)
+            {
+                if(same) border_same++; else border_differ++;
+            }
+            else if(engine) match++;
+            else if(same) unsharpened++;
+            else differ++;
+        }
+
+    printf("%s vs %s: header %s\n", reference, input, header_ok ? "ok" : "DIFFERS");
+    printf("  interior: %lu pixels identical to the engine, %lu left unsharpened in the reference, %lu differ\n",
+           match, unsharpened, differ);
+    printf("  border: %lu copied as the engine does, %lu sharpened with wrapped neighbors\n",
+           border_same, border_differ);
+    printf("  %s\n", (header_ok && differ == 0) ? "PASS" : "FAIL");
+
+    free(out);
+
+    return (header_ok && differ == 0) ? 0 : -1;
+}
+
+
+// map both files, compare, and unmap whatever was mapped on every path
+static int cactus_check(struct xform_pool_t *pool, const char *input, const char *reference)
+{
+    unsigned char *in, *ref = NULL;
+    size_t in_len, ref_len;
+    int rc = -1;
+
+    if((in = map_file(input, &in_len)) != NULL && (ref = map_file(reference, &ref_len)) != NULL)
+        rc = cactus_compare(pool, input, reference, in, in_len, ref, ref_len);
+
+    if(in) munmap(in, in_len);
+    if(ref) munmap(ref, ref_len);
+
+    return rc;
+}
+
+
+// Exact check: both files through the pnmio reader, same format and size,
+// and every output sample equal to the reference's
+static int verify(struct xform_pool_t *pool, xform_kernel_t kernel, const char *input, const char *reference)
+{
+    struct pnm_image_t img, ref;
+    unsigned char *out = NULL;
+    unsigned long differ = 0;
+    size_t i, first = 0;
+    int rc = -1;
+
+    if(pnm_map(&img, input) < 0)
+        return -1;
+    if(pnm_map(&ref, reference) < 0)
+    {
+        pnm_unmap(&img);
+        return -1;
+    }
+
+    if(ref.format != img.format || ref.width != img.width || ref.height != img.height)
+        fprintf(stderr, "%s is a %ux%u P%d, %s is a %ux%u P%d\n", reference, ref.width, ref.height,
+                ref.format, input, img.width, img.height, img.format);
+    else if((out = malloc(img.bytes)) != NULL)
+    {
+        xform_run(pool, kernel, img.pixels, out, img.width, img.height, img.channels);
+
+        for(i = 0; i < img.bytes; i++)
+            if(out[i] != ref.pixels[i] && differ++ == 0)
+                first = i;
+
+        printf("%s vs %s %s: %lu of %zu samples differ\n", reference, input,
+               xform_kernel_name(kernel), differ, img.bytes);
+        if(differ)
+            printf("  first at x=%zu y=%zu: engine %u, reference %u\n",
+                   (first / img.channels) % img.width, first / img.channels / img.width,
+                   out[first], ref.pixels[first]);
+        printf("  %s\n", differ ? "FAIL" : "PASS");
+
+        rc = differ ? -1 : 0;
+    }
+
+    free(out);
+    pnm_unmap(&img);
+    pnm_unmap(&ref);
+
+    return rc;
+}
+
+
+// msec per frame for one thread count
+static double bench_one(xform_kernel_t kernel, int threads, int pin, const unsigned char *img, unsigned char *out,
+                        unsigned width, unsigned height, unsigned channels, int iterations)
+{
+    struct xform_pool_t pool;
+    double start, elapsed;
+    int it;
+
+    if(xform_pool_start(&pool, threads, pin) < 0)
+        return -1.0;
+
+    // once untimed, to fault in the output and start the workers
+    xform_run(&pool, kernel, img, out, width, height, channels);
+
+    start = now_msec();
+    for(it = 0; it < iterations; it++)
+        xform_run(&pool, kernel, img, out, width, height, channels);
+    elapsed = (now_msec() - start) / iterations;
+
+    xform_pool_stop(&pool);
+
+    return elapsed;
+}
+
+
+static void bench(xform_kernel_t kernel, const char *name, const unsigned char *img,
+                  unsigned width, unsigned height, unsigned channels,
+                  int max_threads, int pin, int iterations)
+{
+    size_t bytes = (size_t)width * height * channels;
+    unsigned char *out = malloc(bytes);
+    double one_msec = 0.0, msec;
+    int threads;
+
+    if(!out)
+        exit(-1);
+
+    printf("%s: %ux%u, %u channel(s), %s, %d iterations, workers %s\n", name, width, height, channels,
+           xform_kernel_name(kernel), iterations, pin ? "pinned" : "unpinned");
+
+    for(threads = 1; ; threads = threads * 2 < max_threads ? threads * 2 : max_threads)
+    {
+        msec = bench_one(kernel, threads, pin, img, out, width, height, channels, iterations);
+        if(threads == 1) one_msec = msec;
+
+        printf("  %2d thread(s) %9.3f msec %8.1f Mpixel/s  speedup %5.2f  efficiency %3.0f%%\n",
+               threads, msec, (double)width * height / 1.0e3 / msec,
+               one_msec / msec, 100.0 * one_msec / msec / threads);
+
+        if(threads >= max_threads) break;
+    }
+
+    free(out);
+}
+
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-k sharpen|blur|edge] [-t threads] [-u] [-o output.ppm]\n"
+                    "       [-B [-n iterations] [-s WxH]] [-v reference.ppm]\n"
+                    "       [-C cactus-reference.ppm] image.ppm\n", prog);
+    exit(-1);
+}
+
+
+int main(int argc, char *argv[])
+{
+    char *outfile = "transformed.ppm", *reference = NULL, *cactus = NULL;
+    struct pnm_image_t img, newimg;
+    struct xform_pool_t pool;
+    xform_kernel_t kernel = XFORM_SHARPEN;
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN), pin = 1, benchmark = 0;
+    int iterations = DEFAULT_ITERATIONS, opt;
+    unsigned synth_cols = DEFAULT_SYNTH_COLS, synth_rows = DEFAULT_SYNTH_ROWS;
+    double start;
+
+    while((opt = getopt(argc, argv, "k:t:uo:Bn:s:v:C:h")) != -1)
+    {
+        switch(opt)
+        {
+            case 'k': if(xform_kernel_parse(optarg, &kernel) < 0) usage(argv[0]); break;
+            case 't': threads = atoi(optarg); break;
+            case 'u': pin = 0; break;
+            case 'o': outfile = optarg; break;
+            case 'B': benchmark = 1; break;
+            case 'n': iterations = atoi(optarg); break;
+            case 's': if(sscanf(optarg, "%ux%u", &synth_cols, &synth_rows) != 2) usage(argv[0]); break;
+            case 'v': reference = optarg; break;
+            case 'C': cactus = optarg; break;
+            default:  usage(argv[0]);
+        }
+    }
+    if(optind >= argc || iterations < 1)
+        usage(argv[0]);
+
+    if(threads < 1) threads = 1;
+    if(xform_pool_start(&pool, threads, pin) < 0)
+    {
+        fprintf(stderr, "threads must be 1..%d\n", XFORM_MAX_THREADS);
+        exit(-1);
+    }
+
+    if(reference || cactus)
+    {
+        int rc = reference ? verify(&pool, kernel, argv[optind], reference)
+                           : cactus_check(&pool, argv[optind], cactus);
+
+        xform_pool_stop(&pool);
+        return rc;
+    }
+
+    if(pnm_map(&img, argv[optind]) < 0)
+        exit(-1);
+
+    if(benchmark)
+    {
+        size_t bytes = (size_t)synth_cols * synth_rows * 3, i;
+        unsigned char *synth = malloc(bytes);
+
+        bench(kernel, argv[optind], img.pixels, img.width, img.height, img.channels, threads, pin, iterations);
+
+        if(!synth) exit(-1);
+        for(i = 0; i < bytes; i++)
+            synth[i] = (unsigned char)rand();
+
+        bench(kernel, "synthetic", synth, synth_cols, synth_rows, 3, threads, pin, iterations);
+        free(synth);
+    }
+
+    if(pnm_create(&newimg, outfile, img.format, img.width, img.height, img.comment) < 0)
+        exit(-1);
+
+    start = now_msec();
+    xform_run(&pool, kernel, img.pixels, newimg.pixels, img.width, img.height, img.channels);
+    printf("%s: %ux%u %s on %d thread(s) in %.3f msec, wrote %s\n", argv[optind], img.width, img.height,
+           xform_kernel_name(kernel), threads, now_msec() - start, outfile);
+
+    xform_pool_stop(&pool);
+    pnm_unmap(&img);
+    pnm_unmap(&newimg);
+
+    return 0;
+}
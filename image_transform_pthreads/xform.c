@@ -0,0 +1,246 @@
+/*
+ *  3x3 image transform engine, see xform.h
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "xform.h"
+
+#define SAT (255)
+
+static const char *kernel_names[XFORM_KERNELS] = { "sharpen", "blur", "edge" };
+
+
+// One output row from the three input rows around it.  c is the distance
+// between horizontal neighbors in bytes, i.e. the channel count; each
+// function is only called with a literal c, so it is a constant here too.
+
+static inline void row_sharpen(const unsigned char *up, const unsigned char *mid, const unsigned char *dn,
+                               unsigned char *out, size_t n, const int c)
+{
+    int16_t s, v;
+    size_t i;
+
+    for(i = c; i < n - c; i++)
+    {
+        s = up[i-c] + up[i] + up[i+c] + mid[i-c] + mid[i+c] + dn[i-c] + dn[i] + dn[i+c];
+        v = 10 * mid[i] - s;
+        out[i] = v < 0 ? 0 : (v > 2 * SAT ? SAT : v >> 1);
+    }
+}
+
+
+static inline void row_blur(const unsigned char *up, const unsigned char *mid, const unsigned char *dn,
+                            unsigned char *out, size_t n, const int c)
+{
+    uint16_t s;
+    size_t i;
+
+    for(i = c; i < n - c; i++)
+    {
+        s = up[i-c] + 2 * up[i] + up[i+c] +
+            2 * mid[i-c] + 4 * mid[i] + 2 * mid[i+c] +
+            dn[i-c] + 2 * dn[i] + dn[i+c];
+        out[i] = (s + 8) >> 4;
+    }
+}
+
+
+static inline void row_edge(const unsigned char *up, const unsigned char *mid, const unsigned char *dn,
+                            unsigned char *out, size_t n, const int c)
+{
+    int16_t s, v;
+    size_t i;
+
+    for(i = c; i < n - c; i++)
+    {
+        s = up[i-c] + up[i] + up[i+c] + mid[i-c] + mid[i+c] + dn[i-c] + dn[i] + dn[i+c];
+        v = 8 * mid[i] - s;
+        out[i] = v < 0 ? 0 : (v > SAT ? SAT : v);
+    }
+}
+
+
+static void run_row(xform_kernel_t kernel, const unsigned char *up, const unsigned char *mid,
+                    const unsigned char *dn, unsigned char *out, size_t n, unsigned channels)
+{
+    switch(kernel)
+    {
+        case XFORM_SHARPEN:
+            if(channels == 3) row_sharpen(up, mid, dn, out, n, 3); else row_sharpen(up, mid, dn, out, n, 1);
+            break;
+        case XFORM_BLUR:
+            if(channels == 3) row_blur(up, mid, dn, out, n, 3); else row_blur(up, mid, dn, out, n, 1);
+            break;
+        default:
+            if(channels == 3) row_edge(up, mid, dn, out, n, 3); else row_edge(up, mid, dn, out, n, 1);
+            break;
+    }
+
+    // first and last pixel of the row have no left or right neighbor
+    memcpy(out, mid, channels);
+    memcpy(out + n - channels, mid + n - channels, channels);
+}
+
+
+void xform_rows(xform_kernel_t kernel, const unsigned char *in, unsigned char *out,
+                unsigned width, unsigned height, unsigned channels,
+                unsigned first, unsigned last)
+{
+    size_t stride = (size_t)width * channels;
+    unsigned y;
+
+    for(y = first; y < last; y++)
+    {
+        const unsigned char *mid = in + y * stride;
+
+        // top and bottom rows, and anything too small to have an interior
+        if(y == 0 || y == height - 1 || width < 3)
+            memcpy(out + y * stride, mid, stride);
+        else
+            run_row(kernel, mid - stride, mid, mid + stride, out + y * stride, stride, channels);
+    }
+}
+
+
+// one band of rows of the current job; rows first-1 and last are its halo
+static void run_band(struct xform_pool_t *pool, int idx)
+{
+    unsigned first = (unsigned)(((unsigned long)pool->height * idx) / pool->threads);
+    unsigned last = (unsigned)(((unsigned long)pool->height * (idx + 1)) / pool->threads);
+
+    xform_rows(pool->kernel, pool->in, pool->out, pool->width, pool->height, pool->channels, first, last);
+}
+
+
+static void *workerService(void *threadp)
+{
+    struct xform_worker_t *w = (struct xform_worker_t *)threadp;
+    struct xform_pool_t *pool = w->pool;
+
+    for(;;)
+    {
+        sem_wait(&w->go);
+        if(pool->stop) break;
+
+        run_band(pool, w->idx);
+        sem_post(&pool->done);
+    }
+
+    return NULL;
+}
+
+
+int xform_pool_start(struct xform_pool_t *pool, int threads, int pin)
+{
+    int i, ncpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    pthread_attr_t attr;
+    cpu_set_t cpuset;
+
+    if(threads < 1 || threads > XFORM_MAX_THREADS)
+        return -1;
+    if(ncpus < 1)
+        ncpus = 1;
+
+    pool->threads = threads;
+    pool->stop = 0;
+    sem_init(&pool->done, 0, 0);
+
+    // worker 0 is the caller, left where the scheduler put it
+    pool->worker[0].cpu = -1;
+
+    for(i = 1; i < threads; i++)
+    {
+        struct xform_worker_t *w = &pool->worker[i];
+
+        w->idx = i;
+        w->pool = pool;
+        w->cpu = pin ? i % ncpus : -1;
+        sem_init(&w->go, 0, 0);
+
+        pthread_attr_init(&attr);
+        if(pin)
+        {
+            CPU_ZERO(&cpuset);
+            CPU_SET(w->cpu, &cpuset);
+            pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpuset);
+        }
+
+        if(pthread_create(&w->thread, &attr, workerService, w) != 0)
+        {
+            perror("pthread_create");
+            pthread_attr_destroy(&attr);
+            sem_destroy(&w->go);
+            pool->threads = i;
+            xform_pool_stop(pool);
+            return -1;
+        }
+        pthread_attr_destroy(&attr);
+    }
+
+    return 0;
+}
+
+
+void xform_run(struct xform_pool_t *pool, xform_kernel_t kernel,
+               const unsigned char *in, unsigned char *out,
+               unsigned width, unsigned height, unsigned channels)
+{
+    int i;
+
+    pool->kernel = kernel;
+    pool->in = in;
+    pool->out = out;
+    pool->width = width;
+    pool->height = height;
+    pool->channels = channels;
+
+    for(i = 1; i < pool->threads; i++)
+        sem_post(&pool->worker[i].go);
+
+    run_band(pool, 0);
+
+    for(i = 1; i < pool->threads; i++)
+        sem_wait(&pool->done);
+}
+
+
+void xform_pool_stop(struct xform_pool_t *pool)
+{
+    int i;
+
+    pool->stop = 1;
+    for(i = 1; i < pool->threads; i++)
+    {
+        sem_post(&pool->worker[i].go);
+        pthread_join(pool->worker[i].thread, NULL);
+        sem_destroy(&pool->worker[i].go);
+    }
+    sem_destroy(&pool->done);
+}
+
+
+const char *xform_kernel_name(xform_kernel_t kernel)
+{
+    return kernel < XFORM_KERNELS ? kernel_names[kernel] : "?";
+}
+
+
+int xform_kernel_parse(const char *name, xform_kernel_t *kernel)
+{
+    int k;
+
+    for(k = 0; k < XFORM_KERNELS; k++)
+        if(strcmp(name, kernel_names[k]) == 0)
+        {
+            *kernel = (xform_kernel_t)k;
+            return 0;
+        }
+
+    return -1;
+}
@@ -0,0 +1,85 @@
+/*
+ *  3x3 image transform engine
+ *
+ *  Convolves an 8-bit, 1 or 3 channel interleaved image with one of a few
+ *  fixed 3x3 kernels:
+ *
+ *    sharpen - the usual PSF with K=4: 5 at the center and -K/8 around it,
+ *              computed as (10*c - sum of 8 neighbors) / 2 in integers,
+ *              which is exactly what the double-precision version gives
+ *    blur    - 1 2 1 / 2 4 2 / 1 2 1, divided by 16 and rounded
+ *    edge    - 8 at the center and -1 around it (Laplacian)
+ *
+ *  Results are clamped to 0..255.  The outermost rows and columns have no
+ *  full neighborhood and are copied from the input.
+ *
+ *  The image is split into bands of whole rows, one per worker.  A band
+ *  reads one halo row above and below from its neighbors' bands in the
+ *  input and writes only its own rows of the output, so workers share
+ *  nothing and never wait on each other within a frame.  Workers are
+ *  created once, optionally pinned one per core so a band's rows stay in
+ *  that core's cache from frame to frame, and released for each frame with
+ *  a semaphore.
+ *
+ *  The inner loop runs along a row in 16-bit lanes with the kernel weights
+ *  as compile-time constants, so -O3 turns it into SSE2 or NEON code
+ *  working on 8 or 16 samples at a time.
+ */
+#ifndef _XFORM_H_
+#define _XFORM_H_
+
+#include <pthread.h>
+#include <semaphore.h>
+
+#define XFORM_MAX_THREADS (64)
+
+typedef enum
+{
+    XFORM_SHARPEN,
+    XFORM_BLUR,
+    XFORM_EDGE,
+    XFORM_KERNELS
+} xform_kernel_t;
+
+struct xform_worker_t
+{
+    pthread_t thread;
+    sem_t go;
+    int idx;
+    int cpu;                        // core it is pinned to, -1 if not pinned
+    struct xform_pool_t *pool;
+};
+
+struct xform_pool_t
+{
+    int threads;
+    int stop;
+    sem_t done;
+    struct xform_worker_t worker[XFORM_MAX_THREADS];
+
+    // the job, set before the workers are released
+    xform_kernel_t kernel;
+    const unsigned char *in;
+    unsigned char *out;
+    unsigned width, height, channels;
+};
+
+// threads workers, the caller being worker 0; pin places worker i > 0 on
+// core i modulo the number of cores
+int xform_pool_start(struct xform_pool_t *pool, int threads, int pin);
+void xform_pool_stop(struct xform_pool_t *pool);
+
+// out = kernel applied to in, both width*height*channels bytes, not overlapping
+void xform_run(struct xform_pool_t *pool, xform_kernel_t kernel,
+               const unsigned char *in, unsigned char *out,
+               unsigned width, unsigned height, unsigned channels);
+
+// rows first..last-1 only, on the calling thread
+void xform_rows(xform_kernel_t kernel, const unsigned char *in, unsigned char *out,
+                unsigned width, unsigned height, unsigned channels,
+                unsigned first, unsigned last);
+
+const char *xform_kernel_name(xform_kernel_t kernel);
+int xform_kernel_parse(const char *name, xform_kernel_t *kernel);
+
+#endif
@@ -0,0 +1,43 @@
+/*
+ *  Check and describe PPM/PGM files through pnmio
+ *
+ *  Usage: pnminfo file.ppm [file.pgm ...]
+ *
+ *  Each file is mapped and its header validated; nothing is read beyond
+ *  the header, so a whole directory of frames is checked in the time it
+ *  takes to map them.  Exits non-zero if any file is not a valid image.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pnmio.h"
+
+
+int main(int argc, char *argv[])
+{
+    struct pnm_image_t img;
+    int i, bad = 0;
+
+    if(argc < 2)
+    {
+        fprintf(stderr, "Usage: %s file.ppm [file.pgm ...]\n", argv[0]);
+        exit(-1);
+    }
+
+    for(i = 1; i < argc; i++)
+    {
+        if(pnm_map(&img, argv[i]) < 0)
+        {
+            bad++;
+            continue;
+        }
+
+        printf("%s: P%d %ux%u, %u channel(s), maxval %u, %zu header + %zu pixel bytes%s%s\n",
+               argv[i], img.format, img.width, img.height, img.channels, img.maxval,
+               img.header_len, img.bytes, img.comment[0] ? ", #" : "", img.comment);
+
+        pnm_unmap(&img);
+    }
+
+    return bad ? -1 : 0;
+}
@@ -0,0 +1,270 @@
+/*
+ *  PPM/PGM image I/O, see pnmio.h
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+#include "pnmio.h"
+
+// sanity limit on each dimension, well beyond any camera here
+#define PNM_MAX_DIM (65535)
+
+
+// skip whitespace and comments, keeping the first comment, then read a decimal number
+static int next_number(struct pnm_image_t *img, const unsigned char *data, size_t len,
+                       size_t *pos, unsigned *value)
+{
+    size_t i = *pos, start;
+    unsigned long v = 0;
+
+    for(;;)
+    {
+        while(i < len && isspace(data[i])) i++;
+
+        if(i < len && data[i] == '#')
+        {
+            start = ++i;
+            while(i < len && data[i] != '\n' && data[i] != '\r') i++;
+
+            if(img->comment[0] == '\0')
+            {
+                size_t n = i - start < PNM_MAX_COMMENT - 1 ? i - start : PNM_MAX_COMMENT - 1;
+                memcpy(img->comment, data + start, n);
+                img->comment[n] = '\0';
+            }
+            continue;
+        }
+        break;
+    }
+
+    if(i >= len || !isdigit(data[i]))
+        return -1;
+
+    while(i < len && isdigit(data[i]))
+    {
+        v = v * 10 + (data[i++] - '0');
+        if(v > PNM_MAX_DIM) return -1;
+    }
+
+    *value = (unsigned)v;
+    *pos = i;
+    return 0;
+}
+
+
+int pnm_parse(struct pnm_image_t *img, const unsigned char *data, size_t len)
+{
+    size_t pos = 2;
+
+    memset(img, 0, sizeof(*img));
+
+    if(len < 2 || data[0] != 'P' || (data[1] != '5' && data[1] != '6'))
+        return -1;
+
+    img->format = data[1] - '0';
+    img->channels = img->format == PNM_RGB ? 3 : 1;
+
+    if(next_number(img, data, len, &pos, &img->width) < 0 ||
+       next_number(img, data, len, &pos, &img->height) < 0 ||
+       next_number(img, data, len, &pos, &img->maxval) < 0)
+        return -1;
+
+    if(img->width == 0 || img->height == 0 || img->maxval == 0 || img->maxval > 255)
+        return -1;
+
+    // exactly one whitespace character separates the header from the pixels
+    if(pos >= len || !isspace(data[pos]))
+        return -1;
+
+    img->header_len = pos + 1;
+    img->bytes = (size_t)img->width * img->height * img->channels;
+
+    return 0;
+}
+
+
+int pnm_map(struct pnm_image_t *img, const char *file)
+{
+    struct stat st;
+    void *map;
+    int fd;
+
+    if((fd = open(file, O_RDONLY)) < 0)
+    {
+        perror(file);
+        return -1;
+    }
+
+    if(fstat(fd, &st) < 0 || st.st_size == 0)
+    {
+        fprintf(stderr, "%s: empty or unreadable\n", file);
+        close(fd);
+        return -1;
+    }
+
+    // private and writable: in-place changes stay in this process
+    map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+    {
+        perror("mmap");
+        return -1;
+    }
+
+    // image tools go through the pixels front to back
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    if(pnm_parse(img, (const unsigned char *)map, st.st_size) < 0)
+    {
+        fprintf(stderr, "%s: not an 8-bit binary PGM or PPM\n", file);
+        munmap(map, st.st_size);
+        return -1;
+    }
+
+    if(img->header_len + img->bytes > (size_t)st.st_size)
+    {
+        fprintf(stderr, "%s: %ux%u needs %zu bytes of pixels, file has %zu\n", file,
+                img->width, img->height, img->bytes, (size_t)st.st_size - img->header_len);
+        munmap(map, st.st_size);
+        return -1;
+    }
+
+    img->map = map;
+    img->map_len = st.st_size;
+    img->pixels = (unsigned char *)map + img->header_len;
+
+    return 0;
+}
+
+
+int pnm_header(char *buf, size_t len, int format, unsigned width, unsigned height,
+               const char *comment)
+{
+    int n;
+
+    if(comment && comment[0])
+        n = snprintf(buf, len, "P%d\n#%s\n%u %u\n255\n", format, comment, width, height);
+    else
+        n = snprintf(buf, len, "P%d\n%u %u\n255\n", format, width, height);
+
+    return (n < 0 || (size_t)n >= len) ? -1 : n;
+}
+
+
+int pnm_create(struct pnm_image_t *img, const char *file, int format,
+               unsigned width, unsigned height, const char *comment)
+{
+    char header[PNM_MAX_HEADER];
+    void *map;
+    int fd, hlen;
+
+    if((format != PNM_GRAY && format != PNM_RGB) ||
+       (hlen = pnm_header(header, sizeof(header), format, width, height, comment)) < 0)
+        return -1;
+
+    memset(img, 0, sizeof(*img));
+    img->format = format;
+    img->width = width;
+    img->height = height;
+    img->channels = format == PNM_RGB ? 3 : 1;
+    img->maxval = 255;
+    if(comment)
+        strncpy(img->comment, comment, PNM_MAX_COMMENT - 1);
+    img->header_len = hlen;
+    img->bytes = (size_t)width * height * img->channels;
+    img->map_len = hlen + img->bytes;
+
+    if((fd = open(file, O_RDWR | O_CREAT | O_TRUNC, 00666)) < 0)
+    {
+        perror(file);
+        return -1;
+    }
+
+    if(ftruncate(fd, img->map_len) < 0)
+    {
+        perror("ftruncate");
+        close(fd);
+        return -1;
+    }
+
+    map = mmap(NULL, img->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+    {
+        perror("mmap");
+        return -1;
+    }
+
+    memcpy(map, header, hlen);
+    img->map = map;
+    img->pixels = (unsigned char *)map + hlen;
+
+    return 0;
+}
+
+
+void pnm_unmap(struct pnm_image_t *img)
+{
+    if(img->map)
+        munmap(img->map, img->map_len);
+
+    img->map = NULL;
+    img->pixels = NULL;
+}
+
+
+int pnm_write(const char *file, int format, unsigned width, unsigned height,
+              const char *comment, const void *pixels, size_t bytes)
+{
+    char header[PNM_MAX_HEADER];
+    struct iovec iov[2];
+    ssize_t written;
+    int fd, hlen, i = 0;
+
+    if((hlen = pnm_header(header, sizeof(header), format, width, height, comment)) < 0)
+        return -1;
+
+    if((fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 00666)) < 0)
+    {
+        perror(file);
+        return -1;
+    }
+
+    iov[0].iov_base = header;
+    iov[0].iov_len = hlen;
+    iov[1].iov_base = (void *)pixels;
+    iov[1].iov_len = bytes;
+
+    // one system call unless the kernel takes less than everything
+    while(i < 2)
+    {
+        if((written = writev(fd, &iov[i], 2 - i)) < 0)
+        {
+            if(errno == EINTR) continue;
+            perror("writev");
+            close(fd);
+            return -1;
+        }
+
+        for(; i < 2 && (size_t)written >= iov[i].iov_len; i++)
+            written -= iov[i].iov_len;
+
+        if(i < 2)
+        {
+            iov[i].iov_base = (char *)iov[i].iov_base + written;
+            iov[i].iov_len -= written;
+        }
+    }
+
+    close(fd);
+
+    return 0;
+}
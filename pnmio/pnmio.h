@@ -0,0 +1,75 @@
+/*
+ *  PPM/PGM image I/O shared by the image tools
+ *
+ *  Reading maps the whole file and parses the header in place, so the
+ *  pixels are a view straight into the page cache: no stdio buffer, no
+ *  copy into a caller's array and no size limit but the file's own.  The
+ *  mapping is private and writable, so a tool may transform in place and
+ *  only the pages it touches are copied.
+ *
+ *  Writing is either one writev() of the header and the caller's pixels,
+ *  or, for tools that produce an image from scratch, a file created at its
+ *  final size and mapped, so the output is computed directly into it.
+ *
+ *  Only binary, 8-bit images are handled: P5 (gray) and P6 (RGB) with a
+ *  maxval of at most 255, which is everything the capture code writes.
+ */
+#ifndef _PNMIO_H_
+#define _PNMIO_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PNM_GRAY (5)    // P5
+#define PNM_RGB (6)     // P6
+
+#define PNM_MAX_COMMENT (256)
+
+// longest header pnm_header() makes: magic, comment, size and maxval lines
+#define PNM_MAX_HEADER (PNM_MAX_COMMENT + 48)
+
+struct pnm_image_t
+{
+    int format;                     // PNM_GRAY or PNM_RGB
+    unsigned width, height, channels, maxval;
+    char comment[PNM_MAX_COMMENT];  // first comment line without the '#', "" if none
+
+    unsigned char *pixels;          // width*height*channels bytes, row after row
+    size_t bytes;
+    size_t header_len;              // offset of pixels in the file
+
+    // the mapping behind pixels
+    void *map;
+    size_t map_len;
+};
+
+// Map and validate file; pixels is then a view into the mapping
+int pnm_map(struct pnm_image_t *img, const char *file);
+
+// Parse and validate a header at the start of data, without mapping anything
+int pnm_parse(struct pnm_image_t *img, const unsigned char *data, size_t len);
+
+// Create file at its final size and map it for writing; fill in pixels, then
+// pnm_unmap.  comment may be NULL.
+int pnm_create(struct pnm_image_t *img, const char *file, int format,
+               unsigned width, unsigned height, const char *comment);
+
+// Release a mapping from pnm_map or pnm_create
+void pnm_unmap(struct pnm_image_t *img);
+
+// Write header and pixels with one writev; comment may be NULL
+int pnm_write(const char *file, int format, unsigned width, unsigned height,
+              const char *comment, const void *pixels, size_t bytes);
+
+// Format a header into buf, returning its length or -1 if it doesn't fit
+int pnm_header(char *buf, size_t len, int format, unsigned width, unsigned height,
+               const char *comment);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -35,6 +35,9 @@
 
 #include <time.h>
 
+#include "../pnmio/pnmio.h"
+#include "../image_transform_pthreads/sepconv.h"
+
 #define CLEAR(x) memset(&(x), 0, sizeof(x))
 
 #define MAX_HRES (1920)
@@ -68,6 +71,12 @@
 //#define COLOR_CONVERT_GRAY
 #define DUMP_FRAMES
 
+// smooth every converted frame before it is saved, on FILTER_THREADS
+// workers with the separable convolution library
+//#define FILTER_FRAMES
+#define FILTER_KERNEL (SEP_GAUSS5)
+#define FILTER_THREADS (2)
+
 #define DRIVER_MMAP_BUFFERS (6)  // request buffers for delay
 
 
@@ -132,75 +141,33 @@ static int xioctl(int fh, int request, void *arg)
 }
 
 
-char ppm_header[]="P6\n#9999999999 sec 9999999999 msec \n"HRES_STR" "VRES_STR"\n255\n";
-char ppm_dumpname[]="frames/test0000.ppm";
-
-static void dump_ppm(const void *p, int size, unsigned int tag, struct timespec *time)
+// header comment is the frame time, e.g. "#0000012345 sec 0000000678 msec "
+static void dump_pnm(int format, const void *p, int size, unsigned int tag, struct timespec *time)
 {
-    int written, i, total, dumpfd;
-   
-    snprintf(&ppm_dumpname[11], 9, "%04d", tag);
-    strncat(&ppm_dumpname[15], ".ppm", 5);
-    dumpfd = open(ppm_dumpname, O_WRONLY | O_NONBLOCK | O_CREAT, 00666);
-
-    snprintf(&ppm_header[4], 11, "%010d", (int)time->tv_sec);
-    strncat(&ppm_header[14], " sec ", 5);
-    snprintf(&ppm_header[19], 11, "%010d", (int)((time->tv_nsec)/1000000));
-    strncat(&ppm_header[29], " msec \n"HRES_STR" "VRES_STR"\n255\n", 19);
+    char dumpname[32], comment[PNM_MAX_COMMENT];
 
-    // subtract 1 from sizeof header because it includes the null terminator for the string
-    written=write(dumpfd, ppm_header, sizeof(ppm_header)-1);
+    snprintf(dumpname, sizeof(dumpname), "frames/test%04d.%s", tag, format == PNM_RGB ? "ppm" : "pgm");
+    snprintf(comment, sizeof(comment), "%010d sec %010d msec ", (int)time->tv_sec, (int)((time->tv_nsec)/1000000));
 
-    total=0;
-
-    do
-    {
-        written=write(dumpfd, p, size);
-        total+=written;
-    } while(total < size);
+    // header and frame go out in one writev
+    if(pnm_write(dumpname, format, HRES, VRES, comment, p, size) < 0)
+        return;
 
     clock_gettime(CLOCK_MONOTONIC, &time_now);
     fnow = (double)time_now.tv_sec + (double)time_now.tv_nsec / 1000000000.0;
-    printf("Frame written to flash at %lf, %d, bytes\n", (fnow-fstart), total);
-
-    close(dumpfd);
-    
+    printf("Frame written to flash at %lf, %d, bytes\n", (fnow-fstart), size);
 }
 
 
-char pgm_header[]="P5\n#9999999999 sec 9999999999 msec \n"HRES_STR" "VRES_STR"\n255\n";
-char pgm_dumpname[]="frames/test0000.pgm";
-
-static void dump_pgm(const void *p, int size, unsigned int tag, struct timespec *time)
+static void dump_ppm(const void *p, int size, unsigned int tag, struct timespec *time)
 {
-    int written, i, total, dumpfd;
-   
-    snprintf(&pgm_dumpname[11], 9, "%04d", tag);
-    strncat(&pgm_dumpname[15], ".pgm", 5);
-    dumpfd = open(pgm_dumpname, O_WRONLY | O_NONBLOCK | O_CREAT, 00666);
-
-    snprintf(&pgm_header[4], 11, "%010d", (int)time->tv_sec);
-    strncat(&pgm_header[14], " sec ", 5);
-    snprintf(&pgm_header[19], 11, "%010d", (int)((time->tv_nsec)/1000000));
-    strncat(&pgm_header[29], " msec \n"HRES_STR" "VRES_STR"\n255\n", 19);
-
-    // subtract 1 from sizeof header because it includes the null terminator for the string
-    written=write(dumpfd, pgm_header, sizeof(pgm_header)-1);
-
-    total=0;
-
-    do
-    {
-        written=write(dumpfd, p, size);
-        total+=written;
-    } while(total < size);
+    dump_pnm(PNM_RGB, p, size, tag, time);
+}
 
-    clock_gettime(CLOCK_MONOTONIC, &time_now);
-    fnow = (double)time_now.tv_sec + (double)time_now.tv_nsec / 1000000000.0;
-    printf("Frame written to flash at %lf, %d, bytes\n", (fnow-fstart), total);
 
-    close(dumpfd);
-    
+static void dump_pgm(const void *p, int size, unsigned int tag, struct timespec *time)
+{
+    dump_pnm(PNM_GRAY, p, size, tag, time);
 }
 
 
@@ -272,6 +239,35 @@ int save_framecnt=0;
 
 unsigned char scratchpad_buffer[MAX_HRES*MAX_VRES*MAX_PIXEL_SIZE];
 
+#ifdef FILTER_FRAMES
+// frames are converted into here and filtered into the scratchpad
+static unsigned char filter_buffer[MAX_HRES*MAX_VRES*MAX_PIXEL_SIZE];
+static struct sep_pool_t filter_pool;
+#define CONVERT_BUFFER filter_buffer
+#else
+#define CONVERT_BUFFER scratchpad_buffer
+#endif
+
+
+static void filter_start(void)
+{
+#ifdef FILTER_FRAMES
+    if(sep_pool_start(&filter_pool, FILTER_THREADS, 0, 0) < 0)
+    {
+        fprintf(stderr, "can't start %d filter threads\n", FILTER_THREADS);
+        exit(EXIT_FAILURE);
+    }
+#endif
+}
+
+
+static void filter_stop(void)
+{
+#ifdef FILTER_FRAMES
+    sep_pool_stop(&filter_pool);
+#endif
+}
+
 
 static int save_image(const void *p, int size, struct timespec *frame_time)
 {
@@ -348,9 +344,12 @@ static int process_image(const void *p, int size)
         for(i=0, newi=0; i<size; i=i+4, newi=newi+6)
         {
             y_temp=(int)frame_ptr[i]; u_temp=(int)frame_ptr[i+1]; y2_temp=(int)frame_ptr[i+2]; v_temp=(int)frame_ptr[i+3];
-            yuv2rgb(y_temp, u_temp, v_temp, &scratchpad_buffer[newi], &scratchpad_buffer[newi+1], &scratchpad_buffer[newi+2]);
-            yuv2rgb(y2_temp, u_temp, v_temp, &scratchpad_buffer[newi+3], &scratchpad_buffer[newi+4], &scratchpad_buffer[newi+5]);
+            yuv2rgb(y_temp, u_temp, v_temp, &CONVERT_BUFFER[newi], &CONVERT_BUFFER[newi+1], &CONVERT_BUFFER[newi+2]);
+            yuv2rgb(y2_temp, u_temp, v_temp, &CONVERT_BUFFER[newi+3], &CONVERT_BUFFER[newi+4], &CONVERT_BUFFER[newi+5]);
         }
+#ifdef FILTER_FRAMES
+        sep_run(&filter_pool, FILTER_KERNEL, filter_buffer, scratchpad_buffer, HRES, VRES, 3);
+#endif
 #elif defined(COLOR_CONVERT_GRAY)
         // Pixels are YU and YV alternating, so YUYV which is 4 bytes
         // We want Y, so YY which is 2 bytes
@@ -358,9 +357,12 @@ static int process_image(const void *p, int size)
         for(i=0, newi=0; i<size; i=i+4, newi=newi+2)
         {
             // Y1=first byte and Y2=third byte
-            scratchpad_buffer[newi]=frame_ptr[i];
-            scratchpad_buffer[newi+1]=frame_ptr[i+2];
+            CONVERT_BUFFER[newi]=frame_ptr[i];
+            CONVERT_BUFFER[newi+1]=frame_ptr[i+2];
         }
+#ifdef FILTER_FRAMES
+        sep_run(&filter_pool, FILTER_KERNEL, filter_buffer, scratchpad_buffer, HRES, VRES, 1);
+#endif
 #endif
     }
 
@@ -465,6 +467,76 @@ int seq_frame_read(void)
 }
 
 
+// Dequeue the next frame and hand back the driver's mmap buffer directly,
+// so a publisher (e.g. framebus_daemon) can copy it once to its final
+// destination instead of going through the ring buffer.
+//
+// The buffer belongs to the caller until seq_frame_enqueue() is called.
+// Returns 0, or -1 on a select timeout with no buffer dequeued.  framecnt,
+// if not NULL, gets read_framecnt, which is <= 0 for the STARTUP_FRAMES.
+int seq_frame_dequeue(const void **frame, unsigned int *bytesused, struct timespec *frame_time, int *framecnt)
+{
+    fd_set fds;
+    struct timeval tv;
+    int rc;
+
+    do
+    {
+        FD_ZERO(&fds);
+        FD_SET(camera_device_fd, &fds);
+
+        /* Timeout */
+        tv.tv_sec = 2;
+        tv.tv_usec = 0;
+
+        rc = select(camera_device_fd + 1, &fds, NULL, NULL, &tv);
+
+        if (-1 == rc)
+        {
+            if (EINTR == errno)
+                continue;
+            errno_exit("select");
+        }
+
+        if (0 == rc)
+        {
+            fprintf(stderr, "select timeout\n");
+            return -1;
+        }
+
+    } while (!read_frame());
+
+    clock_gettime(CLOCK_MONOTONIC, frame_time);
+
+    *frame = buffers[frame_buf.index].start;
+    *bytesused = frame_buf.bytesused;
+    if(framecnt) *framecnt = read_framecnt;
+
+    return 0;
+}
+
+
+int seq_frame_enqueue(void)
+{
+    if (-1 == xioctl(camera_device_fd, VIDIOC_QBUF, &frame_buf))
+        errno_exit("VIDIOC_QBUF");
+
+    return 0;
+}
+
+
+void v4l2_frame_format(unsigned int *width, unsigned int *height,
+                       unsigned int *pixelformat, unsigned int *bytesperline,
+                       unsigned int *sizeimage)
+{
+    *width = fmt.fmt.pix.width;
+    *height = fmt.fmt.pix.height;
+    *pixelformat = fmt.fmt.pix.pixelformat;
+    *bytesperline = fmt.fmt.pix.bytesperline;
+    *sizeimage = fmt.fmt.pix.sizeimage;
+}
+
+
 
 int seq_frame_process(void)
 {
@@ -937,6 +1009,7 @@ int v4l2_frame_acquisition_loop(char *dev_name)
     // initialization of V4L2
     open_device(dev_name);
     init_device(dev_name);
+    filter_start();
 
     start_capturing();
 
@@ -948,6 +1021,7 @@ int v4l2_frame_acquisition_loop(char *dev_name)
 
     printf("Total capture time=%lf, for %d frames, %lf FPS\n", (fstop-fstart), read_framecnt, ((double)read_framecnt / (fstop-fstart)));
 
+    filter_stop();
     uninit_device();
     close_device();
     fprintf(stderr, "\n");
@@ -960,6 +1034,7 @@ int v4l2_frame_acquisition_initialization(char *dev_name)
     // initialization of V4L2
     open_device(dev_name);
     init_device(dev_name);
+    filter_start();
 
     start_capturing();
 }
@@ -972,6 +1047,7 @@ int v4l2_frame_acquisition_shutdown(void)
 
     printf("Total capture time=%lf, for %d frames, %lf FPS\n", (fstop-fstart), read_framecnt+1, ((double)read_framecnt / (fstop-fstart)));
 
+    filter_stop();
     uninit_device();
     close_device();
     fprintf(stderr, "\n");
@@ -0,0 +1,272 @@
+/*
+ *  Shared-memory frame bus - see framebus.h for the protocol.
+ *
+ *  The publisher is the only writer, so the slot sequence lock needs no
+ *  read-modify-write atomics, only ordered stores and loads.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "framebus.h"
+
+
+static size_t round_up(size_t size, size_t align)
+{
+    return (size + align - 1) & ~(align - 1);
+}
+
+
+static int futex_wait(uint32_t *addr, uint32_t val, const struct timespec *timeout)
+{
+    return syscall(SYS_futex, addr, FUTEX_WAIT, val, timeout, NULL, 0);
+}
+
+
+static int futex_wake_all(uint32_t *addr)
+{
+    return syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+
+int framebus_create(framebus_t *bus, const char *name, unsigned int slot_count,
+                    unsigned int frame_size, unsigned int width, unsigned int height,
+                    unsigned int pixelformat, unsigned int bytesperline)
+{
+    size_t hdr_size, slot_size;
+
+    if(slot_count < 2 || slot_count > FRAMEBUS_MAX_SLOTS)
+    {
+        fprintf(stderr, "framebus_create: slot count %u out of range\n", slot_count);
+        return -1;
+    }
+
+    memset(bus, 0, sizeof(*bus));
+    strncpy(bus->name, name, sizeof(bus->name)-1);
+    bus->owner = 1;
+
+    hdr_size = round_up(sizeof(struct framebus_hdr_t), FRAMEBUS_ALIGN);
+    slot_size = round_up(frame_size, FRAMEBUS_ALIGN);
+    bus->map_size = hdr_size + (slot_size * slot_count);
+
+    // a stale ring from a crashed daemon would have the wrong geometry
+    shm_unlink(name);
+
+    if((bus->fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644)) < 0)
+    {
+        perror("framebus_create shm_open");
+        return -1;
+    }
+
+    if(ftruncate(bus->fd, bus->map_size) < 0)
+    {
+        perror("framebus_create ftruncate");
+        close(bus->fd); shm_unlink(name);
+        return -1;
+    }
+
+    bus->hdr = mmap(NULL, bus->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, bus->fd, 0);
+
+    if(bus->hdr == MAP_FAILED)
+    {
+        perror("framebus_create mmap");
+        close(bus->fd); shm_unlink(name);
+        return -1;
+    }
+
+    // fault in the ring now rather than on the first frames
+    mlock(bus->hdr, bus->map_size);
+
+    bus->hdr->version = FRAMEBUS_VERSION;
+    bus->hdr->slot_count = slot_count;
+    bus->hdr->slot_size = slot_size;
+    bus->hdr->width = width;
+    bus->hdr->height = height;
+    bus->hdr->pixelformat = pixelformat;
+    bus->hdr->bytesperline = bytesperline;
+    bus->hdr->data_offset = hdr_size;
+    bus->hdr->publisher_pid = getpid();
+    bus->data = (unsigned char *)bus->hdr + hdr_size;
+
+    // readers check the magic last, so publish it after the geometry
+    __atomic_store_n(&bus->hdr->magic, FRAMEBUS_MAGIC, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+
+uint64_t framebus_publish(framebus_t *bus, const void *frame, unsigned int bytesused,
+                          const struct timespec *time_stamp)
+{
+    struct framebus_hdr_t *hdr = bus->hdr;
+    uint64_t seq = hdr->head_seq + 1;
+    struct framebus_slot_t *slot = &hdr->slot[seq % hdr->slot_count];
+
+    if(bytesused > hdr->slot_size)
+        bytesused = hdr->slot_size;
+
+    // odd lock tells readers the slot is being overwritten
+    __atomic_store_n(&slot->lock, (2*seq)+1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    memcpy(bus->data + ((seq % hdr->slot_count) * hdr->slot_size), frame, bytesused);
+    slot->seq = seq;
+    slot->time_stamp = *time_stamp;
+    slot->bytesused = bytesused;
+
+    __atomic_store_n(&slot->lock, 2*seq, __ATOMIC_RELEASE);
+    __atomic_store_n(&hdr->head_seq, seq, __ATOMIC_RELEASE);
+    __atomic_store_n(&hdr->futex_word, (uint32_t)seq, __ATOMIC_RELEASE);
+
+    futex_wake_all(&hdr->futex_word);
+
+    return seq;
+}
+
+
+int framebus_open(framebus_t *bus, const char *name)
+{
+    struct stat st;
+
+    memset(bus, 0, sizeof(*bus));
+    strncpy(bus->name, name, sizeof(bus->name)-1);
+
+    if((bus->fd = shm_open(name, O_RDONLY, 0)) < 0)
+    {
+        perror("framebus_open shm_open");
+        return -1;
+    }
+
+    if(fstat(bus->fd, &st) < 0 || st.st_size < (off_t)sizeof(struct framebus_hdr_t))
+    {
+        fprintf(stderr, "framebus_open: %s is not initialized\n", name);
+        close(bus->fd);
+        return -1;
+    }
+
+    bus->map_size = st.st_size;
+
+    // readers can never corrupt a frame another analytic is using
+    bus->hdr = mmap(NULL, bus->map_size, PROT_READ, MAP_SHARED, bus->fd, 0);
+
+    if(bus->hdr == MAP_FAILED)
+    {
+        perror("framebus_open mmap");
+        close(bus->fd);
+        return -1;
+    }
+
+    if(__atomic_load_n(&bus->hdr->magic, __ATOMIC_ACQUIRE) != FRAMEBUS_MAGIC ||
+       bus->hdr->version != FRAMEBUS_VERSION)
+    {
+        fprintf(stderr, "framebus_open: %s has bad magic or version\n", name);
+        munmap(bus->hdr, bus->map_size);
+        close(bus->fd);
+        return -1;
+    }
+
+    // a truncated or foreign object must not send readers past the mapping
+    if(bus->hdr->slot_count < 1 || bus->hdr->slot_count > FRAMEBUS_MAX_SLOTS ||
+       bus->hdr->data_offset < sizeof(struct framebus_hdr_t) ||
+       (uint64_t)bus->hdr->data_offset + (uint64_t)bus->hdr->slot_count * bus->hdr->slot_size >
+       (uint64_t)bus->map_size)
+    {
+        fprintf(stderr, "framebus_open: %s has %u slots of %u bytes at offset %u, does not fit in %zu bytes\n",
+                name, bus->hdr->slot_count, bus->hdr->slot_size, bus->hdr->data_offset, bus->map_size);
+        munmap(bus->hdr, bus->map_size);
+        close(bus->fd);
+        return -1;
+    }
+
+    bus->data = (unsigned char *)bus->hdr + bus->hdr->data_offset;
+
+    return 0;
+}
+
+
+uint64_t framebus_latest(framebus_t *bus)
+{
+    return __atomic_load_n(&bus->hdr->head_seq, __ATOMIC_ACQUIRE);
+}
+
+
+// Block until a frame newer than after_seq is published, returns the newest
+// sequence number, or after_seq on timeout
+uint64_t framebus_wait(framebus_t *bus, uint64_t after_seq, int timeout_msec)
+{
+    struct timespec timeout;
+    uint64_t seq;
+    uint32_t word;
+
+    timeout.tv_sec = timeout_msec / 1000;
+    timeout.tv_nsec = (timeout_msec % 1000) * 1000000;
+
+    for(;;)
+    {
+        word = __atomic_load_n(&bus->hdr->futex_word, __ATOMIC_ACQUIRE);
+
+        if((seq = framebus_latest(bus)) > after_seq)
+            return seq;
+
+        if(futex_wait(&bus->hdr->futex_word, word, &timeout) < 0 && errno == ETIMEDOUT)
+            return framebus_latest(bus);
+    }
+}
+
+
+// Map frame seq without copying, fails if the slot no longer (or does not
+// yet) hold that frame
+int framebus_acquire(framebus_t *bus, uint64_t seq, framebus_view_t *view)
+{
+    struct framebus_hdr_t *hdr = bus->hdr;
+    struct framebus_slot_t *slot = &hdr->slot[seq % hdr->slot_count];
+
+    view->lock = __atomic_load_n(&slot->lock, __ATOMIC_ACQUIRE);
+
+    if(view->lock != 2*seq)
+        return -1;
+
+    view->seq = seq;
+    view->data = bus->data + ((seq % hdr->slot_count) * hdr->slot_size);
+    view->bytesused = slot->bytesused;
+    view->time_stamp = slot->time_stamp;
+
+    return 0;
+}
+
+
+// Returns 0 if the frame stayed intact for the whole time it was in use,
+// -1 if the publisher lapped the reader and results must be discarded
+int framebus_release(framebus_t *bus, const framebus_view_t *view)
+{
+    struct framebus_slot_t *slot = &bus->hdr->slot[view->seq % bus->hdr->slot_count];
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    return (__atomic_load_n(&slot->lock, __ATOMIC_RELAXED) == view->lock) ? 0 : -1;
+}
+
+
+void framebus_close(framebus_t *bus)
+{
+    if(bus->hdr && bus->hdr != MAP_FAILED)
+        munmap(bus->hdr, bus->map_size);
+
+    if(bus->fd >= 0)
+        close(bus->fd);
+
+    if(bus->owner)
+        shm_unlink(bus->name);
+
+    bus->hdr = NULL;
+    bus->fd = -1;
+}
@@ -0,0 +1,112 @@
+/*
+ *  Shared-memory frame bus
+ *
+ *  A single acquisition process (framebus_daemon) owns the camera through
+ *  capturelib and publishes every frame into a POSIX shared-memory ring.
+ *  Any number of analytics processes map the same ring read-only and work
+ *  directly on the frame slots, so adding a detector never adds a camera
+ *  open or a frame copy.
+ *
+ *  Each published frame gets a sequence number starting at 1.  Slots are
+ *  protected by a sequence lock: the publisher marks a slot odd while it
+ *  is being filled and even when complete, so a reader can tell after the
+ *  fact whether the publisher lapped it while it was using the data.
+ *
+ *  Readers that block for new frames wait on a futex in the header, and the
+ *  publisher wakes all of them with one system call per frame.
+ *
+ *  Usable from C++ (e.g. OpenCV demos), where a slot maps straight into a
+ *  cv::Mat header without a copy:
+ *
+ *      cv::Mat yuyv(bus.hdr->height, bus.hdr->width, CV_8UC2, (void *)view.data);
+ */
+#ifndef _FRAMEBUS_H_
+#define _FRAMEBUS_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FRAMEBUS_DEFAULT_NAME "/rtes_framebus0"
+
+#define FRAMEBUS_MAGIC (0x53554246) // "FBUS"
+#define FRAMEBUS_VERSION (1)
+
+#define FRAMEBUS_MAX_SLOTS (32)
+#define FRAMEBUS_DEFAULT_SLOTS (8)
+
+// frame data for each slot starts on a page boundary
+#define FRAMEBUS_ALIGN (4096)
+
+struct framebus_slot_t
+{
+    uint64_t lock;                  // 2*seq when complete, 2*seq+1 while being written
+    uint64_t seq;
+    struct timespec time_stamp;     // CLOCK_MONOTONIC at dequeue from the driver
+    uint32_t bytesused;
+    uint32_t reserved;
+};
+
+struct framebus_hdr_t
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slot_count;
+    uint32_t slot_size;             // bytes reserved per frame, multiple of FRAMEBUS_ALIGN
+    uint32_t width;
+    uint32_t height;
+    uint32_t pixelformat;           // V4L2 fourcc, e.g. V4L2_PIX_FMT_YUYV
+    uint32_t bytesperline;
+    uint32_t data_offset;           // offset from header to slot 0 data
+    uint32_t futex_word;            // low 32 bits of head_seq, readers wait on this
+    uint64_t head_seq;              // last completely published frame, 0 for none
+    uint32_t publisher_pid;
+    uint32_t reserved;
+    struct framebus_slot_t slot[FRAMEBUS_MAX_SLOTS];
+};
+
+typedef struct
+{
+    int fd;
+    int owner;                      // publisher unlinks the ring on close
+    size_t map_size;
+    struct framebus_hdr_t *hdr;
+    unsigned char *data;
+    char name[64];
+} framebus_t;
+
+// Zero-copy reference to one frame, valid until framebus_release()
+typedef struct
+{
+    uint64_t seq;
+    uint64_t lock;
+    const unsigned char *data;
+    uint32_t bytesused;
+    struct timespec time_stamp;
+} framebus_view_t;
+
+
+// publisher side
+int framebus_create(framebus_t *bus, const char *name, unsigned int slot_count,
+                    unsigned int frame_size, unsigned int width, unsigned int height,
+                    unsigned int pixelformat, unsigned int bytesperline);
+uint64_t framebus_publish(framebus_t *bus, const void *frame, unsigned int bytesused,
+                          const struct timespec *time_stamp);
+
+// reader side
+int framebus_open(framebus_t *bus, const char *name);
+uint64_t framebus_latest(framebus_t *bus);
+uint64_t framebus_wait(framebus_t *bus, uint64_t after_seq, int timeout_msec);
+int framebus_acquire(framebus_t *bus, uint64_t seq, framebus_view_t *view);
+int framebus_release(framebus_t *bus, const framebus_view_t *view);
+
+void framebus_close(framebus_t *bus);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,126 @@
+// Frame bus acquisition daemon
+//
+// Owns the V4L2 camera through capturelib and publishes every frame into the
+// shared-memory frame bus (see framebus.h), so any number of analytics
+// processes (framebus_reader, motion detection, Canny, Hough, ...) can run
+// against one camera at the same time.
+//
+// Usage: framebus_daemon [device] [bus name] [slots]
+//
+//        defaults are /dev/video0, /rtes_framebus0 and 8 slots
+//
+// Run at SCHED_FIFO if permitted so acquisition is never preempted by the
+// analytics it feeds.  Stop with Ctrl-C.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sched.h>
+#include <time.h>
+#include <syslog.h>
+
+#include "framebus.h"
+
+int v4l2_frame_acquisition_initialization(char *dev_name);
+int v4l2_frame_acquisition_shutdown(void);
+int seq_frame_dequeue(const void **frame, unsigned int *bytesused, struct timespec *frame_time, int *framecnt);
+int seq_frame_enqueue(void);
+void v4l2_frame_format(unsigned int *width, unsigned int *height,
+                       unsigned int *pixelformat, unsigned int *bytesperline,
+                       unsigned int *sizeimage);
+
+// report publish rate every 100 frames
+#define REPORT_FRAMES (100)
+
+static volatile sig_atomic_t abortDaemon=0;
+
+static void stop_daemon(int signo)
+{
+    (void)signo;
+    abortDaemon=1;
+}
+
+
+int main(int argc, char *argv[])
+{
+    char *dev_name="/dev/video0";
+    char *bus_name=FRAMEBUS_DEFAULT_NAME;
+    unsigned int slots=FRAMEBUS_DEFAULT_SLOTS;
+    unsigned int width, height, pixelformat, bytesperline, sizeimage, bytesused;
+    struct timespec frame_time, report_time;
+    struct sched_param main_param;
+    struct sigaction sa;
+    const void *frame;
+    framebus_t bus;
+    uint64_t seq=0, report_seq=0;
+    int framecnt;
+    double dt;
+
+    if(argc > 1) dev_name=argv[1];
+    if(argc > 2) bus_name=argv[2];
+    if(argc > 3) slots=atoi(argv[3]);
+
+    sa.sa_handler=stop_daemon;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags=0;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    main_param.sched_priority=sched_get_priority_max(SCHED_FIFO);
+    if(sched_setscheduler(getpid(), SCHED_FIFO, &main_param) < 0)
+        perror("sched_setscheduler, running SCHED_OTHER");
+
+    v4l2_frame_acquisition_initialization(dev_name);
+    v4l2_frame_format(&width, &height, &pixelformat, &bytesperline, &sizeimage);
+
+    if(framebus_create(&bus, bus_name, slots, sizeimage, width, height, pixelformat, bytesperline) < 0)
+    {
+        v4l2_frame_acquisition_shutdown();
+        exit(EXIT_FAILURE);
+    }
+
+    printf("Publishing %ux%u %c%c%c%c frames on %s with %u slots of %u bytes\n",
+           width, height, pixelformat & 0xff, (pixelformat >> 8) & 0xff,
+           (pixelformat >> 16) & 0xff, (pixelformat >> 24) & 0xff,
+           bus_name, slots, bus.hdr->slot_size);
+
+    while(!abortDaemon)
+    {
+        if(seq_frame_dequeue(&frame, &bytesused, &frame_time, &framecnt) < 0)
+            break;
+
+        // frames while the camera settles are handed straight back
+        if(framecnt <= 0)
+        {
+            seq_frame_enqueue();
+            continue;
+        }
+
+        // the first report's rate starts from the first published frame
+        if(seq == 0)
+            report_time=frame_time;
+
+        seq=framebus_publish(&bus, frame, bytesused, &frame_time);
+
+        seq_frame_enqueue();
+
+        if((seq - report_seq) >= REPORT_FRAMES)
+        {
+            dt = (double)(frame_time.tv_sec - report_time.tv_sec) +
+                 (double)(frame_time.tv_nsec - report_time.tv_nsec) / 1000000000.0;
+            syslog(LOG_CRIT, "FRAMEBUS: published seq=%llu at %lf FPS\n",
+                   (unsigned long long)seq, (double)(seq - report_seq) / dt);
+            report_seq=seq;
+            report_time=frame_time;
+        }
+    }
+
+    printf("\nPublished %llu frames\n", (unsigned long long)seq);
+
+    framebus_close(&bus);
+    v4l2_frame_acquisition_shutdown();
+
+    return 0;
+}
@@ -0,0 +1,108 @@
+// Frame bus reader - example analytics process
+//
+// Maps the shared-memory frame bus read-only and computes the mean
+// luminance of each frame in place, without copying it out of the ring.
+// Start as many of these as you like against one framebus_daemon.
+//
+// Usage: framebus_reader [bus name] [frames]
+//
+// Reports how many frames it skipped (fell behind the camera) and how many
+// it had to discard because the daemon overwrote the slot mid-analysis
+// (lapped), plus the age of each frame when analysis completed.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <linux/videodev2.h>
+
+#include "framebus.h"
+
+static double delta_msec(struct timespec *stop, struct timespec *start)
+{
+    return ((double)(stop->tv_sec - start->tv_sec) * 1000.0) +
+           ((double)(stop->tv_nsec - start->tv_nsec) / 1000000.0);
+}
+
+
+// mean of the Y samples, every other byte for YUYV, every byte for GREY
+static double mean_luma(const unsigned char *p, unsigned int size, unsigned int pixelformat)
+{
+    unsigned long long sum=0;
+    unsigned int i, step, n=0;
+
+    step = (pixelformat == V4L2_PIX_FMT_YUYV) ? 2 : 1;
+
+    for(i=0; i < size; i+=step, n++)
+        sum += p[i];
+
+    return n ? (double)sum / (double)n : 0.0;
+}
+
+
+int main(int argc, char *argv[])
+{
+    char *bus_name=FRAMEBUS_DEFAULT_NAME;
+    unsigned long long frames=300, analyzed=0, skipped=0, lapped=0;
+    uint64_t last_seq=0, seq;
+    struct timespec done_time;
+    double luma, age, max_age=0.0, sum_age=0.0;
+    framebus_view_t view;
+    framebus_t bus;
+
+    if(argc > 1) bus_name=argv[1];
+    if(argc > 2) frames=strtoull(argv[2], NULL, 10);
+
+    if(framebus_open(&bus, bus_name) < 0)
+        exit(EXIT_FAILURE);
+
+    printf("Reading %ux%u frames from %s, %u slots, publisher pid %u\n",
+           bus.hdr->width, bus.hdr->height, bus_name, bus.hdr->slot_count, bus.hdr->publisher_pid);
+
+    // start from the newest frame, not the oldest one still in the ring
+    last_seq=framebus_latest(&bus);
+
+    while(analyzed < frames)
+    {
+        if((seq=framebus_wait(&bus, last_seq, 2000)) == last_seq)
+        {
+            fprintf(stderr, "no frames from publisher for 2 sec\n");
+            break;
+        }
+
+        // always analyze the newest frame, count the ones we could not keep up with
+        if(last_seq != 0)
+            skipped += (seq - last_seq - 1);
+        last_seq=seq;
+
+        if(framebus_acquire(&bus, seq, &view) < 0)
+        {
+            lapped++;
+            continue;
+        }
+
+        luma=mean_luma(view.data, view.bytesused, bus.hdr->pixelformat);
+
+        if(framebus_release(&bus, &view) < 0)
+        {
+            lapped++;
+            continue;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &done_time);
+        age=delta_msec(&done_time, &view.time_stamp);
+        sum_age+=age;
+        if(age > max_age) max_age=age;
+        analyzed++;
+
+        printf("seq=%llu, luma=%6.2lf, age=%6.3lf msec\n", (unsigned long long)seq, luma, age);
+    }
+
+    printf("analyzed=%llu, skipped=%llu, lapped=%llu, ave age=%lf msec, max age=%lf msec\n",
+           analyzed, skipped, lapped, analyzed ? sum_age/(double)analyzed : 0.0, max_age);
+
+    framebus_close(&bus);
+
+    return 0;
+}